@@ -1,15 +1,72 @@
 #include "py/runtime.h"
+#include "py/mperrno.h"
+#include "extmod/vfs.h"
+#include "extmod/vfs_lfs.h"
 #include "modch32fun.h"
+#include <string.h>
+
+// ==========================================================================
+// Low level flash helpers (shared with kv)
+// ==========================================================================
+// Addresses are the XIP addresses used for reading, the data source has to be
+// in RAM because the flash is busy while it is being programmed. These run
+// from RAM so the update swap can use them on the sectors it executes from.
+
+#ifdef CH5xx
+CH32FUN_RAMFUNC int ch32fun_flash_erase(uint32_t addr, uint32_t len) {
+	return FLASH_ROMA_ERASE(addr, len);
+}
+
+CH32FUN_RAMFUNC int ch32fun_flash_program(uint32_t addr, const void *buf, uint32_t len) {
+	return FLASH_ROMA_WRITE(addr, (void *)buf, len);
+}
+#else
+// the programming interface only takes the 0x08000000 alias of the code flash
+#define FLASH_PROGRAM_BASE 0x08000000
+
+CH32FUN_RAMFUNC static void flash_unlock(void) {
+	FLASH->KEYR = FLASH_KEY1;
+	FLASH->KEYR = FLASH_KEY2;
+}
+
+CH32FUN_RAMFUNC int ch32fun_flash_erase(uint32_t addr, uint32_t len) {
+	flash_unlock();
+	for (uint32_t a = addr; a < addr + len; a += FLASH_SECTOR_SIZE) {
+		FLASH->CTLR = CR_PER_Set;
+		FLASH->ADDR = FLASH_PROGRAM_BASE + a;
+		FLASH->CTLR = CR_STRT_Set | CR_PER_Set;
+		while (FLASH->STATR & FLASH_STATR_BSY);
+	}
+	FLASH->CTLR = CR_LOCK_Set;
+	return 0;
+}
+
+CH32FUN_RAMFUNC int ch32fun_flash_program(uint32_t addr, const void *buf, uint32_t len) {
+	const uint16_t *src = buf;
+	volatile uint16_t *dst = (volatile uint16_t *)(uintptr_t)(FLASH_PROGRAM_BASE + addr);
+
+	flash_unlock();
+	FLASH->CTLR = CR_PG_Set;
+	for (uint32_t i = 0; i < len / 2; i++) {
+		dst[i] = src[i];
+		while (FLASH->STATR & FLASH_STATR_BSY);
+	}
+	FLASH->CTLR = CR_LOCK_Set;
+	return 0;
+}
+#endif
 
 // ==========================================================================
 // ch5xx_flash Submodule
 // ==========================================================================
 
+// Usage: erase(addr), erases the whole sector addr is in
 static mp_obj_t fun_flash_erase(mp_obj_t addr_in) {
-	uint32_t addr = mp_obj_get_int(addr_in);
-	// FLASH_Unlock_Fast();
-	// FLASH_ErasePage_Fast(addr);
-	// FLASH_Lock_Fast();
+	uint32_t addr = mp_obj_get_int(addr_in) & ~(FLASH_SECTOR_SIZE - 1);
+	ch32fun_check_addr(addr, FLASH_SECTOR_SIZE, FLASH_START, FLASH_END);
+	if (ch32fun_flash_erase(addr, FLASH_SECTOR_SIZE) != 0) {
+		mp_raise_OSError(MP_EIO);
+	}
 	return mp_const_none;
 }
 static MP_DEFINE_CONST_FUN_OBJ_1(fun_flash_erase_obj, fun_flash_erase);
@@ -34,17 +91,29 @@ static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(fun_flash_read_obj, 1, 2, fun_flash_r
 
 static mp_obj_t fun_flash_write(mp_obj_t addr_in, mp_obj_t data_in) {
 	uint32_t addr = mp_obj_get_int(addr_in);
+	int ret;
+
+	if (addr & 3) {
+		mp_raise_ValueError(MP_ERROR_TEXT("address must be word aligned"));
+	}
 
 	if (mp_obj_is_int(data_in)) {
 		ch32fun_check_addr(addr, 4, FLASH_START, FLASH_END);
-		// uint32_t val = mp_obj_get_int(data_in);
-		// FLASH_ProgramWord(addr, val);
+		uint32_t val = mp_obj_get_int_truncated(data_in);
+		ret = ch32fun_flash_program(addr, &val, 4);
 	}
 	else {
 		mp_buffer_info_t bufinfo;
 		mp_get_buffer_raise(data_in, &bufinfo, MP_BUFFER_READ);
+		if (bufinfo.len & 3) {
+			mp_raise_ValueError(MP_ERROR_TEXT("length must be a multiple of 4"));
+		}
 		ch32fun_check_addr(addr, bufinfo.len, FLASH_START, FLASH_END);
-		// Programming loop...
+		ret = ch32fun_flash_program(addr, bufinfo.buf, bufinfo.len);
+	}
+
+	if (ret != 0) {
+		mp_raise_OSError(MP_EIO);
 	}
 	return mp_const_none;
 }
@@ -64,3 +133,151 @@ MP_DEFINE_CONST_OBJ_TYPE(
 	MP_TYPE_FLAG_NONE,
 	locals_dict, &flash_locals_dict
 );
+
+// ==========================================================================
+// Flash Block Device ch32fun.Flash()
+// ==========================================================================
+// Implements the extended block protocol over VFS_FLASH_START..VFS_FLASH_END,
+// so littlefs can be mounted on it. Blocks are erase sectors.
+
+#define VFS_BLOCK_COUNT (VFS_FLASH_SIZE / FLASH_SECTOR_SIZE)
+
+// Lowest address of the storage above the firmware (update scratch sector,
+// update state, filesystem, kv), for ch32fun_layout.ld
+__asm__(".globl ch32fun_storage_start\n.set ch32fun_storage_start, " MP_STRINGIFY(UPDATE_SCRATCH));
+
+typedef struct _ch32fun_flash_bdev_obj_t {
+	mp_obj_base_t base;
+} ch32fun_flash_bdev_obj_t;
+
+static const ch32fun_flash_bdev_obj_t ch32fun_flash_bdev_obj = {{&ch32fun_flash_bdev_type}};
+
+// The link time check can be defeated by another linker script, so the
+// region is not touched at all if the image reaches into it.
+static bool flash_bdev_usable(void) {
+	return FLASH_IMAGE_END <= VFS_FLASH_START;
+}
+
+static mp_obj_t flash_bdev_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args) {
+	mp_arg_check_num(n_args, n_kw, 0, 0, false);
+	if (!flash_bdev_usable()) {
+		mp_raise_OSError(MP_ENODEV);
+	}
+	return MP_OBJ_FROM_PTR(&ch32fun_flash_bdev_obj);
+}
+
+static uint32_t flash_bdev_addr(mp_obj_t block_in, size_t offset, size_t len) {
+	uint32_t addr = VFS_FLASH_START + mp_obj_get_int(block_in) * FLASH_SECTOR_SIZE + offset;
+	ch32fun_check_addr(addr, len, VFS_FLASH_START, VFS_FLASH_END);
+	return addr;
+}
+
+// Usage: readblocks(block, buf[, offset])
+static mp_obj_t flash_bdev_readblocks(size_t n_args, const mp_obj_t *args) {
+	mp_buffer_info_t bufinfo;
+	mp_get_buffer_raise(args[2], &bufinfo, MP_BUFFER_WRITE);
+	size_t offset = (n_args > 3) ? mp_obj_get_int(args[3]) : 0;
+
+	uint32_t addr = flash_bdev_addr(args[1], offset, bufinfo.len);
+	memcpy(bufinfo.buf, (const void *)(uintptr_t)addr, bufinfo.len);
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(flash_bdev_readblocks_obj, 3, 4, flash_bdev_readblocks);
+
+// Usage: writeblocks(block, buf[, offset]), without offset the blocks are erased first
+static mp_obj_t flash_bdev_writeblocks(size_t n_args, const mp_obj_t *args) {
+	mp_buffer_info_t bufinfo;
+	mp_get_buffer_raise(args[2], &bufinfo, MP_BUFFER_READ);
+	size_t offset = (n_args > 3) ? mp_obj_get_int(args[3]) : 0;
+
+	uint32_t addr = flash_bdev_addr(args[1], offset, bufinfo.len);
+	if (n_args == 3) {
+		uint32_t len = (bufinfo.len + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+		if (ch32fun_flash_erase(addr, len) != 0) {
+			mp_raise_OSError(MP_EIO);
+		}
+	}
+	if (ch32fun_flash_program(addr, bufinfo.buf, bufinfo.len) != 0) {
+		mp_raise_OSError(MP_EIO);
+	}
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(flash_bdev_writeblocks_obj, 3, 4, flash_bdev_writeblocks);
+
+// Usage: ioctl(op, arg)
+static mp_obj_t flash_bdev_ioctl(mp_obj_t self_in, mp_obj_t op_in, mp_obj_t arg_in) {
+	switch (mp_obj_get_int(op_in)) {
+	case MP_BLOCKDEV_IOCTL_INIT:
+	case MP_BLOCKDEV_IOCTL_DEINIT:
+	case MP_BLOCKDEV_IOCTL_SYNC:
+		return MP_OBJ_NEW_SMALL_INT(0);
+	case MP_BLOCKDEV_IOCTL_BLOCK_COUNT:
+		return MP_OBJ_NEW_SMALL_INT(VFS_BLOCK_COUNT);
+	case MP_BLOCKDEV_IOCTL_BLOCK_SIZE:
+		return MP_OBJ_NEW_SMALL_INT(FLASH_SECTOR_SIZE);
+	case MP_BLOCKDEV_IOCTL_BLOCK_ERASE: {
+		uint32_t addr = flash_bdev_addr(arg_in, 0, FLASH_SECTOR_SIZE);
+		return MP_OBJ_NEW_SMALL_INT(ch32fun_flash_erase(addr, FLASH_SECTOR_SIZE) ? -MP_EIO : 0);
+	}
+	default:
+		return mp_const_none;
+	}
+}
+static MP_DEFINE_CONST_FUN_OBJ_3(flash_bdev_ioctl_obj, flash_bdev_ioctl);
+
+static const mp_rom_map_elem_t flash_bdev_locals_dict_table[] = {
+	{ MP_ROM_QSTR(MP_QSTR_readblocks),  MP_ROM_PTR(&flash_bdev_readblocks_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_writeblocks), MP_ROM_PTR(&flash_bdev_writeblocks_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_ioctl),       MP_ROM_PTR(&flash_bdev_ioctl_obj) },
+};
+static MP_DEFINE_CONST_DICT(flash_bdev_locals_dict, flash_bdev_locals_dict_table);
+
+// NOTE: Not static
+MP_DEFINE_CONST_OBJ_TYPE(
+	ch32fun_flash_bdev_type,
+	MP_QSTR_Flash,
+	MP_TYPE_FLAG_NONE,
+	make_new, flash_bdev_make_new,
+	locals_dict, &flash_bdev_locals_dict
+);
+
+#if MICROPY_VFS
+static mp_obj_t flash_vfs_new(mp_obj_t bdev) {
+	mp_obj_t lfs_type = MP_OBJ_FROM_PTR(&mp_type_vfs_lfs2);
+
+	nlr_buf_t nlr;
+	if (nlr_push(&nlr) == 0) {
+		mp_obj_t vfs = mp_call_function_1(lfs_type, bdev);
+		nlr_pop();
+		return vfs;
+	}
+
+	// no valid filesystem yet (first boot)
+	printf("Formatting filesystem\n");
+	mp_call_function_1(mp_load_attr(lfs_type, MP_QSTR_mkfs), bdev);
+	return mp_call_function_1(lfs_type, bdev);
+}
+
+// Mounts littlefs on the flash block device at / and makes it the cwd.
+// VfsLfs2 defaults keep the read/prog caches and lookahead at 32 bytes each.
+void ch32fun_vfs_mount(void) {
+	if (!flash_bdev_usable()) {
+		printf("Firmware overlaps the filesystem, not mounted\n");
+		return;
+	}
+
+	nlr_buf_t nlr;
+	if (nlr_push(&nlr) == 0) {
+		mp_obj_t args[2] = {
+			flash_vfs_new(MP_OBJ_FROM_PTR(&ch32fun_flash_bdev_obj)),
+			MP_OBJ_NEW_QSTR(MP_QSTR__slash_)
+		};
+		mp_vfs_mount(2, args, (mp_map_t *)&mp_const_empty_map);
+		MP_STATE_VM(vfs_cur) = MP_STATE_VM(vfs_mount_table);
+		nlr_pop();
+	}
+	else {
+		mp_obj_print_exception(&mp_plat_print, (mp_obj_t)nlr.ret_val);
+	}
+}
+#endif
@@ -0,0 +1,706 @@
+#include "py/runtime.h"
+#include "py/mphal.h"
+#include "py/stream.h"
+#include "py/mperrno.h"
+#include "modch32fun.h"
+#include <string.h>
+
+#if MICROPY_PY_CH32FUN_CONN
+
+// ==========================================================================
+// Conn Submodule: BLE link layer connection, peripheral role
+// ==========================================================================
+// Advertises connectable (ADV_IND) and listens for a CONNECT_IND after each
+// one. Once connected every connection event is run by the interrupts: the
+// SysTick timer wakes up just before the anchor point and arms RX on the
+// next data channel (channel selection #1). The RF interrupt takes the
+// central's PDU, re-syncs the anchor, does SN/NESN and answers right away.
+// LL control PDUs a phone sends are answered here. Data is one L2CAP
+// channel (CID 0x0040) exposed as a stream, there is no ATT/GATT.
+// ADV_INDs go out through the iSLER TX queue. The answer to the central
+// can't wait for that, it has to be on air T_IFS after the central's PDU, so
+// the RF interrupt sends it directly: having just received, the radio has no
+// TX of its own in progress.
+#define CONN_ADV_ACCESS_ADDR 0x8E89BED6
+#define CONN_ADV_CRCINIT     0x555555
+#define CONN_ADV_LISTEN_US   1000 // after each ADV_IND, for a CONNECT_IND
+#define CONN_GUARD_US        150  // wake up this early for an anchor point
+#define CONN_LISTEN_US       600  // then listen this long past it
+#define CONN_CID             0x0040
+#define CONN_PDU_MAX         27   // LL payload without data length extension
+#define CONN_TX_SLOTS        8
+#define CONN_L2CAP_MTU       ((CONN_TX_SLOTS - 1) * CONN_PDU_MAX - 4) // fits the TX ring
+#ifdef CH570_CH572
+#define CONN_RX_BUF_SIZE     256
+#else
+#define CONN_RX_BUF_SIZE     1024
+#endif
+
+#define PDU_ADV_IND          0x00
+#define PDU_CONNECT_IND      0x05
+#define LLID_CONTINUE        1 // or empty PDU
+#define LLID_START           2
+#define LLID_CONTROL         3
+
+enum { CONN_IDLE, CONN_ADV, CONN_WAIT, CONN_CONNECTED };
+enum { PHASE_START, PHASE_END }; // of a connection event
+
+typedef struct _ch32fun_conn_obj_t {
+	mp_obj_base_t base;
+	mp_int_t timeout; // ms for read/write, -1 waits forever
+} ch32fun_conn_obj_t;
+
+typedef struct {
+	uint8_t hdr; // LLID, SN/NESN filled in when sent
+	uint8_t len;
+	uint8_t data[CONN_PDU_MAX];
+} conn_pdu_t;
+
+static volatile uint8_t conn_state;
+static ch32fun_timer_t conn_timer;
+static uint8_t conn_phase;
+
+// advertising
+static ch32fun_isler_txreq_t adv_req;
+static uint8_t adv_pdu[2 + 6 + 31];
+static uint8_t adv_len;
+static uint8_t adv_ch;
+static uint32_t adv_interval_us;
+
+// connection parameters from CONNECT_IND
+static uint32_t conn_aa;
+static uint32_t conn_crcinit;
+static uint32_t conn_interval;   // SysTick ticks
+static uint32_t conn_timeout;    // us, up to 32 s: longer than SysTick differences last at 144 MHz
+static uint32_t conn_window;     // SysTick ticks, transmit window
+static uint8_t conn_windowed;    // the next anchor is somewhere in the window
+static uint8_t conn_chm[5];
+static uint8_t conn_used[37];
+static uint8_t conn_used_count;
+static uint8_t conn_hop;
+static uint8_t conn_unmapped;
+static uint8_t conn_channel;
+static uint16_t conn_event;
+static uint32_t conn_anchor;     // SysTick, anchor of the current event
+static uint32_t conn_silent;     // us of missed events since the last PDU, for the supervision timeout
+static uint8_t conn_missed;
+
+// pending LL_CHANNEL_MAP_IND / LL_CONNECTION_UPDATE_IND
+static uint8_t upd_chm_pending;
+static uint8_t upd_chm[5];
+static uint16_t upd_chm_instant;
+static uint8_t upd_conn_pending;
+static uint32_t upd_window;
+static uint32_t upd_win_offset;
+static uint32_t upd_interval;
+static uint32_t upd_timeout;     // us
+static uint16_t upd_conn_instant;
+
+// SN/NESN
+static uint8_t conn_sn;
+static uint8_t conn_nesn;
+static conn_pdu_t conn_last;     // last PDU sent, resent until acked
+static uint8_t conn_last_kind;   // 0 empty, 1 control, 2 data
+static conn_pdu_t conn_ctrl;     // control response waiting to go out
+static volatile uint8_t conn_ctrl_pending;
+static volatile uint8_t conn_terminate; // drop once this event is over
+
+// TX, L2CAP frames cut into PDUs
+static conn_pdu_t tx_pdus[CONN_TX_SLOTS];
+static volatile uint8_t tx_head;
+static volatile uint8_t tx_tail;
+
+// RX, L2CAP payload for CONN_CID
+static uint8_t conn_rx_data[CONN_RX_BUF_SIZE];
+static volatile uint16_t conn_rx_head;
+static volatile uint16_t conn_rx_tail;
+static uint16_t l2cap_left;      // bytes of the current L2CAP frame still to come
+static uint16_t l2cap_cid;
+
+// counters for stats()
+static volatile uint32_t stat_events;
+static volatile uint32_t stat_missed;
+static volatile uint32_t stat_retransmit;
+static volatile uint32_t stat_rx_overflow;
+
+static size_t conn_rx_count(void) {
+	return (conn_rx_head + CONN_RX_BUF_SIZE - conn_rx_tail) % CONN_RX_BUF_SIZE;
+}
+
+static size_t tx_free(void) {
+	return CONN_TX_SLOTS - 1 - (tx_head + CONN_TX_SLOTS - tx_tail) % CONN_TX_SLOTS;
+}
+
+static inline uint32_t us_to_ticks(uint32_t us) {
+	return us * DELAY_US_TIME;
+}
+
+// run the timer at SysTick value `when`
+static void conn_at(uint32_t when, uint8_t phase) {
+	int32_t delta = (int32_t)(when - funSysTick32()) / (int32_t)DELAY_US_TIME;
+	conn_phase = phase;
+	ch32fun_timer_start(&conn_timer, (delta > 0) ? delta : 0);
+}
+
+static void conn_set_chm(const uint8_t *chm) {
+	memcpy(conn_chm, chm, 5);
+	conn_used_count = 0;
+	for (int ch = 0; ch < 37; ch++) {
+		if (chm[ch >> 3] & (1 << (ch & 7))) {
+			conn_used[conn_used_count++] = ch;
+		}
+	}
+	if (conn_used_count == 0) {
+		conn_used[conn_used_count++] = 0; // bogus map, avoid dividing by zero
+	}
+}
+
+// channel selection algorithm #1
+static uint8_t conn_next_channel(void) {
+	conn_unmapped = (conn_unmapped + conn_hop) % 37;
+	if (conn_chm[conn_unmapped >> 3] & (1 << (conn_unmapped & 7))) {
+		return conn_unmapped;
+	}
+	return conn_used[conn_unmapped % conn_used_count];
+}
+
+static void conn_listen(uint32_t aa, uint32_t crcinit, uint8_t channel) {
+	ch32fun_isler_rx(aa, channel, ch32fun_isler_phy_1m);
+	ch32fun_isler_crcinit(crcinit);
+}
+
+static void conn_start_adv(void) {
+	conn_state = CONN_ADV;
+	adv_ch = 37;
+	conn_at(funSysTick32(), PHASE_START);
+}
+
+// Back to advertising, from interrupt or Python context
+static void conn_drop(void) {
+	conn_terminate = 0;
+	conn_ctrl_pending = 0;
+	l2cap_left = 0;
+	tx_tail = tx_head;
+	conn_start_adv();
+}
+
+// --------------------------------------------------------------------------
+// Connection Events
+// --------------------------------------------------------------------------
+
+static void conn_queue_ctrl(const uint8_t *data, size_t len) {
+	conn_ctrl.hdr = LLID_CONTROL;
+	conn_ctrl.len = len;
+	memcpy(conn_ctrl.data, data, len);
+	conn_ctrl_pending = 1;
+}
+
+// Called from the RF ISR
+static void conn_rx_control(const uint8_t *p, size_t len) {
+	uint8_t rsp[9];
+	switch (p[0]) {
+		case 0x00: // LL_CONNECTION_UPDATE_IND
+			if (len >= 12) {
+				upd_window = us_to_ticks(p[1] * 1250);
+				upd_win_offset = us_to_ticks((p[2] | (p[3] << 8)) * 1250);
+				upd_interval = us_to_ticks((p[4] | (p[5] << 8)) * 1250);
+				upd_timeout = (p[8] | (p[9] << 8)) * 10000;
+				upd_conn_instant = p[10] | (p[11] << 8);
+				upd_conn_pending = 1;
+			}
+			break;
+		case 0x01: // LL_CHANNEL_MAP_IND
+			if (len >= 8) {
+				memcpy(upd_chm, &p[1], 5);
+				upd_chm_instant = p[6] | (p[7] << 8);
+				upd_chm_pending = 1;
+			}
+			break;
+		case 0x02: // LL_TERMINATE_IND
+			conn_terminate = 1;
+			break;
+		case 0x08: // LL_FEATURE_REQ
+			memset(rsp, 0, sizeof(rsp));
+			rsp[0] = 0x09; // LL_FEATURE_RSP, nothing optional
+			conn_queue_ctrl(rsp, 9);
+			break;
+		case 0x0C: // LL_VERSION_IND
+			rsp[0] = 0x0C;
+			rsp[1] = 0x09; // Bluetooth 5.0
+			rsp[2] = 0xFF; rsp[3] = 0xFF; // no company ID
+			rsp[4] = 0x00; rsp[5] = 0x00;
+			conn_queue_ctrl(rsp, 6);
+			break;
+		case 0x12: // LL_PING_REQ
+			rsp[0] = 0x13;
+			conn_queue_ctrl(rsp, 1);
+			break;
+		case 0x14: // LL_LENGTH_REQ, we stay at 27 bytes
+			rsp[0] = 0x15;
+			rsp[1] = CONN_PDU_MAX; rsp[2] = 0;
+			rsp[3] = 0x48; rsp[4] = 0x01; // 328 us
+			rsp[5] = CONN_PDU_MAX; rsp[6] = 0;
+			rsp[7] = 0x48; rsp[8] = 0x01;
+			conn_queue_ctrl(rsp, 9);
+			break;
+		case 0x07: // LL_UNKNOWN_RSP
+		case 0x09: case 0x13: case 0x15: // responses we never asked for
+			break;
+		default:
+			rsp[0] = 0x07; // LL_UNKNOWN_RSP
+			rsp[1] = p[0];
+			conn_queue_ctrl(rsp, 2);
+			break;
+	}
+}
+
+// Called from the RF ISR, L2CAP reassembly for CONN_CID
+static void conn_rx_data_pdu(uint8_t llid, const uint8_t *p, size_t len) {
+	if (llid == LLID_START) {
+		if (len < 4) {
+			l2cap_left = 0;
+			return;
+		}
+		l2cap_left = p[0] | (p[1] << 8);
+		l2cap_cid = p[2] | (p[3] << 8);
+		p += 4;
+		len -= 4;
+	}
+	if (len > l2cap_left) {
+		len = l2cap_left;
+	}
+	l2cap_left -= len;
+	if (l2cap_cid != CONN_CID) {
+		return; // ATT, signalling, ... not handled
+	}
+
+	for (size_t i = 0; i < len; i++) {
+		uint16_t next = (conn_rx_head + 1) % CONN_RX_BUF_SIZE;
+		if (next == conn_rx_tail) {
+			stat_rx_overflow++;
+			break;
+		}
+		conn_rx_data[conn_rx_head] = p[i];
+		conn_rx_head = next;
+	}
+}
+
+// Called from the RF ISR, answers the central within the same event
+static void conn_respond(void) {
+	if (conn_last_kind == 0 || conn_last.hdr & 0x80) {
+		// last one was acked (or empty), pick the next
+		if (conn_ctrl_pending) {
+			conn_last = conn_ctrl;
+			conn_last_kind = 1;
+		}
+		else if (tx_tail != tx_head) {
+			conn_last = tx_pdus[tx_tail];
+			conn_last_kind = 2;
+		}
+		else {
+			conn_last.hdr = LLID_CONTINUE;
+			conn_last.len = 0;
+			conn_last_kind = 0;
+		}
+	}
+	else {
+		stat_retransmit++;
+	}
+
+	uint8_t frame[2 + CONN_PDU_MAX];
+	frame[0] = (conn_last.hdr & 0x03) | (conn_nesn << 2) | (conn_sn << 3);
+	frame[1] = conn_last.len;
+	memcpy(&frame[2], conn_last.data, conn_last.len);
+	ch32fun_isler_crcinit(conn_crcinit);
+	ch32fun_isler_tx(conn_aa, frame, 2 + conn_last.len, conn_channel, ch32fun_isler_phy_1m);
+	conn_last.hdr &= 0x7F; // not acked yet
+}
+
+// Called from the RF ISR
+static void conn_rx_event(const uint8_t *frame, size_t len, uint32_t now) {
+	uint8_t hdr = frame[0];
+	uint8_t plen = frame[1];
+	if (plen + 2 > len) {
+		return;
+	}
+
+	// the central transmits at the anchor, we see the end of its PDU
+	conn_anchor = now - us_to_ticks((1 + 4 + 2 + plen + 3) * 8);
+	conn_silent = 0;
+	conn_missed = 0;
+	conn_windowed = 0;
+	conn_state = CONN_CONNECTED;
+	stat_events++;
+
+	// NESN != our SN acknowledges what we sent last
+	if (((hdr >> 2) & 1) != conn_sn) {
+		conn_sn ^= 1;
+		if (conn_last_kind == 1) {
+			conn_ctrl_pending = 0;
+			if (conn_last.data[0] == 0x02) {
+				conn_terminate = 1; // our LL_TERMINATE_IND got through
+			}
+		}
+		else if (conn_last_kind == 2) {
+			tx_tail = (tx_tail + 1) % CONN_TX_SLOTS;
+		}
+		conn_last.hdr |= 0x80;
+		conn_last_kind = 0;
+	}
+
+	// SN == our NESN is new data
+	if (((hdr >> 3) & 1) == conn_nesn) {
+		conn_nesn ^= 1;
+		uint8_t llid = hdr & 0x03;
+		if (llid == LLID_CONTROL && plen > 0) {
+			conn_rx_control(&frame[2], plen);
+		}
+		else if (plen > 0 || llid == LLID_START) {
+			conn_rx_data_pdu(llid, &frame[2], plen);
+		}
+	}
+
+	conn_respond();
+
+	if (conn_terminate) {
+		conn_drop();
+		return;
+	}
+	conn_at(conn_anchor + conn_interval - us_to_ticks(CONN_GUARD_US), PHASE_START);
+}
+
+// Called from the RF ISR
+static int conn_rx_hook(const uint8_t *frame, size_t len) {
+	uint32_t now = ch32fun_isler_rx_ticks();
+
+	if (conn_state == CONN_WAIT || conn_state == CONN_CONNECTED) {
+		if (!ch32fun_isler_rx_is(conn_aa, conn_channel)) {
+			return 0; // RX armed by someone else
+		}
+		conn_rx_event(frame, len, now);
+		return 1;
+	}
+	if (conn_state != CONN_ADV || !ch32fun_isler_rx_is(CONN_ADV_ACCESS_ADDR, adv_ch - 1) ||
+		(frame[0] & 0x0F) != PDU_CONNECT_IND || len < 36 || memcmp(&frame[8], &adv_pdu[2], 6) != 0) {
+		return 0;
+	}
+
+	// CONNECT_IND: InitA, AdvA, AA, CRCInit, WinSize, WinOffset, Interval, Latency, Timeout, ChM, Hop
+	const uint8_t *ll = &frame[14];
+	conn_aa = ll[0] | (ll[1] << 8) | (ll[2] << 16) | ((uint32_t)ll[3] << 24);
+	conn_crcinit = ll[4] | (ll[5] << 8) | (ll[6] << 16);
+	conn_window = us_to_ticks(ll[7] * 1250);
+	uint32_t win_offset = us_to_ticks((ll[8] | (ll[9] << 8)) * 1250);
+	conn_interval = us_to_ticks((ll[10] | (ll[11] << 8)) * 1250);
+	conn_timeout = (ll[14] | (ll[15] << 8)) * 10000;
+	conn_set_chm(&ll[16]);
+	conn_hop = ll[21] & 0x1F;
+
+	conn_unmapped = 0;
+	conn_event = 0xFFFF; // the first event is 0
+	conn_sn = conn_nesn = 0;
+	conn_last_kind = 0;
+	conn_last.hdr = 0x80;
+	conn_ctrl_pending = 0;
+	conn_terminate = 0;
+	upd_chm_pending = upd_conn_pending = 0;
+	l2cap_left = 0;
+	conn_silent = 0;
+	conn_missed = 0;
+
+	// transmit window opens 1.25 ms + WinOffset after the CONNECT_IND
+	conn_anchor = now + us_to_ticks(1250) + win_offset;
+	conn_windowed = 1;
+	conn_state = CONN_WAIT;
+	conn_at(conn_anchor - us_to_ticks(CONN_GUARD_US), PHASE_START);
+	return 1;
+}
+
+// Called from the iSLER TX interrupt once the ADV_IND is out
+static void conn_adv_done(ch32fun_isler_txreq_t *req) {
+	if (conn_state != CONN_ADV) {
+		return;
+	}
+	conn_listen(CONN_ADV_ACCESS_ADDR, CONN_ADV_CRCINIT, adv_ch);
+	adv_ch++;
+	ch32fun_timer_start(&conn_timer, (adv_ch <= 39) ? CONN_ADV_LISTEN_US : adv_interval_us);
+}
+
+// Called from the SysTick ISR
+static void conn_timer_cb(ch32fun_timer_t *timer) {
+	if (conn_state == CONN_ADV) {
+		if (adv_ch > 39) {
+			adv_ch = 37;
+		}
+		adv_req.channel = adv_ch;
+		ch32fun_isler_tx_queue(&adv_req);
+		return;
+	}
+	if (conn_state != CONN_WAIT && conn_state != CONN_CONNECTED) {
+		return;
+	}
+
+	if (conn_phase == PHASE_END) {
+		// nobody showed up, the next anchor is one interval on
+		conn_silent += conn_interval / DELAY_US_TIME;
+		if (conn_silent > conn_timeout) {
+			conn_drop(); // supervision timeout
+			return;
+		}
+		if (conn_missed < 255) {
+			conn_missed++;
+		}
+		stat_missed++;
+		conn_anchor += conn_interval;
+		uint32_t widen = us_to_ticks(CONN_GUARD_US) * (1 + conn_missed);
+		conn_at(conn_anchor - widen, PHASE_START);
+		return;
+	}
+
+	// start of an event, apply updates due at this instant
+	conn_event++;
+	if (upd_chm_pending && conn_event == upd_chm_instant) {
+		conn_set_chm(upd_chm);
+		upd_chm_pending = 0;
+	}
+	if (upd_conn_pending && conn_event == upd_conn_instant) {
+		conn_interval = upd_interval;
+		conn_timeout = upd_timeout;
+		upd_conn_pending = 0;
+
+		// the event at the instant moves into a transmit window that opens
+		// 1.25 ms + WinOffset after the old anchor, come back for it then
+		conn_anchor += us_to_ticks(1250) + upd_win_offset;
+		conn_window = upd_window;
+		conn_windowed = 1;
+		conn_event--;
+		conn_at(conn_anchor - us_to_ticks(CONN_GUARD_US), PHASE_START);
+		return;
+	}
+
+	conn_channel = conn_next_channel();
+	conn_listen(conn_aa, conn_crcinit, conn_channel);
+
+	uint32_t listen = us_to_ticks(CONN_GUARD_US * (1 + conn_missed) + CONN_LISTEN_US);
+	if (conn_windowed) {
+		listen += conn_window;
+	}
+	conn_at(conn_anchor + listen, PHASE_END);
+}
+
+// ==========================================================================
+// Python Methods
+// ==========================================================================
+
+static void conn_wait(ch32fun_conn_obj_t *self, int (*cond)(void)) {
+	mp_uint_t start = mp_hal_ticks_ms();
+	while (!cond()) {
+		if (conn_state == CONN_IDLE) {
+			mp_raise_OSError(MP_ENOTCONN);
+		}
+		if (self->timeout >= 0 && mp_hal_ticks_ms() - start >= (mp_uint_t)self->timeout) {
+			mp_raise_OSError(MP_ETIMEDOUT);
+		}
+		mp_hal_background_processing();
+	}
+}
+
+static int conn_can_read(void) {
+	return conn_rx_count() > 0;
+}
+
+static int conn_can_write(void) {
+	return conn_state == CONN_CONNECTED && tx_free() == CONN_TX_SLOTS - 1;
+}
+
+static int conn_is_dropped(void) {
+	return conn_state != CONN_CONNECTED;
+}
+
+// Usage: ch32fun.Conn(mac, adv_data=b'', interval_ms=100, timeout=-1)
+static mp_obj_t conn_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+	enum { ARG_mac, ARG_adv_data, ARG_interval_ms, ARG_timeout };
+	static const mp_arg_t allowed_args[] = {
+		{ MP_QSTR_mac,         MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+		{ MP_QSTR_adv_data,    MP_ARG_OBJ, {.u_obj = mp_const_none} },
+		{ MP_QSTR_interval_ms, MP_ARG_INT, {.u_int = 100} },
+		{ MP_QSTR_timeout,     MP_ARG_INT, {.u_int = -1} },
+	};
+
+	mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+	mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+	mp_buffer_info_t mac;
+	mp_get_buffer_raise(args[ARG_mac].u_obj, &mac, MP_BUFFER_READ);
+	if (mac.len != 6) {
+		mp_raise_ValueError(MP_ERROR_TEXT("MAC address is 6 bytes"));
+	}
+	mp_buffer_info_t data = { .buf = NULL, .len = 0 };
+	if (args[ARG_adv_data].u_obj != mp_const_none) {
+		mp_get_buffer_raise(args[ARG_adv_data].u_obj, &data, MP_BUFFER_READ);
+		if (data.len > 31) {
+			mp_raise_ValueError(MP_ERROR_TEXT("payload too large"));
+		}
+	}
+
+	conn_state = CONN_IDLE;
+	ch32fun_timer_stop(&conn_timer);
+	ch32fun_isler_tx_cancel(&adv_req);
+
+	adv_pdu[0] = PDU_ADV_IND;
+	adv_pdu[1] = 6 + data.len;
+	for (int i = 0; i < 6; i++) {
+		adv_pdu[2 + i] = ((uint8_t*)mac.buf)[5 - i];
+	}
+	if (data.len) {
+		memcpy(&adv_pdu[8], data.buf, data.len);
+	}
+	adv_len = 8 + data.len;
+	adv_interval_us = args[ARG_interval_ms].u_int * 1000;
+	adv_req.frame = adv_pdu;
+	adv_req.len = adv_len;
+	adv_req.access_addr = CONN_ADV_ACCESS_ADDR;
+	adv_req.phy_mode = ch32fun_isler_phy_1m;
+	adv_req.done = conn_adv_done;
+
+	conn_rx_head = conn_rx_tail = 0;
+	tx_head = tx_tail = 0;
+	stat_events = stat_missed = stat_retransmit = stat_rx_overflow = 0;
+
+	conn_timer.callback = conn_timer_cb;
+	ch32fun_isler_hook(conn_rx_hook, 1);
+	conn_start_adv();
+
+	ch32fun_conn_obj_t *self = mp_obj_malloc(ch32fun_conn_obj_t, type);
+	self->timeout = args[ARG_timeout].u_int;
+	return MP_OBJ_FROM_PTR(self);
+}
+
+static mp_uint_t conn_read(mp_obj_t self_in, void *buf_in, mp_uint_t size, int *errcode) {
+	ch32fun_conn_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	uint8_t *buf = buf_in;
+
+	if (size == 0) {
+		return 0;
+	}
+	conn_wait(self, conn_can_read);
+
+	mp_uint_t n = 0;
+	while (n < size && conn_rx_count() > 0) {
+		buf[n++] = conn_rx_data[conn_rx_tail];
+		conn_rx_tail = (conn_rx_tail + 1) % CONN_RX_BUF_SIZE;
+	}
+	return n;
+}
+
+// Each write is cut into L2CAP frames of up to CONN_L2CAP_MTU bytes
+static mp_uint_t conn_write(mp_obj_t self_in, const void *buf_in, mp_uint_t size, int *errcode) {
+	ch32fun_conn_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	const uint8_t *buf = buf_in;
+
+	for (mp_uint_t done = 0; done < size; ) {
+		size_t n = (size - done < CONN_L2CAP_MTU) ? size - done : CONN_L2CAP_MTU;
+		conn_wait(self, conn_can_write);
+
+		uint8_t l2cap[4] = { n & 0xFF, n >> 8, CONN_CID & 0xFF, CONN_CID >> 8 };
+		size_t pos = 0; // of the L2CAP frame, header included
+		while (pos < n + 4) {
+			conn_pdu_t *pdu = &tx_pdus[tx_head];
+			size_t chunk = (n + 4 - pos < CONN_PDU_MAX) ? n + 4 - pos : CONN_PDU_MAX;
+			pdu->hdr = (pos == 0) ? LLID_START : LLID_CONTINUE;
+			pdu->len = chunk;
+			for (size_t i = 0; i < chunk; i++, pos++) {
+				pdu->data[i] = (pos < 4) ? l2cap[pos] : buf[done + pos - 4];
+			}
+			tx_head = (tx_head + 1) % CONN_TX_SLOTS;
+		}
+		done += n;
+	}
+	return size;
+}
+
+static mp_uint_t conn_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_t arg, int *errcode) {
+	ch32fun_conn_obj_t *self = MP_OBJ_TO_PTR(self_in);
+
+	if (request == MP_STREAM_POLL) {
+		mp_uint_t ret = 0;
+		if ((arg & MP_STREAM_POLL_RD) && conn_can_read()) ret |= MP_STREAM_POLL_RD;
+		if ((arg & MP_STREAM_POLL_WR) && conn_can_write()) ret |= MP_STREAM_POLL_WR;
+		return ret;
+	}
+	else if (request == MP_STREAM_CLOSE) {
+		if (conn_state == CONN_CONNECTED) {
+			static const uint8_t terminate[2] = { 0x02, 0x13 }; // LL_TERMINATE_IND, user terminated
+			conn_queue_ctrl(terminate, 2);
+			mp_int_t timeout = self->timeout;
+			self->timeout = 1000;
+			nlr_buf_t nlr;
+			if (nlr_push(&nlr) == 0) {
+				conn_wait(self, conn_is_dropped);
+				nlr_pop();
+			}
+			self->timeout = timeout;
+		}
+		conn_state = CONN_IDLE;
+		ch32fun_timer_stop(&conn_timer);
+		ch32fun_isler_tx_cancel(&adv_req);
+		ch32fun_isler_hook(conn_rx_hook, 0);
+		return 0;
+	}
+
+	*errcode = MP_EINVAL;
+	return MP_STREAM_ERROR;
+}
+
+// Usage: conn.connected()
+static mp_obj_t conn_connected(mp_obj_t self_in) {
+	return mp_obj_new_bool(conn_state == CONN_CONNECTED);
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(conn_connected_obj, conn_connected);
+
+// Usage: conn.any() -> bytes waiting to be read
+static mp_obj_t conn_any(mp_obj_t self_in) {
+	return MP_OBJ_NEW_SMALL_INT(conn_rx_count());
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(conn_any_obj, conn_any);
+
+// Usage: conn.stats() -> (events, missed, retransmitted, rx overflow)
+static mp_obj_t conn_stats(mp_obj_t self_in) {
+	mp_obj_t items[4] = {
+		mp_obj_new_int_from_uint(stat_events),
+		mp_obj_new_int_from_uint(stat_missed),
+		mp_obj_new_int_from_uint(stat_retransmit),
+		mp_obj_new_int_from_uint(stat_rx_overflow),
+	};
+	return mp_obj_new_tuple(4, items);
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(conn_stats_obj, conn_stats);
+
+static const mp_rom_map_elem_t conn_locals_dict_table[] = {
+	{ MP_ROM_QSTR(MP_QSTR_read),      MP_ROM_PTR(&mp_stream_read_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_readinto),  MP_ROM_PTR(&mp_stream_readinto_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_write),     MP_ROM_PTR(&mp_stream_write_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_close),     MP_ROM_PTR(&mp_stream_close_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_connected), MP_ROM_PTR(&conn_connected_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_any),       MP_ROM_PTR(&conn_any_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_stats),     MP_ROM_PTR(&conn_stats_obj) },
+};
+static MP_DEFINE_CONST_DICT(conn_locals_dict, conn_locals_dict_table);
+
+static const mp_stream_p_t conn_stream_p = {
+	.read = conn_read,
+	.write = conn_write,
+	.ioctl = conn_ioctl,
+};
+
+// NOTE: Not static
+MP_DEFINE_CONST_OBJ_TYPE(
+	ch32fun_conn_type,
+	MP_QSTR_Conn,
+	MP_TYPE_FLAG_ITER_IS_STREAM,
+	make_new, conn_make_new,
+	protocol, &conn_stream_p,
+	locals_dict, &conn_locals_dict
+);
+
+#endif // MICROPY_PY_CH32FUN_CONN
@@ -1,7 +1,8 @@
 #include "py/runtime.h"
-#include "py/ringbuf.h"
+#include "py/mphal.h"
 #include "py/objstr.h"
 #include "modch32fun.h"
+#include <string.h>
 
 // ==========================================================================
 // iSLER Submodule
@@ -12,46 +13,871 @@ void ISLER_CALLBACK(void); // this should have been in extralibs/iSLER.h
 #include "iSLER.h"
 
 // ==========================================================================
-// RX Ring Buffer Implementation
+// RX Packet Queue
 // ==========================================================================
-// We need a buffer to store packets because Python might not read them fast enough.
-// Size: 512 bytes (approx 2 large packets or many small ones)
-#define RX_BUF_SIZE 512
+// Fixed slots holding one frame each, so packet boundaries survive. The ISR
+// stamps every frame with its RSSI, channel and arrival time.
+#ifdef CH570_CH572
+#define ISLER_RX_SLOTS     6
+#define ISLER_RX_SLOT_SIZE 64  // legacy advertising PDUs fit, longer frames are truncated
+#else
+#define ISLER_RX_SLOTS     8
+#define ISLER_RX_SLOT_SIZE 260 // any frame (2 byte header + 255 byte payload)
+#endif
 
 typedef struct {
-	uint8_t buf[RX_BUF_SIZE];
-	volatile uint16_t head;
-	volatile uint16_t tail;
-} isler_ringbuf_t;
+	uint32_t timestamp; // mp_hal_ticks_us() at the RX interrupt
+	uint16_t len;       // bytes stored in frame
+	int8_t rssi;
+	uint8_t channel;
+	uint8_t frame[ISLER_RX_SLOT_SIZE];
+} isler_rx_slot_t;
 
-static isler_ringbuf_t rx_fifo;
+static isler_rx_slot_t rx_slots[ISLER_RX_SLOTS];
+static volatile uint8_t rx_slot_head;  // next slot the ISR fills
+static volatile uint8_t rx_slot_tail;  // next slot Python reads
+static uint8_t isler_rx_channel;  // channel RX was last armed on
+static uint32_t isler_rx_aa;      // and its access address and PHY, for ch32fun_isler_resume()
+static uint8_t isler_rx_phy;
+static uint8_t isler_rx_armed;
 
-// Helper to push data (Called from ISR)
-static void rx_fifo_push(const uint8_t *data, size_t len) {
-	for (size_t i = 0; i < len; i++) {
-		uint16_t next = (rx_fifo.head + 1) % RX_BUF_SIZE;
-		if (next != rx_fifo.tail) { // Only push if not full
-			rx_fifo.buf[rx_fifo.head] = data[i];
-			rx_fifo.head = next;
+// see Extended Advertising, while a chain is followed the radio is not ours
+enum { EXT_IDLE, EXT_CHAIN, EXT_DONE };
+static volatile uint8_t ext_rx_state;
+
+// counters for stats()
+static volatile uint32_t rx_frames;    // every frame the radio delivered
+static volatile uint32_t rx_received;
+static volatile uint32_t rx_dropped;   // queue was full
+static volatile uint32_t rx_truncated; // frame longer than a slot
+
+// Called from ISR, returns 0 if the queue was full
+static int rx_queue_push(const uint8_t *frame, size_t len, int8_t rssi, uint32_t timestamp) {
+	uint8_t next = (rx_slot_head + 1) % ISLER_RX_SLOTS;
+	rx_received++;
+	if (next == rx_slot_tail) {
+		rx_dropped++;
+		return 0;
+	}
+
+	isler_rx_slot_t *slot = &rx_slots[rx_slot_head];
+	if (len > ISLER_RX_SLOT_SIZE) {
+		len = ISLER_RX_SLOT_SIZE;
+		rx_truncated++;
+	}
+	memcpy(slot->frame, frame, len);
+	slot->len = len;
+	slot->rssi = rssi;
+	slot->channel = isler_rx_channel;
+	slot->timestamp = timestamp;
+	rx_slot_head = next;
+	return 1;
+}
+
+// Called from Python context, NULL if empty
+static isler_rx_slot_t *rx_queue_peek(void) {
+	return (rx_slot_head == rx_slot_tail) ? NULL : &rx_slots[rx_slot_tail];
+}
+
+static void rx_queue_pop(void) {
+	rx_slot_tail = (rx_slot_tail + 1) % ISLER_RX_SLOTS;
+}
+
+static size_t rx_queue_count(void) {
+	return (rx_slot_head + ISLER_RX_SLOTS - rx_slot_tail) % ISLER_RX_SLOTS;
+}
+
+// ==========================================================================
+// Continuous Scanner
+// ==========================================================================
+// scan(window, interval) keeps RX armed from the interrupts: the LLE ISR
+// re-arms after every packet and a timer hops 37 -> 38 -> 39 every interval,
+// listening for window ms of it. Repeats of an advertiser with an unchanged
+// payload are dropped, so Python only wakes up for something new.
+#define ISLER_ADV_ACCESS_ADDR 0x8E89BED6
+
+#ifdef CH570_CH572
+#define ISLER_SEEN_SIZE 32
+#else
+#define ISLER_SEEN_SIZE 64
+#endif
+
+static ch32fun_timer_t scan_timer;
+static volatile uint8_t scan_active;
+static volatile uint8_t scan_listening;
+static uint8_t scan_phy;
+static uint32_t scan_window_us;
+static uint32_t scan_interval_us;
+
+// direct mapped set of (AdvA, payload) hashes, a collision just evicts
+static uint32_t scan_seen[ISLER_SEEN_SIZE];
+
+// FNV-1a over AdvA and the payload, 0 is reserved for empty entries
+static uint32_t scan_hash(const uint8_t *frame, size_t len) {
+	uint32_t h = 0x811C9DC5;
+	for (size_t i = 2; i < len; i++) {
+		h = (h ^ frame[i]) * 0x01000193;
+	}
+	return h ? h : 1;
+}
+
+// Called from ISR. A hash is only added once its frame made it into the
+// queue, a frame dropped on a full queue is taken again when it repeats.
+static int scan_is_new(uint32_t h) {
+	return scan_seen[h % ISLER_SEEN_SIZE] != h;
+}
+
+static void scan_seen_add(uint32_t h) {
+	scan_seen[h % ISLER_SEEN_SIZE] = h;
+}
+
+static uint8_t scan_channel_next(uint8_t channel) {
+	return (channel >= 37 && channel < 39) ? channel + 1 : 37;
+}
+
+static void scan_arm(void) {
+	if (ext_rx_state == EXT_CHAIN) {
+		return; // following an AUX chain, don't pull the radio away
+	}
+	isler_rx_channel = scan_channel_next(isler_rx_channel);
+	iSLERRX(ISLER_ADV_ACCESS_ADDR, isler_rx_channel, scan_phy);
+}
+
+// Called from the SysTick ISR
+static void scan_timer_cb(ch32fun_timer_t *timer) {
+	if (scan_listening && scan_window_us < scan_interval_us) {
+		// window is over, stay deaf until the next interval
+		scan_listening = 0;
+		ch32fun_timer_start(timer, scan_interval_us - scan_window_us);
+		return;
+	}
+
+	scan_listening = 1;
+	scan_arm();
+	ch32fun_timer_start(timer, scan_window_us);
+}
+
+static void scan_stop(void) {
+	scan_active = 0;
+	scan_listening = 0;
+	ch32fun_timer_stop(&scan_timer);
+}
+
+// ==========================================================================
+// RX Filter
+// ==========================================================================
+// Rules are checked in the ISR before a packet is queued. A rule matches
+// when all of its set fields match, a packet is kept when any rule matches
+// (or when there are no rules). Frames are laid out as
+// [header, len, AdvA (6, LSB first), AD structures...].
+#ifdef CH570_CH572
+#define ISLER_FILTER_RULES 4
+#else
+#define ISLER_FILTER_RULES 8
+#endif
+
+#define ISLER_ANY -1
+
+typedef struct {
+	uint8_t mac[6];  // prefix in display order (MSB first)
+	uint8_t mac_len; // 0 = any address
+	int8_t rssi;     // minimum RSSI
+	int16_t ad_type; // ISLER_ANY or an AD type that has to be present
+	int32_t company; // ISLER_ANY or a manufacturer company ID
+	volatile uint32_t hits;
+} isler_filter_t;
+
+static isler_filter_t filter_rules[ISLER_FILTER_RULES];
+static volatile uint8_t filter_count;
+static volatile uint32_t filter_rejected;
+
+// Find AD structure `type` in the advertising data, returns its data or NULL
+static const uint8_t *isler_ad_find(const uint8_t *ad, size_t len, uint8_t type, size_t *out_len) {
+	size_t i = 0;
+	while (i + 1 < len) {
+		uint8_t field_len = ad[i];
+		if (field_len == 0 || i + 1 + field_len > len) {
+			break; // padding or malformed
+		}
+		if (ad[i + 1] == type) {
+			*out_len = field_len - 1;
+			return &ad[i + 2];
 		}
+		i += 1 + field_len;
 	}
+	return NULL;
 }
 
-// Helper to pop data (Called from Python context)
-static int rx_fifo_pop(void) {
-	if (rx_fifo.head == rx_fifo.tail) {
-		return -1; // Empty
+static int filter_rule_match(const isler_filter_t *rule, const uint8_t *frame, size_t len, int8_t rssi) {
+	if (rssi < rule->rssi) {
+		return 0;
+	}
+	if (len < 8) {
+		// no AdvA, only a rule without address or AD checks matches
+		return rule->mac_len == 0 && rule->ad_type == ISLER_ANY && rule->company == ISLER_ANY;
+	}
+	for (int i = 0; i < rule->mac_len; i++) {
+		if (rule->mac[i] != frame[7 - i]) {
+			return 0;
+		}
 	}
-	int val = rx_fifo.buf[rx_fifo.tail];
-	rx_fifo.tail = (rx_fifo.tail + 1) % RX_BUF_SIZE;
-	return val;
+
+	size_t field_len;
+	if (rule->ad_type != ISLER_ANY &&
+		isler_ad_find(&frame[8], len - 8, rule->ad_type, &field_len) == NULL) {
+		return 0;
+	}
+	if (rule->company != ISLER_ANY) {
+		const uint8_t *mfg = isler_ad_find(&frame[8], len - 8, 0xFF, &field_len);
+		if (mfg == NULL || field_len < 2 || (mfg[0] | (mfg[1] << 8)) != rule->company) {
+			return 0;
+		}
+	}
+	return 1;
 }
 
-static size_t rx_fifo_count(void) {
-	if (rx_fifo.head >= rx_fifo.tail) {
-		return rx_fifo.head - rx_fifo.tail;
+// Called from ISR
+static int filter_accept(const uint8_t *frame, size_t len, int8_t rssi) {
+	if (filter_count == 0) {
+		return 1;
+	}
+	for (int i = 0; i < filter_count; i++) {
+		if (filter_rule_match(&filter_rules[i], frame, len, rssi)) {
+			filter_rules[i].hits++;
+			return 1;
+		}
 	}
-	return (RX_BUF_SIZE - rx_fifo.tail) + rx_fifo.head;
+	filter_rejected++;
+	return 0;
+}
+
+// ==========================================================================
+// TX Queue and Advertising Scheduler
+// ==========================================================================
+// Frames are built once in Python context and sent one channel per tick of
+// the SysTick timer. adv() queues one-shot frames, advertise() keeps a
+// double buffered template that the timer sends every interval + jitter.
+// iSLERTX() only returns once the frame is out, so the timer just pends the
+// software interrupt, which sends at the lowest priority: SysTick does not
+// sit out the air time and other timers keep their deadlines. The protocols
+// on top (extended advertising, Link, timesync, Conn) hand their frames to
+// the same interrupt through ch32fun_isler_tx_queue(), so only one TX is
+// ever on the radio. Those go ahead of the scheduler's frames.
+#ifdef CH570_CH572
+#define ISLER_TX_QUEUE      2
+#define ISLER_TX_FRAME_SIZE 40  // legacy advertising PDU: 2 + AdvA + 31
+#else
+#define ISLER_TX_QUEUE      4
+#define ISLER_TX_FRAME_SIZE 258
+#endif
+#define ISLER_ADV_FRAME_SIZE 258 // adv() takes up to 250 payload bytes on every chip
+#define ISLER_TX_GAP_US     400 // between the 37/38/39 copies of a frame
+
+void SW_Handler(void) __attribute__((interrupt)) __attribute__((used));
+
+typedef struct {
+	uint16_t len;
+	uint8_t frame[ISLER_TX_FRAME_SIZE];
+} isler_tx_frame_t;
+
+// one-shot frames from adv()
+typedef struct {
+	uint16_t len;
+	uint8_t frame[ISLER_ADV_FRAME_SIZE];
+} isler_adv_frame_t;
+
+static isler_adv_frame_t tx_frames[ISLER_TX_QUEUE];
+static volatile uint8_t tx_head;
+static volatile uint8_t tx_tail;
+
+// periodic advertising, Python fills the template adv_current is not pointing at
+static isler_tx_frame_t adv_templates[2];
+static isler_tx_frame_t *volatile adv_current;
+static volatile uint8_t adv_due;
+static uint32_t adv_interval_us;
+static uint32_t adv_jitter_us;
+static uint32_t adv_seed;
+
+static ch32fun_timer_t tx_timer;
+static ch32fun_timer_t adv_timer;
+static const void *volatile tx_sending; // the frame on air, one of the kinds above
+static const uint8_t *tx_data;
+static uint16_t tx_len;
+static const isler_tx_frame_t *relay_ready(void);
+static void relay_sent(const void *f);
+static uint8_t tx_channel;
+static volatile uint8_t tx_busy;
+static volatile uint8_t tx_tick; // tx_timer ran out, the scheduler sends next
+static ch32fun_isler_txreq_t *tx_req_head;
+static ch32fun_isler_txreq_t *tx_req_tail;
+
+// Builds a legacy ADV_NONCONN_IND into frame, size bytes of room
+static void isler_build_adv(uint8_t *frame, uint16_t *len, size_t size, const mp_buffer_info_t *mac, const mp_buffer_info_t *payload) {
+	if (payload->len + 6 + 2 > size) {
+		mp_raise_ValueError(MP_ERROR_TEXT("payload too large"));
+	}
+	else if (mac->len != 6) {
+		mp_raise_ValueError(MP_ERROR_TEXT("MAC address is 6 bytes"));
+	}
+
+	frame[0] = 0x02; // PDU
+	frame[1] = (uint8_t)payload->len +6; // +6 = mac
+	for(int i = 0; i < 6; i++) {
+		frame[2 +i] = ((uint8_t*)mac->buf)[5 -i];
+	}
+	if (payload->len > 0) {
+		memcpy(&frame[8], payload->buf, payload->len);
+	}
+	*len = payload->len +6 +2;
+}
+
+static void tx_pick(const void *f, const uint8_t *data, uint16_t len) {
+	tx_sending = f;
+	tx_data = data;
+	tx_len = len;
+	tx_channel = 37;
+}
+
+static ch32fun_isler_txreq_t *tx_req_pop(void) {
+	uint32_t mstatus = __get_MSTATUS();
+	__disable_irq();
+	ch32fun_isler_txreq_t *req = tx_req_head;
+	if (req != NULL) {
+		tx_req_head = req->next;
+		req->queued = 0;
+	}
+	__set_MSTATUS(mstatus);
+	return req;
+}
+
+// Software interrupt, pended by tx_timer_cb() and ch32fun_isler_tx_queue()
+void SW_Handler(void) {
+	ch32fun_isler_txreq_t *req;
+	while ((req = tx_req_pop()) != NULL) {
+		if (req->start != NULL) {
+			req->start(req);
+		}
+		iSLERTX(req->access_addr, (uint8_t *)req->frame, req->len, req->channel, req->phy_mode);
+		if (!tx_busy) {
+			ch32fun_isler_resume();
+		}
+		if (req->done != NULL) {
+			req->done(req);
+		}
+	}
+	if (!tx_tick) {
+		return;
+	}
+	tx_tick = 0;
+
+	if (tx_sending == NULL) {
+		const isler_tx_frame_t *f;
+		if (tx_head != tx_tail) {
+			tx_pick(&tx_frames[tx_tail], tx_frames[tx_tail].frame, tx_frames[tx_tail].len);
+		}
+		else if ((f = relay_ready()) != NULL) {
+			tx_pick(f, f->frame, f->len);
+		}
+		else if (adv_due && (f = adv_current) != NULL) {
+			adv_due = 0;
+			tx_pick(f, f->frame, f->len);
+		}
+		else {
+			tx_busy = 0;
+			ch32fun_isler_resume(); // TX dropped the receiver
+			return;
+		}
+	}
+
+	iSLERTX(ISLER_ADV_ACCESS_ADDR, (uint8_t *)tx_data, tx_len, tx_channel, PHY_1M);
+
+	if (tx_channel < 39) {
+		tx_channel++;
+	}
+	else {
+		if (tx_sending == &tx_frames[tx_tail]) {
+			tx_tail = (tx_tail + 1) % ISLER_TX_QUEUE;
+		}
+		relay_sent(tx_sending);
+		tx_sending = NULL;
+	}
+	ch32fun_timer_start(&tx_timer, ISLER_TX_GAP_US);
+}
+
+// Called from the SysTick ISR
+static void tx_timer_cb(ch32fun_timer_t *timer) {
+	tx_tick = 1;
+	NVIC_SetPendingIRQ(Software_IRQn);
+}
+
+static void tx_irq_enable(void) {
+	static int irq_enabled = 0;
+	if (!irq_enabled) {
+		NVIC_SetPriority(Software_IRQn, 0xF0); // below SysTick and the radio
+		NVIC_EnableIRQ(Software_IRQn);
+		irq_enabled = 1;
+	}
+}
+
+// Any context. Returns 0 when req is still waiting from an earlier call.
+int ch32fun_isler_tx_queue(ch32fun_isler_txreq_t *req) {
+	tx_irq_enable();
+	uint32_t mstatus = __get_MSTATUS();
+	__disable_irq();
+	int queued = !req->queued;
+	if (queued) {
+		req->queued = 1;
+		req->next = NULL;
+		if (tx_req_head == NULL) {
+			tx_req_head = req;
+		}
+		else {
+			tx_req_tail->next = req;
+		}
+		tx_req_tail = req;
+		NVIC_SetPendingIRQ(Software_IRQn);
+	}
+	__set_MSTATUS(mstatus);
+	return queued;
+}
+
+// Any context, takes req off the queue if it has not gone out yet
+void ch32fun_isler_tx_cancel(ch32fun_isler_txreq_t *req) {
+	uint32_t mstatus = __get_MSTATUS();
+	__disable_irq();
+	ch32fun_isler_txreq_t *prev = NULL;
+	for (ch32fun_isler_txreq_t *r = tx_req_head; r != NULL; prev = r, r = r->next) {
+		if (r == req) {
+			if (prev == NULL) {
+				tx_req_head = r->next;
+			}
+			else {
+				prev->next = r->next;
+			}
+			if (tx_req_tail == r) {
+				tx_req_tail = prev;
+			}
+			req->queued = 0;
+			break;
+		}
+	}
+	__set_MSTATUS(mstatus);
+}
+
+static void tx_kick(void) {
+	tx_irq_enable();
+
+	uint32_t mstatus = __get_MSTATUS();
+	__disable_irq();
+	if (!tx_busy) {
+		tx_busy = 1;
+		tx_timer.callback = tx_timer_cb;
+		ch32fun_timer_start(&tx_timer, 0);
+	}
+	__set_MSTATUS(mstatus);
+}
+
+// Called from the SysTick ISR
+static void adv_timer_cb(ch32fun_timer_t *timer) {
+	uint32_t delay = adv_interval_us;
+	if (adv_jitter_us) {
+		adv_seed = adv_seed * 1664525 + 1013904223;
+		delay += (adv_seed >> 8) % adv_jitter_us;
+	}
+	ch32fun_timer_start(timer, delay);
+
+	adv_due = 1;
+	tx_kick();
+}
+
+// ==========================================================================
+// Mesh Relay
+// ==========================================================================
+// Managed flooding, done entirely in the interrupts. Mesh frames carry a
+// manufacturer data AD structure: [company (2), ttl, msg_id (2), src (2), dst (2), ...].
+// A relay remembers recent (src, msg_id) pairs, and repeats a new message
+// with its ttl decremented after a random backoff. It drops the repeat if
+// it hears enough other relays send it first. Python only sees messages
+// for this node or broadcast (dst 0xFFFF). Relaying listens through
+// whatever advertising RX is running, normally scan().
+#ifdef CH570_CH572
+#define ISLER_RELAY_SLOTS    2
+#define ISLER_RELAY_SEEN     8
+#else
+#define ISLER_RELAY_SLOTS    4
+#define ISLER_RELAY_SEEN     16
+#endif
+#define ISLER_RELAY_SUPPRESS 2 // repeats heard during the backoff that cancel ours
+#define ISLER_MESH_HDR       9
+#define ISLER_MESH_BROADCAST 0xFFFF
+
+enum { RELAY_FREE, RELAY_WAIT, RELAY_READY };
+
+typedef struct {
+	ch32fun_timer_t timer; // first, the callback casts back to the slot
+	isler_tx_frame_t tx;
+	uint32_t key;
+	volatile uint8_t state;
+	uint8_t heard;
+} isler_relay_slot_t;
+
+static isler_relay_slot_t relay_slots[ISLER_RELAY_SLOTS];
+// every 32 bit value is a possible key, so the empty entries are the ones
+// at relay_seen_used and above, filled in order until the ring is full
+static uint32_t relay_seen[ISLER_RELAY_SEEN];
+static uint8_t relay_seen_used;
+static uint8_t relay_seen_next;
+static volatile uint8_t relay_on;
+static uint16_t relay_node_id;
+static uint16_t relay_company;
+static uint32_t relay_backoff_us;
+static uint32_t relay_seed;
+
+// counters for relay_stats()
+static volatile uint32_t relay_relayed;
+static volatile uint32_t relay_duplicates;
+static volatile uint32_t relay_suppressed;
+static volatile uint32_t relay_delivered;
+
+// Called from the SysTick ISR
+static void relay_timer_cb(ch32fun_timer_t *timer) {
+	isler_relay_slot_t *slot = (isler_relay_slot_t *)timer;
+	if (slot->state != RELAY_WAIT) {
+		return;
+	}
+	if (slot->heard >= ISLER_RELAY_SUPPRESS) {
+		slot->state = RELAY_FREE;
+		relay_suppressed++;
+		return;
+	}
+	slot->state = RELAY_READY;
+	tx_kick();
+}
+
+static const isler_tx_frame_t *relay_ready(void) {
+	for (int i = 0; i < ISLER_RELAY_SLOTS; i++) {
+		if (relay_slots[i].state == RELAY_READY) {
+			return &relay_slots[i].tx;
+		}
+	}
+	return NULL;
+}
+
+static void relay_sent(const void *f) {
+	for (int i = 0; i < ISLER_RELAY_SLOTS; i++) {
+		if (f == &relay_slots[i].tx) {
+			relay_slots[i].state = RELAY_FREE;
+			relay_relayed++;
+		}
+	}
+}
+
+// Called from the RF ISR, returns 1 if the frame should reach Python
+static int relay_rx(const uint8_t *frame, size_t len) {
+	size_t field_len;
+	const uint8_t *mfg = (len > 8) ? isler_ad_find(&frame[8], len - 8, 0xFF, &field_len) : NULL;
+	if (mfg == NULL || field_len < ISLER_MESH_HDR || (mfg[0] | (mfg[1] << 8)) != relay_company) {
+		return 1; // not a mesh frame
+	}
+
+	uint8_t ttl = mfg[2];
+	uint16_t msg_id = mfg[3] | (mfg[4] << 8);
+	uint16_t src = mfg[5] | (mfg[6] << 8);
+	uint16_t dst = mfg[7] | (mfg[8] << 8);
+	uint32_t key = ((uint32_t)src << 16) | msg_id;
+
+	for (int i = 0; i < relay_seen_used; i++) {
+		if (relay_seen[i] == key) {
+			relay_duplicates++;
+			for (int j = 0; j < ISLER_RELAY_SLOTS; j++) {
+				if (relay_slots[j].state == RELAY_WAIT && relay_slots[j].key == key) {
+					relay_slots[j].heard++;
+				}
+			}
+			return 0;
+		}
+	}
+	relay_seen[relay_seen_next] = key;
+	relay_seen_next = (relay_seen_next + 1) % ISLER_RELAY_SEEN;
+	if (relay_seen_used < ISLER_RELAY_SEEN) {
+		relay_seen_used++;
+	}
+
+	if (src == relay_node_id) {
+		return 0; // our own message coming back
+	}
+
+	int for_us = (dst == relay_node_id || dst == ISLER_MESH_BROADCAST);
+	if (for_us) {
+		relay_delivered++;
+	}
+
+	if (dst != relay_node_id && ttl > 1 && len <= ISLER_TX_FRAME_SIZE) {
+		for (int i = 0; i < ISLER_RELAY_SLOTS; i++) {
+			isler_relay_slot_t *slot = &relay_slots[i];
+			if (slot->state != RELAY_FREE) {
+				continue;
+			}
+			memcpy(slot->tx.frame, frame, len);
+			slot->tx.frame[&mfg[2] - frame] = ttl - 1;
+			slot->tx.len = len;
+			slot->key = key;
+			slot->heard = 0;
+			slot->state = RELAY_WAIT;
+
+			relay_seed = relay_seed * 1664525 + 1013904223;
+			slot->timer.callback = relay_timer_cb;
+			ch32fun_timer_start(&slot->timer, relay_backoff_us ? (relay_seed >> 8) % relay_backoff_us : 0);
+			break;
+		}
+	}
+
+	return for_us;
+}
+
+// ==========================================================================
+// Extended Advertising (chained PDUs)
+// ==========================================================================
+// Payloads beyond one frame go out like BLE extended advertising: an
+// ADV_EXT_IND on 37/38/39 at 1M points (AuxPtr) at an AUX_ADV_IND on a
+// secondary channel at the faster PHY. That one chains AUX_CHAIN_INDs,
+// hopping channels, until the data is sent. The receiver follows the
+// AuxPtrs from the RF interrupt and reassembles the payload for recv_ext(),
+// once ext_rx() turned that on: following a chain takes the radio off the
+// primary channels, and every BLE 5 device nearby sends ADV_EXT_INDs.
+// Frame payload: [ext header len | mode, flags, AdvA?, ADI?, AuxPtr?, data...]
+#define ISLER_PDU_EXT        0x07
+#define EXT_FLAG_ADVA        0x01
+#define EXT_FLAG_TARGETA     0x02
+#define EXT_FLAG_CTEINFO     0x04
+#define EXT_FLAG_ADI         0x08
+#define EXT_FLAG_AUXPTR      0x10
+
+#ifdef CH570_CH572
+#define ISLER_EXT_MAX        512  // reassembly buffer
+#else
+#define ISLER_EXT_MAX        2048
+#endif
+#define ISLER_EXT_CHUNK      240  // data bytes per AUX frame
+#define ISLER_AUX_OFFSET_US  600  // last primary to AUX_ADV_IND
+#define ISLER_AUX_GAP_US     300  // between AUX frames of a chain
+#define ISLER_AUX_TIMEOUT_US 3000 // give up on a chain after this much silence
+
+typedef struct {
+	const uint8_t *adva;
+	const uint8_t *auxptr;
+	const uint8_t *data;
+	uint16_t adi;
+	uint8_t data_len;
+} isler_ext_info_t;
+
+// AuxPtr PHY field <-> iSLER PHY
+static uint8_t ext_phy_field(uint8_t phy) {
+	return (phy == PHY_1M) ? 0 : (phy == PHY_2M) ? 1 : 2;
+}
+
+// The AuxPtr only says Coded, ext_rx() tells S2 from S8
+static uint8_t ext_rx_coded = PHY_S8;
+
+static uint8_t ext_phy_mode(uint8_t field) {
+	return (field == 0) ? PHY_1M : (field == 1) ? PHY_2M : ext_rx_coded;
+}
+
+static uint8_t ext_next_channel(uint8_t ch) {
+	return (ch + 7) % 37; // secondary channels 0..36
+}
+
+static int ext_parse(const uint8_t *frame, size_t len, isler_ext_info_t *e) {
+	const uint8_t *p = &frame[2];
+	size_t plen = frame[1];
+	if (plen < 1 || plen + 2 > len) {
+		return 0;
+	}
+	size_t hlen = p[0] & 0x3F;
+	if (1 + hlen > plen) {
+		return 0;
+	}
+
+	uint8_t flags = hlen ? p[1] : 0;
+	const uint8_t *q = &p[2];
+	memset(e, 0, sizeof(*e));
+	if (flags & EXT_FLAG_ADVA) { e->adva = q; q += 6; }
+	if (flags & EXT_FLAG_TARGETA) q += 6;
+	if (flags & EXT_FLAG_CTEINFO) q += 1;
+	if (flags & EXT_FLAG_ADI) { e->adi = q[0] | (q[1] << 8); q += 2; }
+	if (flags & EXT_FLAG_AUXPTR) { e->auxptr = q; q += 3; }
+	if (q > &p[1 + hlen]) {
+		return 0;
+	}
+
+	e->data = &p[1 + hlen];
+	e->data_len = plen - 1 - hlen;
+	return 1;
+}
+
+// Builds [header, len, ext header, data], returns the frame length
+static size_t ext_build(uint8_t *f, const uint8_t *adva, uint16_t adi, int aux, uint8_t aux_ch,
+	uint8_t aux_phy, uint32_t aux_offset_us, const uint8_t *data, size_t data_len) {
+	uint8_t *q = &f[4];
+	uint8_t flags = EXT_FLAG_ADI;
+
+	if (adva) {
+		flags |= EXT_FLAG_ADVA;
+		memcpy(q, adva, 6);
+		q += 6;
+	}
+	*q++ = adi & 0xFF;
+	*q++ = adi >> 8;
+	if (aux) {
+		uint16_t offset = aux_offset_us / 30; // 30 us units
+		flags |= EXT_FLAG_AUXPTR;
+		*q++ = aux_ch & 0x3F;
+		*q++ = offset & 0xFF;
+		*q++ = ((offset >> 8) & 0x1F) | (ext_phy_field(aux_phy) << 5);
+	}
+
+	f[0] = ISLER_PDU_EXT;
+	f[2] = (q - &f[3]) & 0x3F; // AdvMode 0: non-connectable, non-scannable
+	f[3] = flags;
+	if (data_len) {
+		memcpy(q, data, data_len);
+		q += data_len;
+	}
+	f[1] = q - &f[2];
+	return q - f;
+}
+
+// TX state, the data stays in the Python object held by the root pointer
+static ch32fun_timer_t ext_tx_timer;
+static const uint8_t *ext_tx_data;
+static size_t ext_tx_len;
+static size_t ext_tx_pos;
+static uint8_t ext_tx_adva[6];
+static uint16_t ext_tx_adi;
+static uint8_t ext_tx_phy;
+static uint8_t ext_tx_ch;
+static uint8_t ext_tx_step; // 0..2 primaries, then AUX frames
+static volatile uint8_t ext_tx_busy;
+static uint8_t ext_tx_frame[2 + 255];
+static ch32fun_isler_txreq_t ext_tx_req;
+static uint8_t ext_tx_more; // another AUX frame follows the one queued
+
+// Called from the software interrupt once a frame of the chain is out
+static void ext_tx_done(ch32fun_isler_txreq_t *req) {
+	if (ext_tx_step <= 3) {
+		ch32fun_timer_start(&ext_tx_timer, (ext_tx_step < 3) ? ISLER_TX_GAP_US : ISLER_AUX_OFFSET_US);
+	}
+	else if (ext_tx_more) {
+		ch32fun_timer_start(&ext_tx_timer, ISLER_AUX_GAP_US);
+	}
+	else {
+		ext_tx_busy = 0;
+	}
+}
+
+// Called from the SysTick ISR, queues the next frame of the chain
+static void ext_tx_timer_cb(ch32fun_timer_t *timer) {
+	uint8_t *f = ext_tx_frame;
+	ch32fun_isler_txreq_t *req = &ext_tx_req;
+	req->access_addr = ISLER_ADV_ACCESS_ADDR;
+	req->frame = f;
+	req->done = ext_tx_done;
+
+	if (ext_tx_step < 3) {
+		uint32_t offset = (2 - ext_tx_step) * ISLER_TX_GAP_US + ISLER_AUX_OFFSET_US;
+		req->len = ext_build(f, NULL, ext_tx_adi, 1, ext_tx_ch, ext_tx_phy, offset, NULL, 0);
+		req->channel = 37 + ext_tx_step;
+		req->phy_mode = PHY_1M;
+		ext_tx_step++;
+		ch32fun_isler_tx_queue(req);
+		return;
+	}
+
+	int first = (ext_tx_step == 3);
+	size_t chunk = ISLER_EXT_CHUNK - (first ? 6 : 0);
+	if (chunk > ext_tx_len - ext_tx_pos) {
+		chunk = ext_tx_len - ext_tx_pos;
+	}
+	ext_tx_more = ext_tx_pos + chunk < ext_tx_len;
+	uint8_t next_ch = ext_next_channel(ext_tx_ch);
+
+	req->len = ext_build(f, first ? ext_tx_adva : NULL, ext_tx_adi, ext_tx_more, next_ch, ext_tx_phy,
+		ISLER_AUX_GAP_US, &ext_tx_data[ext_tx_pos], chunk);
+	req->channel = ext_tx_ch;
+	req->phy_mode = ext_tx_phy;
+	ext_tx_pos += chunk;
+	ext_tx_ch = next_ch;
+	ext_tx_step++;
+	ch32fun_isler_tx_queue(req);
+}
+
+// RX reassembly
+static uint8_t ext_rx_buf[ISLER_EXT_MAX];
+static volatile uint16_t ext_rx_len;
+static uint8_t ext_rx_mac[6];
+static uint16_t ext_rx_adi;
+static ch32fun_timer_t ext_rx_timer;
+static volatile uint32_t ext_rx_dropped; // incomplete, too long, or Python was too slow
+static volatile uint8_t ext_rx_on;
+
+static void ext_rx_abort(void) {
+	ext_rx_state = EXT_IDLE;
+	ext_rx_dropped++;
+	ch32fun_isler_resume();
+}
+
+// Called from the SysTick ISR
+static void ext_rx_timer_cb(ch32fun_timer_t *timer) {
+	if (ext_rx_state == EXT_CHAIN) {
+		ext_rx_abort();
+	}
+}
+
+// Called from the RF ISR, returns 1 when a chain is complete
+static int ext_rx(const uint8_t *frame, size_t len) {
+	isler_ext_info_t e;
+	if (!ext_parse(frame, len, &e)) {
+		return 0;
+	}
+
+	if (ext_rx_state == EXT_DONE) {
+		ext_rx_dropped++; // the last one is still waiting for recv_ext()
+		return 0;
+	}
+	if (ext_rx_state == EXT_IDLE) {
+		ext_rx_adi = e.adi;
+		ext_rx_len = 0;
+		ext_rx_state = EXT_CHAIN;
+	}
+	else if (e.adi != ext_rx_adi) {
+		ext_rx_abort();
+		return 0;
+	}
+
+	if (e.adva) {
+		for (int i = 0; i < 6; i++) {
+			ext_rx_mac[i] = e.adva[5 - i];
+		}
+	}
+	if (ext_rx_len + e.data_len > ISLER_EXT_MAX) {
+		ext_rx_abort();
+		return 0;
+	}
+	memcpy(&ext_rx_buf[ext_rx_len], e.data, e.data_len);
+	ext_rx_len += e.data_len;
+
+	if (e.auxptr) {
+		// follow the chain, the next frame is on its way
+		iSLERRX(ISLER_ADV_ACCESS_ADDR, e.auxptr[0] & 0x3F, ext_phy_mode(e.auxptr[2] >> 5));
+		ext_rx_timer.callback = ext_rx_timer_cb;
+		ch32fun_timer_start(&ext_rx_timer, ISLER_AUX_TIMEOUT_US);
+		return 0;
+	}
+
+	ch32fun_timer_stop(&ext_rx_timer);
+	ext_rx_state = EXT_DONE;
+	ch32fun_isler_resume();
+	return 1;
 }
 
 // ==========================================================================
@@ -61,19 +887,130 @@ static size_t rx_fifo_count(void) {
 // Global reference to the user's Python callback function
 static mp_obj_t isler_callback_obj = mp_const_none;
 
+// Protocols built on the raw radio (ch32fun_link.c, ...) see frames first
+#define ISLER_RX_HOOKS 4
+static ch32fun_isler_hook_t rx_hooks[ISLER_RX_HOOKS];
+static uint32_t rx_ticks; // SysTick at the top of the RF ISR
+
 void mod_isler_rx_isr(void) {
+	rx_ticks = funSysTick32();
+	uint32_t now = rx_ticks / DELAY_US_TIME;
 	uint8_t *frame = (uint8_t *)LLE_BUF;
 	uint8_t len = frame[1] + 2;
+	int queued = 0;
 
-	if (len > 0 && len < 255) {
-		rx_fifo_push(frame, len);
+	rx_frames++;
+	for (int i = 0; i < ISLER_RX_HOOKS; i++) {
+		if (rx_hooks[i] != NULL && rx_hooks[i](frame, len)) {
+			return;
+		}
 	}
 
-	if (isler_callback_obj != mp_const_none) {
+	if (ext_rx_on && (frame[0] & 0x0F) == ISLER_PDU_EXT) {
+		if (ext_rx(frame, len) && isler_callback_obj != mp_const_none) {
+			mp_sched_schedule(isler_callback_obj, mp_const_none);
+		}
+		else if (ext_rx_state != EXT_CHAIN) {
+			ch32fun_isler_resume();
+		}
+		return;
+	}
+
+	if (scan_active && !scan_listening) {
+		return; // left over from the last window
+	}
+
+	if (len > 0 && len < 255 && (!relay_on || relay_rx(frame, len))) {
+		int8_t rssi = ReadRSSI();
+		if (filter_accept(frame, len, rssi)) {
+			uint32_t h = scan_active ? scan_hash(frame, len) : 0;
+			if (!scan_active || scan_is_new(h)) {
+				queued = rx_queue_push(frame, len, rssi, now);
+			}
+			if (queued && scan_active) {
+				scan_seen_add(h);
+			}
+		}
+	}
+
+	if (scan_active) {
+		iSLERRX(ISLER_ADV_ACCESS_ADDR, isler_rx_channel, scan_phy);
+	}
+
+	if (queued && isler_callback_obj != mp_const_none) {
 		mp_sched_schedule(isler_callback_obj, mp_const_none);
 	}
 }
 
+// ==========================================================================
+// Raw Radio Access (see modch32fun.h)
+// ==========================================================================
+
+void ch32fun_isler_hook(ch32fun_isler_hook_t hook, int enable) {
+	for (int i = 0; i < ISLER_RX_HOOKS; i++) {
+		if (rx_hooks[i] == hook) {
+			rx_hooks[i] = NULL;
+		}
+	}
+	if (!enable) {
+		return;
+	}
+	for (int i = 0; i < ISLER_RX_HOOKS; i++) {
+		if (rx_hooks[i] == NULL) {
+			rx_hooks[i] = hook;
+			return;
+		}
+	}
+	mp_raise_msg(&mp_type_RuntimeError, MP_ERROR_TEXT("too many RX hooks"));
+}
+
+void ch32fun_isler_rx(uint32_t access_addr, uint8_t channel, uint8_t phy_mode) {
+	scan_stop();
+	isler_rx_aa = access_addr;
+	isler_rx_channel = channel;
+	isler_rx_phy = phy_mode;
+	isler_rx_armed = 1;
+	iSLERRX(access_addr, channel, phy_mode);
+}
+
+// In an RX hook: was the frame received on RX armed by ch32fun_isler_rx()
+// with this access address and channel
+int ch32fun_isler_rx_is(uint32_t access_addr, uint8_t channel) {
+	return !scan_active && isler_rx_armed && isler_rx_aa == access_addr && isler_rx_channel == channel;
+}
+
+// In an RX hook: SysTick when the RF interrupt for this frame was taken
+uint32_t ch32fun_isler_rx_ticks(void) {
+	return rx_ticks;
+}
+
+void ch32fun_isler_rx_adv(uint8_t channel) {
+	ch32fun_isler_rx(ISLER_ADV_ACCESS_ADDR, channel, PHY_1M);
+}
+
+void ch32fun_isler_resume(void) {
+	if (scan_active) {
+		if (scan_listening) {
+			iSLERRX(ISLER_ADV_ACCESS_ADDR, isler_rx_channel, scan_phy);
+		}
+	}
+	else if (isler_rx_armed) {
+		iSLERRX(isler_rx_aa, isler_rx_channel, isler_rx_phy);
+	}
+}
+
+void ch32fun_isler_tx(uint32_t access_addr, const uint8_t *frame, size_t len, uint8_t channel, uint8_t phy_mode) {
+	iSLERTX(access_addr, (uint8_t *)frame, len, channel, phy_mode);
+}
+
+const uint8_t ch32fun_isler_phy_1m = PHY_1M;
+
+// For data channel PDUs: iSLERRX() loads the advertising CRC init, call this
+// right after it. iSLERTX() only returns once the frame is out, call it before.
+void ch32fun_isler_crcinit(uint32_t crcinit) {
+	BB->CRCINIT1 = crcinit & 0xFFFFFF;
+}
+
 // ==========================================================================
 // Python Methods
 // ==========================================================================
@@ -85,35 +1022,399 @@ static mp_obj_t fun_isler_irq(mp_obj_t handler) {
 }
 static MP_DEFINE_CONST_FUN_OBJ_1(fun_isler_irq_obj, fun_isler_irq);
 
-// Method: iSLER.any() -> Returns number of bytes available
+// Method: iSLER.any() -> Returns number of packets queued
 static mp_obj_t fun_isler_any(void) {
-	return MP_OBJ_NEW_SMALL_INT(rx_fifo_count());
+	return MP_OBJ_NEW_SMALL_INT(rx_queue_count());
 }
 static MP_DEFINE_CONST_FUN_OBJ_0(fun_isler_any_obj, fun_isler_any);
 
-// Method: iSLER.read([len])
+// Method: iSLER.read([len]) -> next packet as bytes, or None
 static mp_obj_t fun_isler_read(size_t n_args, const mp_obj_t *args) {
-	size_t count = rx_fifo_count();
+	isler_rx_slot_t *slot = rx_queue_peek();
+	if (slot == NULL) {
+		return mp_const_none;
+	}
 
+	size_t len = slot->len;
 	if (n_args > 0) {
 		size_t req = mp_obj_get_int(args[0]);
-		if (req < count) count = req;
+		if (req < len) len = req;
+	}
+
+	mp_obj_t packet = mp_obj_new_bytes(slot->frame, len);
+	rx_queue_pop();
+	return packet;
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(fun_isler_read_obj, 0, 1, fun_isler_read);
+
+// A writable array('i'), the element count
+static size_t isler_get_ints(mp_obj_t buf_in, int32_t **buf) {
+	mp_buffer_info_t info;
+	mp_get_buffer_raise(buf_in, &info, MP_BUFFER_WRITE);
+	if (info.typecode != 'i') {
+		mp_raise_ValueError(MP_ERROR_TEXT("need an array('i')"));
+	}
+	*buf = info.buf;
+	return info.len / sizeof(int32_t);
+}
+
+// Method: iSLER.recv_into(buf[, meta]) -> length, or None if nothing is queued
+// Allocation free: meta is an optional array('i', 3) that receives
+// rssi, channel and timestamp_us.
+static mp_obj_t fun_isler_recv_into(size_t n_args, const mp_obj_t *args) {
+	mp_buffer_info_t bufinfo;
+	mp_get_buffer_raise(args[0], &bufinfo, MP_BUFFER_WRITE);
+	int32_t *m = NULL;
+	if (n_args > 1 && isler_get_ints(args[1], &m) < 3) {
+		mp_raise_ValueError(MP_ERROR_TEXT("meta needs 3 ints"));
 	}
 
-	if (count == 0) {
+	isler_rx_slot_t *slot = rx_queue_peek();
+	if (slot == NULL) {
 		return mp_const_none;
 	}
 
-	vstr_t vstr;
-	vstr_init_len(&vstr, count);
+	size_t len = (slot->len < bufinfo.len) ? slot->len : bufinfo.len;
+	memcpy(bufinfo.buf, slot->frame, len);
 
-	for (size_t i = 0; i < count; i++) {
-		vstr.buf[i] = (byte)rx_fifo_pop();
+	if (m != NULL) {
+		m[0] = slot->rssi;
+		m[1] = slot->channel;
+		m[2] = slot->timestamp;
 	}
 
-	return mp_obj_new_bytes_from_vstr(&vstr);
+	rx_queue_pop();
+	return MP_OBJ_NEW_SMALL_INT(len);
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(fun_isler_recv_into_obj, 1, 2, fun_isler_recv_into);
+
+// Method: iSLER.stats() -> (received, dropped, truncated, chains dropped)
+static mp_obj_t fun_isler_stats(void) {
+	mp_obj_t items[4] = {
+		mp_obj_new_int_from_uint(rx_received),
+		mp_obj_new_int_from_uint(rx_dropped),
+		mp_obj_new_int_from_uint(rx_truncated),
+		mp_obj_new_int_from_uint(ext_rx_dropped),
+	};
+	return mp_obj_new_tuple(4, items);
+}
+static MP_DEFINE_CONST_FUN_OBJ_0(fun_isler_stats_obj, fun_isler_stats);
+
+// --------------------------------------------------------------------------
+// Survey Function
+// Python: iSLER.survey(result[, channels[, dwell_us]])
+// Listens on every BLE channel (or the given list) for dwell_us and samples
+// the RSSI, dwell_us up to 1 s. result is an array('i', 3 * n) that receives
+// peak RSSI, mean RSSI and packets received per channel. Stops a running
+// scan and leaves RX armed on the last channel.
+// --------------------------------------------------------------------------
+#define ISLER_SURVEY_SETTLE_US 40 // RX turn-on before the RSSI means anything
+
+static mp_obj_t fun_isler_survey(size_t n_args, const mp_obj_t *args) {
+	int32_t *out;
+	size_t out_len = isler_get_ints(args[0], &out);
+
+	uint8_t channels[40];
+	size_t n = 0;
+	if (n_args > 1 && args[1] != mp_const_none) {
+		mp_obj_t iter = mp_getiter(args[1], NULL);
+		mp_obj_t item;
+		while ((item = mp_iternext(iter)) != MP_OBJ_STOP_ITERATION) {
+			mp_int_t ch = mp_obj_get_int(item);
+			if (n >= 40 || ch < 0 || ch > 39) {
+				mp_raise_ValueError(MP_ERROR_TEXT("bad channel"));
+			}
+			channels[n++] = ch;
+		}
+	}
+	else {
+		for (n = 0; n < 40; n++) {
+			channels[n] = n;
+		}
+	}
+	mp_int_t dwell_us = (n_args > 2) ? mp_obj_get_int(args[2]) : 200;
+	if (dwell_us < 0 || dwell_us > 1000000) {
+		mp_raise_ValueError(MP_ERROR_TEXT("dwell_us out of range"));
+	}
+	// SysTick deltas, mp_hal_ticks_us() does not wrap at a power of two
+	uint32_t dwell = dwell_us * DELAY_US_TIME;
+
+	if (out_len < n * 3) {
+		mp_raise_ValueError(MP_ERROR_TEXT("result too small"));
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		ch32fun_isler_rx(ISLER_ADV_ACCESS_ADDR, channels[i], PHY_1M);
+		uint32_t packets = rx_frames;
+		uint32_t seen = packets;
+		int32_t peak = -128;
+		int32_t sum = 0;
+		uint32_t samples = 0;
+
+		uint32_t start = funSysTick32();
+		while (funSysTick32() - start < ISLER_SURVEY_SETTLE_US * DELAY_US_TIME) {
+		}
+		start = funSysTick32();
+		while (funSysTick32() - start < dwell) {
+			int8_t rssi = ReadRSSI();
+			if (rssi > peak) peak = rssi;
+			sum += rssi;
+			samples++;
+			if (rx_frames != seen) {
+				// a packet ends the receive, keep listening
+				seen = rx_frames;
+				iSLERRX(ISLER_ADV_ACCESS_ADDR, channels[i], PHY_1M);
+			}
+		}
+
+		out[3 * i + 0] = peak;
+		out[3 * i + 1] = samples ? sum / (int32_t)samples : peak;
+		out[3 * i + 2] = rx_frames - packets;
+	}
+
+	return MP_OBJ_NEW_SMALL_INT(n);
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(fun_isler_survey_obj, 1, 3, fun_isler_survey);
+
+// --------------------------------------------------------------------------
+// Relay Functions
+// Python: iSLER.relay(node_id, company=0xFFFF, backoff_ms=20), iSLER.relay(None) stops
+//         iSLER.relay_stats() -> (relayed, duplicates, suppressed, delivered)
+// --------------------------------------------------------------------------
+static mp_obj_t fun_isler_relay(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+	enum { ARG_node_id, ARG_company, ARG_backoff_ms };
+	static const mp_arg_t allowed_args[] = {
+		{ MP_QSTR_node_id,    MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+		{ MP_QSTR_company,    MP_ARG_INT, {.u_int = 0xFFFF} },
+		{ MP_QSTR_backoff_ms, MP_ARG_INT, {.u_int = 20} },
+	};
+
+	mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+	mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+	relay_on = 0;
+	for (int i = 0; i < ISLER_RELAY_SLOTS; i++) {
+		ch32fun_timer_stop(&relay_slots[i].timer);
+		if (relay_slots[i].state == RELAY_WAIT) {
+			relay_slots[i].state = RELAY_FREE;
+		}
+	}
+	if (args[ARG_node_id].u_obj == mp_const_none) {
+		return mp_const_none;
+	}
+
+	relay_node_id = mp_obj_get_int(args[ARG_node_id].u_obj);
+	relay_company = args[ARG_company].u_int;
+	relay_backoff_us = args[ARG_backoff_ms].u_int * 1000;
+	relay_seed ^= funSysTick32() ^ relay_node_id;
+	relay_seen_used = 0;
+	relay_seen_next = 0;
+	relay_relayed = relay_duplicates = relay_suppressed = relay_delivered = 0;
+	relay_on = 1;
+
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_KW(fun_isler_relay_obj, 1, fun_isler_relay);
+
+static mp_obj_t fun_isler_relay_stats(void) {
+	mp_obj_t items[4] = {
+		mp_obj_new_int_from_uint(relay_relayed),
+		mp_obj_new_int_from_uint(relay_duplicates),
+		mp_obj_new_int_from_uint(relay_suppressed),
+		mp_obj_new_int_from_uint(relay_delivered),
+	};
+	return mp_obj_new_tuple(4, items);
+}
+static MP_DEFINE_CONST_FUN_OBJ_0(fun_isler_relay_stats_obj, fun_isler_relay_stats);
+
+// --------------------------------------------------------------------------
+// Extended Advertising Functions
+// Python: iSLER.adv_ext(mac, data[, phy_mode]), sends data as one chained transfer
+//         iSLER.ext_rx(on[, coded]), follow chains, coded is PHY_S8 or PHY_S2
+//         iSLER.recv_ext() -> (mac, data) of the last complete transfer, or None
+// --------------------------------------------------------------------------
+static uint8_t ext_check_phy(mp_obj_t phy_in) {
+	mp_int_t phy = mp_obj_get_int(phy_in);
+	if (phy != PHY_1M && phy != PHY_2M && phy != PHY_S2 && phy != PHY_S8) {
+		mp_raise_ValueError(MP_ERROR_TEXT("invalid phy_mode"));
+	}
+	return phy;
 }
-static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(fun_isler_read_obj, 0, 1, fun_isler_read);
+
+static mp_obj_t fun_isler_adv_ext(size_t n_args, const mp_obj_t *args) {
+	mp_buffer_info_t mac;
+	mp_buffer_info_t bufinfo;
+	mp_get_buffer_raise(args[0], &mac, MP_BUFFER_READ);
+	mp_get_buffer_raise(args[1], &bufinfo, MP_BUFFER_READ);
+
+	if (mac.len != 6) {
+		mp_raise_ValueError(MP_ERROR_TEXT("MAC address is 6 bytes"));
+	}
+	else if (bufinfo.len > ISLER_EXT_MAX) {
+		mp_raise_ValueError(MP_ERROR_TEXT("payload too large"));
+	}
+
+	while (ext_tx_busy) {
+		mp_hal_background_processing(); // previous transfer still on air
+	}
+
+	// hold on to the data object until the last AUX frame is out
+	MP_STATE_PORT(isler_ext_tx) = args[1];
+	ext_tx_data = bufinfo.buf;
+	ext_tx_len = bufinfo.len;
+	ext_tx_pos = 0;
+	for (int i = 0; i < 6; i++) {
+		ext_tx_adva[i] = ((uint8_t*)mac.buf)[5 - i];
+	}
+	ext_tx_adi = (ext_tx_adi + 1) & 0x0FFF; // new DID, SID 0
+	ext_tx_phy = (n_args > 2) ? ext_check_phy(args[2]) : PHY_2M;
+	ext_tx_ch = funSysTick32() % 37;
+	ext_tx_step = 0;
+	ext_tx_busy = 1;
+
+	ext_tx_timer.callback = ext_tx_timer_cb;
+	ch32fun_timer_start(&ext_tx_timer, 0);
+
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(fun_isler_adv_ext_obj, 2, 3, fun_isler_adv_ext);
+
+static mp_obj_t fun_isler_ext_rx(size_t n_args, const mp_obj_t *args) {
+	uint8_t coded = (n_args > 1) ? ext_check_phy(args[1]) : PHY_S8;
+	if (coded != PHY_S2 && coded != PHY_S8) {
+		mp_raise_ValueError(MP_ERROR_TEXT("coded is PHY_S2 or PHY_S8"));
+	}
+
+	uint32_t mstatus = __get_MSTATUS();
+	__disable_irq();
+	ext_rx_on = mp_obj_is_true(args[0]);
+	ext_rx_coded = coded;
+	if (!ext_rx_on && ext_rx_state == EXT_CHAIN) {
+		ch32fun_timer_stop(&ext_rx_timer);
+		ext_rx_state = EXT_IDLE;
+		ch32fun_isler_resume();
+	}
+	__set_MSTATUS(mstatus);
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(fun_isler_ext_rx_obj, 1, 2, fun_isler_ext_rx);
+
+static mp_obj_t fun_isler_recv_ext(void) {
+	if (ext_rx_state != EXT_DONE) {
+		return mp_const_none;
+	}
+
+	mp_obj_t items[2] = {
+		mp_obj_new_bytes(ext_rx_mac, 6),
+		mp_obj_new_bytes(ext_rx_buf, ext_rx_len),
+	};
+	ext_rx_state = EXT_IDLE;
+	return mp_obj_new_tuple(2, items);
+}
+static MP_DEFINE_CONST_FUN_OBJ_0(fun_isler_recv_ext_obj, fun_isler_recv_ext);
+
+// ==========================================================================
+// Advertising Data Parser
+// ==========================================================================
+// Works in place on a frame as returned by read()/recv_into(), offsets are
+// into that buffer so memoryview slices can be taken without copying. Walking
+// the structures with ad_next() and the lookups return small ints and do not
+// allocate, only ad_name() makes a str.
+#define AD_FLAGS       0x01
+#define AD_NAME_SHORT  0x08
+#define AD_NAME        0x09
+#define AD_TX_POWER    0x0A
+#define AD_MFG_DATA    0xFF
+
+// AD structures start after the header and AdvA and end at the PDU length
+static const uint8_t *isler_ad_data(mp_obj_t buf_in, size_t *len) {
+	mp_buffer_info_t bufinfo;
+	mp_get_buffer_raise(buf_in, &bufinfo, MP_BUFFER_READ);
+	const uint8_t *frame = bufinfo.buf;
+	if (bufinfo.len < 8) {
+		*len = 0;
+		return frame;
+	}
+	size_t end = frame[1] + 2;
+	if (end > bufinfo.len) end = bufinfo.len;
+	*len = (end > 8) ? end - 8 : 0;
+	return &frame[8];
+}
+
+// Method: iSLER.ad_next(frame[, offset]) -> offset of the AD structure after
+// the one at offset, the first one without it, or -1 past the last. At the
+// offset: frame[o] is the length of type and data, frame[o + 1] the type and
+// the data starts at o + 2.
+static mp_obj_t fun_isler_ad_next(size_t n_args, const mp_obj_t *args) {
+	size_t len;
+	const uint8_t *ad = isler_ad_data(args[0], &len);
+	size_t i = 0;
+	if (n_args > 1) {
+		mp_int_t pos = mp_obj_get_int(args[1]);
+		if (pos < 8 || (size_t)pos - 8 >= len) {
+			return MP_OBJ_NEW_SMALL_INT(-1);
+		}
+		i = pos - 8 + 1 + ad[pos - 8];
+	}
+
+	if (i + 1 >= len) {
+		return MP_OBJ_NEW_SMALL_INT(-1);
+	}
+	if (ad[i] == 0 || i + 1 + ad[i] > len) {
+		return MP_OBJ_NEW_SMALL_INT(-1); // padding or malformed
+	}
+	return MP_OBJ_NEW_SMALL_INT(8 + i);
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(fun_isler_ad_next_obj, 1, 2, fun_isler_ad_next);
+
+// Method: iSLER.ad_find(frame, ad_type) -> offset of the field data, or -1
+static mp_obj_t fun_isler_ad_find(mp_obj_t buf_in, mp_obj_t type_in) {
+	size_t len, field_len;
+	const uint8_t *ad = isler_ad_data(buf_in, &len);
+	const uint8_t *field = isler_ad_find(ad, len, mp_obj_get_int(type_in), &field_len);
+	return MP_OBJ_NEW_SMALL_INT(field ? 8 + (field - ad) : -1);
+}
+static MP_DEFINE_CONST_FUN_OBJ_2(fun_isler_ad_find_obj, fun_isler_ad_find);
+
+// Method: iSLER.ad_flags(frame) -> int or None
+static mp_obj_t fun_isler_ad_flags(mp_obj_t buf_in) {
+	size_t len, field_len;
+	const uint8_t *ad = isler_ad_data(buf_in, &len);
+	const uint8_t *field = isler_ad_find(ad, len, AD_FLAGS, &field_len);
+	return (field && field_len >= 1) ? MP_OBJ_NEW_SMALL_INT(field[0]) : mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(fun_isler_ad_flags_obj, fun_isler_ad_flags);
+
+// Method: iSLER.ad_tx_power(frame) -> dBm or None
+static mp_obj_t fun_isler_ad_tx_power(mp_obj_t buf_in) {
+	size_t len, field_len;
+	const uint8_t *ad = isler_ad_data(buf_in, &len);
+	const uint8_t *field = isler_ad_find(ad, len, AD_TX_POWER, &field_len);
+	return (field && field_len >= 1) ? MP_OBJ_NEW_SMALL_INT((int8_t)field[0]) : mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(fun_isler_ad_tx_power_obj, fun_isler_ad_tx_power);
+
+// Method: iSLER.ad_company(frame) -> manufacturer company ID or None
+// The manufacturer data itself is at ad_find(frame, 0xFF) + 2
+static mp_obj_t fun_isler_ad_company(mp_obj_t buf_in) {
+	size_t len, field_len;
+	const uint8_t *ad = isler_ad_data(buf_in, &len);
+	const uint8_t *field = isler_ad_find(ad, len, AD_MFG_DATA, &field_len);
+	return (field && field_len >= 2) ? MP_OBJ_NEW_SMALL_INT(field[0] | (field[1] << 8)) : mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(fun_isler_ad_company_obj, fun_isler_ad_company);
+
+// Method: iSLER.ad_name(frame) -> complete or shortened local name, or None
+static mp_obj_t fun_isler_ad_name(mp_obj_t buf_in) {
+	size_t len, field_len;
+	const uint8_t *ad = isler_ad_data(buf_in, &len);
+	const uint8_t *field = isler_ad_find(ad, len, AD_NAME, &field_len);
+	if (field == NULL) {
+		field = isler_ad_find(ad, len, AD_NAME_SHORT, &field_len);
+	}
+	return field ? mp_obj_new_str((const char *)field, field_len) : mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(fun_isler_ad_name_obj, fun_isler_ad_name);
 
 // ==========================================================================
 // Hardware Register Definitions
@@ -156,13 +1457,107 @@ static mp_obj_t fun_isler_rx(size_t n_args, const mp_obj_t *args) {
 	uint8_t phy_mode     = mp_obj_get_int(args[2]); // e.g. iSLER.PHY_1M
 
 	// This is non-blocking. When a packet arrives, the ISR
-	// will fill the RingBuffer and trigger the Python callback.
-	iSLERRX(access_addr, channel, phy_mode);
+	// will queue it and trigger the Python callback.
+	ch32fun_isler_rx(access_addr, channel, phy_mode);
 
 	return mp_const_none;
 }
 static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(fun_isler_rx_obj, 3, 3, fun_isler_rx);
 
+// --------------------------------------------------------------------------
+// Scan Function
+// Python: iSLER.scan(window_ms, interval_ms[, phy_mode]), iSLER.scan(0) stops
+// --------------------------------------------------------------------------
+static mp_obj_t fun_isler_scan(size_t n_args, const mp_obj_t *args) {
+	mp_int_t window = mp_obj_get_int(args[0]);
+	mp_int_t interval = (n_args > 1) ? mp_obj_get_int(args[1]) : window;
+
+	scan_stop();
+	if (window <= 0) {
+		return mp_const_none;
+	}
+	if (interval < window) {
+		mp_raise_ValueError(MP_ERROR_TEXT("interval < window"));
+	}
+
+	memset(scan_seen, 0, sizeof(scan_seen));
+	scan_phy = (n_args > 2) ? mp_obj_get_int(args[2]) : PHY_1M;
+	scan_window_us = window * 1000;
+	scan_interval_us = interval * 1000;
+	scan_active = 1;
+	scan_listening = 1;
+	scan_timer.callback = scan_timer_cb;
+	scan_arm();
+	ch32fun_timer_start(&scan_timer, scan_window_us);
+
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(fun_isler_scan_obj, 1, 3, fun_isler_scan);
+
+// --------------------------------------------------------------------------
+// Filter Functions
+// Python: iSLER.filter(mac=b'', ad_type=-1, company=-1, rssi=-128) -> rule index
+//         iSLER.filter_clear()
+//         iSLER.filter_hits() -> (hits per rule..., rejected)
+// --------------------------------------------------------------------------
+static mp_obj_t fun_isler_filter(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+	enum { ARG_mac, ARG_ad_type, ARG_company, ARG_rssi };
+	static const mp_arg_t allowed_args[] = {
+		{ MP_QSTR_mac,     MP_ARG_OBJ, {.u_obj = mp_const_none} },
+		{ MP_QSTR_ad_type, MP_ARG_INT, {.u_int = ISLER_ANY} },
+		{ MP_QSTR_company, MP_ARG_INT, {.u_int = ISLER_ANY} },
+		{ MP_QSTR_rssi,    MP_ARG_INT, {.u_int = -128} },
+	};
+
+	mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+	mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+	if (filter_count >= ISLER_FILTER_RULES) {
+		mp_raise_ValueError(MP_ERROR_TEXT("filter table full"));
+	}
+
+	isler_filter_t rule = {
+		.mac_len = 0,
+		.rssi = args[ARG_rssi].u_int,
+		.ad_type = args[ARG_ad_type].u_int,
+		.company = args[ARG_company].u_int,
+		.hits = 0,
+	};
+	if (args[ARG_mac].u_obj != mp_const_none) {
+		mp_buffer_info_t mac;
+		mp_get_buffer_raise(args[ARG_mac].u_obj, &mac, MP_BUFFER_READ);
+		if (mac.len > 6) {
+			mp_raise_ValueError(MP_ERROR_TEXT("MAC address is 6 bytes"));
+		}
+		memcpy(rule.mac, mac.buf, mac.len);
+		rule.mac_len = mac.len;
+	}
+
+	// write the rule before the ISR can see it
+	filter_rules[filter_count] = rule;
+	filter_count++;
+	return MP_OBJ_NEW_SMALL_INT(filter_count - 1);
+}
+static MP_DEFINE_CONST_FUN_OBJ_KW(fun_isler_filter_obj, 0, fun_isler_filter);
+
+static mp_obj_t fun_isler_filter_clear(void) {
+	filter_count = 0;
+	filter_rejected = 0;
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_0(fun_isler_filter_clear_obj, fun_isler_filter_clear);
+
+static mp_obj_t fun_isler_filter_hits(void) {
+	size_t n = filter_count;
+	mp_obj_tuple_t *hits = MP_OBJ_TO_PTR(mp_obj_new_tuple(n + 1, NULL));
+	for (size_t i = 0; i < n; i++) {
+		hits->items[i] = mp_obj_new_int_from_uint(filter_rules[i].hits);
+	}
+	hits->items[n] = mp_obj_new_int_from_uint(filter_rejected);
+	return MP_OBJ_FROM_PTR(hits);
+}
+static MP_DEFINE_CONST_FUN_OBJ_0(fun_isler_filter_hits_obj, fun_isler_filter_hits);
+
 static mp_obj_t fun_isler_tx(size_t n_args, const mp_obj_t *args) {
 	mp_buffer_info_t mac;
 	mp_buffer_info_t bufinfo;
@@ -196,48 +1591,105 @@ static mp_obj_t fun_isler_tx(size_t n_args, const mp_obj_t *args) {
 }
 static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(fun_isler_tx_obj, 5, 5, fun_isler_tx);
 
+// --------------------------------------------------------------------------
+// Advertising Functions
+// Python: iSLER.adv(mac, payload), queues one advertisement on 37/38/39
+//         iSLER.advertise(mac, payload, interval_ms[, jitter_ms]), iSLER.advertise(None) stops
+// --------------------------------------------------------------------------
 static mp_obj_t fun_isler_adv(size_t n_args, const mp_obj_t *args) {
 	mp_buffer_info_t mac;
 	mp_buffer_info_t bufinfo;
 	mp_get_buffer_raise(args[0], &mac, MP_BUFFER_READ);
 	mp_get_buffer_raise(args[1], &bufinfo, MP_BUFFER_READ);
 
-	if (bufinfo.len > 250) {
-		mp_raise_ValueError(MP_ERROR_TEXT("payload too large"));
+	uint8_t next = (tx_head + 1) % ISLER_TX_QUEUE;
+	while (next == tx_tail) {
+		mp_hal_background_processing(); // queue full, wait for the timer to drain it
 	}
-	else if (mac.len != 6) {
-		mp_raise_ValueError(MP_ERROR_TEXT("MAC address is 6 bytes"));
+
+	isler_adv_frame_t *f = &tx_frames[tx_head];
+	isler_build_adv(f->frame, &f->len, sizeof(f->frame), &mac, &bufinfo);
+	tx_head = next;
+	tx_kick();
+
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(fun_isler_adv_obj, 2, 2, fun_isler_adv);
+
+static mp_obj_t fun_isler_advertise(size_t n_args, const mp_obj_t *args) {
+	if (args[0] == mp_const_none) {
+		ch32fun_timer_stop(&adv_timer);
+		adv_current = NULL;
+		return mp_const_none;
+	}
+	if (n_args < 3) {
+		mp_raise_TypeError(MP_ERROR_TEXT("interval required"));
 	}
 
-	uint8_t adv[256];
-	adv[0] = 0x02; // PDU
-	adv[1] = (uint8_t)bufinfo.len +6; // +6 = mac
-	for(int i = 0; i < 6; i++) {
-		adv[2 +i] = ((uint8_t*)mac.buf)[5 -i];
+	mp_buffer_info_t mac;
+	mp_buffer_info_t bufinfo;
+	mp_get_buffer_raise(args[0], &mac, MP_BUFFER_READ);
+	mp_get_buffer_raise(args[1], &bufinfo, MP_BUFFER_READ);
+	mp_int_t interval = mp_obj_get_int(args[2]);
+	mp_int_t jitter = (n_args > 3) ? mp_obj_get_int(args[3]) : 10;
+	if (interval < 20) {
+		mp_raise_ValueError(MP_ERROR_TEXT("interval < 20ms"));
+	}
+	if (jitter < 0) {
+		mp_raise_ValueError(MP_ERROR_TEXT("negative jitter"));
 	}
 
-	if (bufinfo.len > 0) {
-		memcpy(&adv[8], bufinfo.buf, bufinfo.len);
+	// fill the spare template, it may still be on air from the last swap
+	isler_tx_frame_t *spare = (adv_current == &adv_templates[0]) ? &adv_templates[1] : &adv_templates[0];
+	while (tx_sending == spare) {
 	}
+	isler_build_adv(spare->frame, &spare->len, sizeof(spare->frame), &mac, &bufinfo);
+
+	int running = (adv_current != NULL);
+	adv_current = spare;
 
-	iSLERTX(0x8E89BED6, adv, bufinfo.len +6 +2, 37, PHY_1M);
-	iSLERTX(0x8E89BED6, adv, bufinfo.len +6 +2, 38, PHY_1M);
-	iSLERTX(0x8E89BED6, adv, bufinfo.len +6 +2, 39, PHY_1M);
+	if (!running || adv_interval_us != interval * 1000 || adv_jitter_us != jitter * 1000) {
+		adv_interval_us = interval * 1000;
+		adv_jitter_us = jitter * 1000;
+		adv_seed ^= funSysTick32();
+		adv_timer.callback = adv_timer_cb;
+		ch32fun_timer_start(&adv_timer, 0);
+	}
 
 	return mp_const_none;
 }
-static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(fun_isler_adv_obj, 2, 2, fun_isler_adv);
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(fun_isler_advertise_obj, 1, 4, fun_isler_advertise);
 
 static const mp_rom_map_elem_t isler_locals_dict_table[] = {
 	{ MP_ROM_QSTR(MP_QSTR_init), MP_ROM_PTR(&fun_isler_init_obj) },
 
 	{ MP_ROM_QSTR(MP_QSTR_rx),   MP_ROM_PTR(&fun_isler_rx_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_scan), MP_ROM_PTR(&fun_isler_scan_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_survey), MP_ROM_PTR(&fun_isler_survey_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_relay), MP_ROM_PTR(&fun_isler_relay_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_relay_stats), MP_ROM_PTR(&fun_isler_relay_stats_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_filter), MP_ROM_PTR(&fun_isler_filter_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_filter_clear), MP_ROM_PTR(&fun_isler_filter_clear_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_filter_hits), MP_ROM_PTR(&fun_isler_filter_hits_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_irq),  MP_ROM_PTR(&fun_isler_irq_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_any),  MP_ROM_PTR(&fun_isler_any_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_read), MP_ROM_PTR(&fun_isler_read_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_recv_into), MP_ROM_PTR(&fun_isler_recv_into_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_stats), MP_ROM_PTR(&fun_isler_stats_obj) },
+
+	{ MP_ROM_QSTR(MP_QSTR_ad_next),     MP_ROM_PTR(&fun_isler_ad_next_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_ad_find),     MP_ROM_PTR(&fun_isler_ad_find_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_ad_flags),    MP_ROM_PTR(&fun_isler_ad_flags_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_ad_tx_power), MP_ROM_PTR(&fun_isler_ad_tx_power_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_ad_company),  MP_ROM_PTR(&fun_isler_ad_company_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_ad_name),     MP_ROM_PTR(&fun_isler_ad_name_obj) },
 
 	{ MP_ROM_QSTR(MP_QSTR_tx),   MP_ROM_PTR(&fun_isler_tx_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_adv),  MP_ROM_PTR(&fun_isler_adv_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_advertise), MP_ROM_PTR(&fun_isler_advertise_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_adv_ext), MP_ROM_PTR(&fun_isler_adv_ext_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_ext_rx), MP_ROM_PTR(&fun_isler_ext_rx_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_recv_ext), MP_ROM_PTR(&fun_isler_recv_ext_obj) },
 
 	// Constants
 	{ MP_ROM_QSTR(MP_QSTR_PHY_1M), MP_ROM_INT(PHY_1M) },
@@ -303,3 +1755,5 @@ MP_DEFINE_CONST_OBJ_TYPE(
 
 // Create the Singleton Instance
 const mp_obj_base_t ch32fun_isler_obj = { &ch32fun_isler_type };
+
+MP_REGISTER_ROOT_POINTER(mp_obj_t isler_ext_tx);
@@ -0,0 +1,424 @@
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "modch32fun.h"
+#include <string.h>
+
+// ==========================================================================
+// kv Submodule
+// ==========================================================================
+// Log structured key/value store in the top KV_FLASH_SECTORS of code flash.
+// Records are only ever appended, a put never erases. The sectors are used as
+// a ring and one of them is always kept erased: when the head sector is full
+// the log moves onto the spare, the live records of the oldest sector are
+// copied forward and the oldest sector is erased to become the new spare.
+// Every sector starts with a sequence number so the log can be replayed in
+// order at mount, newer records overriding older ones.
+
+#define KV_MAGIC         0x3130564B // "KV01"
+#define KV_FLAG_VALUE    0xA5
+#define KV_FLAG_DELETED  0x5A
+#define KV_KEY_MAX       32
+#define KV_VALUE_MAX     512
+#define KV_INDEX_SIZE    32 // max number of keys, power of two
+
+#define KV_SECTOR(i)     (KV_FLASH_START + (i) * FLASH_SECTOR_SIZE)
+#define KV_ALIGN(n)      (((n) + 3) & ~3)
+
+typedef struct {
+	uint32_t magic;
+	uint32_t seq;
+} kv_sector_hdr_t;
+
+typedef struct {
+	uint8_t key_len;
+	uint8_t flags;
+	uint16_t val_len;
+	uint32_t crc; // over the first 4 header bytes, the key and the value
+} kv_rec_hdr_t;
+
+// RAM index: key hash -> record offset, so a get never scans flash
+typedef struct {
+	uint16_t hash; // 0 marks an empty slot
+	uint16_t off;  // record offset from KV_FLASH_START in words
+} kv_index_t;
+
+static kv_index_t kv_index[KV_INDEX_SIZE];
+static uint32_t kv_seq;  // sequence number of the head sector
+static uint32_t kv_head; // address the next record is written to
+static bool kv_mounted;
+
+static void kv_mount(void);
+
+static void kv_check(int err) {
+	if (err != 0) {
+		mp_raise_OSError(MP_EIO);
+	}
+}
+
+static inline const kv_rec_hdr_t *kv_rec(uint16_t off) {
+	return (const kv_rec_hdr_t *)(uintptr_t)(KV_FLASH_START + off * 4);
+}
+
+static inline const uint8_t *kv_rec_key(const kv_rec_hdr_t *r) {
+	return (const uint8_t *)(r + 1);
+}
+
+static inline uint32_t kv_rec_size(const kv_rec_hdr_t *r) {
+	return sizeof(kv_rec_hdr_t) + KV_ALIGN(r->key_len + r->val_len);
+}
+
+static inline int kv_head_sector(void) {
+	return (kv_head - KV_FLASH_START - 1) / FLASH_SECTOR_SIZE;
+}
+
+static uint32_t kv_crc(const kv_rec_hdr_t *hdr, const uint8_t *key, const uint8_t *val) {
+	uint32_t crc = ch32fun_crc32(0, hdr, 4);
+	crc = ch32fun_crc32(crc, key, hdr->key_len);
+	return ch32fun_crc32(crc, val, hdr->val_len);
+}
+
+// FNV-1a folded to 16 bits
+static uint16_t kv_hash(const uint8_t *key, size_t len) {
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ key[i]) * 16777619u;
+	}
+	h = (h >> 16) ^ (h & 0xFFFF);
+	return h ? h : 1;
+}
+
+// ==========================================================================
+// Index
+// ==========================================================================
+
+// Returns the slot holding key, or the empty slot it would go in when insert
+// is set. NULL if it is not there, or the index is full.
+static kv_index_t *kv_index_find(const uint8_t *key, size_t len, uint16_t hash, bool insert) {
+	for (size_t i = 0; i < KV_INDEX_SIZE; i++) {
+		kv_index_t *slot = &kv_index[(hash + i) & (KV_INDEX_SIZE - 1)];
+		if (slot->hash == 0) {
+			return insert ? slot : NULL;
+		}
+		if (slot->hash == hash) {
+			const kv_rec_hdr_t *r = kv_rec(slot->off);
+			if (r->key_len == len && memcmp(kv_rec_key(r), key, len) == 0) {
+				return slot;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void kv_index_add(const kv_rec_hdr_t *r) {
+	uint16_t hash = kv_hash(kv_rec_key(r), r->key_len);
+	kv_index_t *slot = kv_index_find(kv_rec_key(r), r->key_len, hash, true);
+	if (slot != NULL) {
+		slot->hash = hash;
+		slot->off = ((uintptr_t)r - KV_FLASH_START) / 4;
+	}
+}
+
+// Walks the records of a sector, calling fn for every one with a valid CRC.
+// Returns the address just past the last record. A header that does not parse
+// ends the log as well: nothing behind it can be trusted, see kv_torn().
+static uint32_t kv_walk(int sector, void (*fn)(const kv_rec_hdr_t *r)) {
+	uint32_t addr = KV_SECTOR(sector) + sizeof(kv_sector_hdr_t);
+	uint32_t end = KV_SECTOR(sector + 1);
+
+	while (addr + sizeof(kv_rec_hdr_t) <= end) {
+		const kv_rec_hdr_t *r = (const kv_rec_hdr_t *)(uintptr_t)addr;
+		if (*(const uint32_t *)r == FLASH_ERASED_WORD) {
+			break; // end of the log
+		}
+
+		uint32_t size = kv_rec_size(r);
+		if (r->key_len == 0 || r->key_len > KV_KEY_MAX || r->val_len > KV_VALUE_MAX ||
+			(r->flags != KV_FLAG_VALUE && r->flags != KV_FLAG_DELETED) || addr + size > end) {
+			break; // torn header
+		}
+		if (fn != NULL && r->crc == kv_crc(r, kv_rec_key(r), kv_rec_key(r) + r->key_len)) {
+			fn(r);
+		}
+		addr += size;
+	}
+	return addr;
+}
+
+// ==========================================================================
+// Log
+// ==========================================================================
+
+// True if the log walked up to addr ends in a torn header rather than in
+// erased flash: the rest of that sector cannot be programmed anymore.
+static bool kv_torn(uint32_t addr) {
+	return (addr - KV_FLASH_START) % FLASH_SECTOR_SIZE != 0 && *(const uint32_t *)(uintptr_t)addr != FLASH_ERASED_WORD;
+}
+
+// Programs a record body made of two spans, staged through RAM because the
+// source may itself be in flash (when compacting).
+static void kv_program_body(uint32_t addr, const uint8_t *a, size_t alen, const uint8_t *b, size_t blen) {
+	uint8_t chunk[32] __attribute__((aligned(4)));
+	size_t total = alen + blen;
+
+	for (size_t pos = 0; pos < total; ) {
+		size_t n = 0;
+		for (; n < sizeof(chunk) && pos < total; n++, pos++) {
+			chunk[n] = (pos < alen) ? a[pos] : b[pos - alen];
+		}
+		while (n & 3) {
+			chunk[n++] = 0xFF;
+		}
+		kv_check(ch32fun_flash_program(addr, chunk, n));
+		addr += n;
+	}
+}
+
+static void kv_append(const kv_rec_hdr_t *hdr, const uint8_t *key, const uint8_t *val) {
+	// header first: a torn body is caught by the CRC, a torn header ends the sector
+	kv_check(ch32fun_flash_program(kv_head, hdr, sizeof(*hdr)));
+	kv_program_body(kv_head + sizeof(*hdr), key, hdr->key_len, val, hdr->val_len);
+
+	const kv_rec_hdr_t *r = (const kv_rec_hdr_t *)(uintptr_t)kv_head;
+	if (r->crc != kv_crc(r, kv_rec_key(r), kv_rec_key(r) + r->key_len)) {
+		mp_raise_OSError(MP_EIO);
+	}
+	kv_head += kv_rec_size(r);
+	kv_index_add(r);
+}
+
+static bool kv_sector_blank(int sector) {
+	const uint32_t *p = (const uint32_t *)(uintptr_t)KV_SECTOR(sector);
+	for (size_t i = 0; i < FLASH_SECTOR_SIZE / 4; i++) {
+		if (p[i] != FLASH_ERASED_WORD) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Starts a new head sector
+static void kv_open_sector(int sector) {
+	if (!kv_sector_blank(sector)) {
+		kv_check(ch32fun_flash_erase(KV_SECTOR(sector), FLASH_SECTOR_SIZE));
+	}
+	kv_sector_hdr_t hdr = { KV_MAGIC, ++kv_seq };
+	kv_check(ch32fun_flash_program(KV_SECTOR(sector), &hdr, sizeof(hdr)));
+	kv_head = KV_SECTOR(sector) + sizeof(hdr);
+}
+
+// Copies a record forward if the index still points at it
+static void kv_copy_live(const kv_rec_hdr_t *r) {
+	if (r->flags != KV_FLAG_VALUE) {
+		return; // everything older than a tombstone is in this sector or gone
+	}
+	uint16_t hash = kv_hash(kv_rec_key(r), r->key_len);
+	kv_index_t *slot = kv_index_find(kv_rec_key(r), r->key_len, hash, false);
+	if (slot != NULL && kv_rec(slot->off) == r) {
+		kv_rec_hdr_t hdr = *r;
+		kv_append(&hdr, kv_rec_key(r), kv_rec_key(r) + r->key_len);
+	}
+}
+
+// Moves the head onto the spare sector and compacts the oldest one into it
+static void kv_compact(void) {
+	int head = (kv_head_sector() + 1) % KV_FLASH_SECTORS;
+	int oldest = (head + 1) % KV_FLASH_SECTORS;
+
+	kv_open_sector(head);
+	kv_walk(oldest, kv_copy_live);
+	kv_check(ch32fun_flash_erase(KV_SECTOR(oldest), FLASH_SECTOR_SIZE));
+
+	// drop the index entries that pointed into the erased sector
+	kv_mount();
+}
+
+static void kv_format(void) {
+	for (int i = 0; i < KV_FLASH_SECTORS; i++) {
+		if (!kv_sector_blank(i)) {
+			kv_check(ch32fun_flash_erase(KV_SECTOR(i), FLASH_SECTOR_SIZE));
+		}
+	}
+	memset(kv_index, 0, sizeof(kv_index));
+	kv_seq = 0;
+	kv_open_sector(0);
+	kv_mounted = true;
+}
+
+// Rebuilds the index by replaying the log, oldest sector first
+static void kv_mount(void) {
+	int order[KV_FLASH_SECTORS];
+	int n = 0;
+
+	for (int i = 0; i < KV_FLASH_SECTORS; i++) {
+		const kv_sector_hdr_t *hdr = (const kv_sector_hdr_t *)(uintptr_t)KV_SECTOR(i);
+		if (hdr->magic != KV_MAGIC) {
+			continue;
+		}
+		int j = n++;
+		for (; j > 0 && ((const kv_sector_hdr_t *)(uintptr_t)KV_SECTOR(order[j - 1]))->seq > hdr->seq; j--) {
+			order[j] = order[j - 1];
+		}
+		order[j] = i;
+	}
+
+	if (n == 0) {
+		kv_format();
+		return;
+	}
+
+	memset(kv_index, 0, sizeof(kv_index));
+	for (int i = 0; i < n; i++) {
+		kv_head = kv_walk(order[i], kv_index_add);
+	}
+	kv_seq = ((const kv_sector_hdr_t *)(uintptr_t)KV_SECTOR(order[n - 1]))->seq;
+	kv_mounted = true;
+
+	if (n == KV_FLASH_SECTORS) {
+		// no spare left: a compaction was interrupted
+		if (kv_torn(kv_head)) {
+			// cut short mid record, so the oldest sector is still intact: drop
+			// the partial copy, the next put that does not fit redoes it
+			kv_check(ch32fun_flash_erase(KV_SECTOR(order[n - 1]), FLASH_SECTOR_SIZE));
+		} else {
+			// finish it, records already copied are indexed in the head
+			kv_walk(order[0], kv_copy_live);
+			kv_check(ch32fun_flash_erase(KV_SECTOR(order[0]), FLASH_SECTOR_SIZE));
+		}
+		kv_mount();
+	} else if (kv_torn(kv_head)) {
+		// a put was cut short, carry on in the spare
+		kv_compact();
+	}
+}
+
+static void kv_put(const uint8_t *key, size_t key_len, const uint8_t *val, size_t val_len, uint8_t flags) {
+	kv_rec_hdr_t hdr = { key_len, flags, val_len, 0 };
+	hdr.crc = kv_crc(&hdr, key, val);
+	uint32_t size = sizeof(hdr) + KV_ALIGN(key_len + val_len);
+
+	for (int i = 0; kv_head + size > KV_SECTOR(kv_head_sector() + 1); i++) {
+		if (i == KV_FLASH_SECTORS) {
+			mp_raise_OSError(MP_ENOSPC); // live data does not fit anymore
+		}
+		kv_compact();
+	}
+
+	if (kv_index_find(key, key_len, kv_hash(key, key_len), true) == NULL) {
+		mp_raise_OSError(MP_ENOSPC); // out of index slots
+	}
+	kv_append(&hdr, key, val);
+}
+
+static const uint8_t *kv_get_key(mp_obj_t key_in, size_t *len) {
+	const uint8_t *key = (const uint8_t *)mp_obj_str_get_data(key_in, len);
+	if (*len == 0 || *len > KV_KEY_MAX) {
+		mp_raise_ValueError(MP_ERROR_TEXT("bad key length"));
+	}
+	if (!kv_mounted) {
+		kv_mount();
+	}
+	return key;
+}
+
+static const kv_rec_hdr_t *kv_lookup(const uint8_t *key, size_t len) {
+	kv_index_t *slot = kv_index_find(key, len, kv_hash(key, len), false);
+	if (slot == NULL || kv_rec(slot->off)->flags != KV_FLAG_VALUE) {
+		return NULL;
+	}
+	return kv_rec(slot->off);
+}
+
+// ==========================================================================
+// Python Methods
+// ==========================================================================
+
+// Usage: kv.get(key[, default])
+static mp_obj_t fun_kv_get(size_t n_args, const mp_obj_t *args) {
+	size_t len;
+	const uint8_t *key = kv_get_key(args[0], &len);
+	const kv_rec_hdr_t *r = kv_lookup(key, len);
+
+	if (r == NULL) {
+		return (n_args > 1) ? args[1] : mp_const_none;
+	}
+	return mp_obj_new_bytes(kv_rec_key(r) + r->key_len, r->val_len);
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(fun_kv_get_obj, 1, 2, fun_kv_get);
+
+// Usage: kv.put(key, value)
+static mp_obj_t fun_kv_put(mp_obj_t key_in, mp_obj_t val_in) {
+	size_t len;
+	const uint8_t *key = kv_get_key(key_in, &len);
+	mp_buffer_info_t bufinfo;
+	mp_get_buffer_raise(val_in, &bufinfo, MP_BUFFER_READ);
+
+	if (bufinfo.len > KV_VALUE_MAX) {
+		mp_raise_ValueError(MP_ERROR_TEXT("value too large"));
+	}
+
+	// skip the write if nothing changed, saves flash wear on repeated saves
+	const kv_rec_hdr_t *r = kv_lookup(key, len);
+	if (r != NULL && r->val_len == bufinfo.len && memcmp(kv_rec_key(r) + len, bufinfo.buf, bufinfo.len) == 0) {
+		return mp_const_none;
+	}
+
+	kv_put(key, len, bufinfo.buf, bufinfo.len, KV_FLAG_VALUE);
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_2(fun_kv_put_obj, fun_kv_put);
+
+// Usage: kv.delete(key)
+static mp_obj_t fun_kv_delete(mp_obj_t key_in) {
+	size_t len;
+	const uint8_t *key = kv_get_key(key_in, &len);
+
+	if (kv_lookup(key, len) == NULL) {
+		mp_raise_type_arg(&mp_type_KeyError, key_in);
+	}
+	kv_put(key, len, NULL, 0, KV_FLAG_DELETED);
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(fun_kv_delete_obj, fun_kv_delete);
+
+// Usage: kv.keys() -> list of str
+static mp_obj_t fun_kv_keys(void) {
+	if (!kv_mounted) {
+		kv_mount();
+	}
+
+	mp_obj_t list = mp_obj_new_list(0, NULL);
+	for (size_t i = 0; i < KV_INDEX_SIZE; i++) {
+		if (kv_index[i].hash != 0) {
+			const kv_rec_hdr_t *r = kv_rec(kv_index[i].off);
+			if (r->flags == KV_FLAG_VALUE) {
+				mp_obj_list_append(list, mp_obj_new_str((const char *)kv_rec_key(r), r->key_len));
+			}
+		}
+	}
+	return list;
+}
+static MP_DEFINE_CONST_FUN_OBJ_0(fun_kv_keys_obj, fun_kv_keys);
+
+// Usage: kv.format(), drops all keys
+static mp_obj_t fun_kv_format(void) {
+	kv_format();
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_0(fun_kv_format_obj, fun_kv_format);
+
+static const mp_rom_map_elem_t kv_locals_dict_table[] = {
+	{ MP_ROM_QSTR(MP_QSTR_get),    MP_ROM_PTR(&fun_kv_get_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_put),    MP_ROM_PTR(&fun_kv_put_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_delete), MP_ROM_PTR(&fun_kv_delete_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_keys),   MP_ROM_PTR(&fun_kv_keys_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_format), MP_ROM_PTR(&fun_kv_format_obj) },
+};
+static MP_DEFINE_CONST_DICT(kv_locals_dict, kv_locals_dict_table);
+
+// NOTE: Not static
+MP_DEFINE_CONST_OBJ_TYPE(
+	ch32fun_kv_type,
+	MP_QSTR_kv,
+	MP_TYPE_FLAG_NONE,
+	locals_dict, &kv_locals_dict
+);
@@ -0,0 +1,403 @@
+#include "py/runtime.h"
+#include "py/mphal.h"
+#include "py/stream.h"
+#include "py/mperrno.h"
+#include "modch32fun.h"
+#include <string.h>
+
+// ==========================================================================
+// Link Submodule: reliable byte stream between two boards over iSLER
+// ==========================================================================
+// Go-back-N with cumulative ACKs. write() cuts the data into fragments that
+// fit one frame, the SysTick timer queues up to LINK_WINDOW of them back to
+// back on the iSLER TX interrupt and the RF interrupt takes ACKs and data. The receiver acks after a
+// short quiet time so a whole burst is acknowledged at once, and the sender
+// resends from the oldest unacked fragment when the retransmit timer runs out.
+// Frames are [type, len, seq, ack, payload...], the radio has one link at a time.
+#ifdef CH570_CH572
+#define LINK_WINDOW       2
+#define LINK_MTU          60
+#define LINK_RX_BUF_SIZE  256
+#else
+#define LINK_WINDOW       4   // must divide 256
+#define LINK_MTU          240 // payload bytes per frame, at most 253
+#define LINK_RX_BUF_SIZE  1024
+#endif
+
+#define LINK_GAP_US       300  // between frames of a burst
+#define LINK_ACK_DELAY_US 600  // quiet time before the receiver acks
+#define LINK_RTO_US       5000 // retransmit timeout
+#define LINK_MAX_RETRIES  20   // timeouts without hearing the peer before the link is declared dead
+
+#define LINK_DATA         0x0E // PDU types the advertising channels don't use
+#define LINK_ACK          0x0F
+
+typedef struct _ch32fun_link_obj_t {
+	mp_obj_base_t base;
+	mp_int_t timeout; // ms for read/write, -1 waits forever
+} ch32fun_link_obj_t;
+
+typedef struct {
+	uint8_t len;
+	uint8_t data[LINK_MTU];
+} link_frag_t;
+
+static uint32_t link_access_addr;
+static uint8_t link_channel;
+static uint8_t link_phy;
+static volatile uint8_t link_open;
+static volatile uint8_t link_dead;
+
+// TX window, fragment for sequence number s lives in tx_win[s % LINK_WINDOW]
+static link_frag_t tx_win[LINK_WINDOW];
+static volatile uint8_t tx_base; // oldest unacked
+static volatile uint8_t tx_next; // next to put on air
+static volatile uint8_t tx_end;  // next free
+static volatile uint8_t tx_busy;
+static uint8_t tx_retries;
+
+// RX byte stream
+static uint8_t link_rx_data[LINK_RX_BUF_SIZE];
+static volatile uint16_t rx_buf_head;
+static volatile uint16_t rx_buf_tail;
+static volatile uint8_t rx_expected; // next sequence number we accept
+
+static ch32fun_timer_t tx_timer;
+static ch32fun_timer_t rto_timer;
+static ch32fun_timer_t ack_timer;
+
+// frames on their way out, each is left alone until its done callback ran
+static ch32fun_isler_txreq_t data_req;
+static ch32fun_isler_txreq_t ack_req;
+static uint8_t data_frame[4 + LINK_MTU];
+static uint8_t ack_frame[4];
+static volatile uint8_t ack_sending;
+
+// counters for stats()
+static volatile uint32_t stat_tx;
+static volatile uint32_t stat_retransmit;
+static volatile uint32_t stat_rx;
+static volatile uint32_t stat_rx_rejected; // duplicate, out of order or no room
+
+static size_t rx_buf_count(void) {
+	return (rx_buf_head + LINK_RX_BUF_SIZE - rx_buf_tail) % LINK_RX_BUF_SIZE;
+}
+
+static size_t rx_buf_free(void) {
+	return LINK_RX_BUF_SIZE - 1 - rx_buf_count();
+}
+
+static void link_send(ch32fun_isler_txreq_t *req, uint8_t *frame, uint8_t type, uint8_t seq, const uint8_t *data, size_t len) {
+	frame[0] = type;
+	frame[1] = len + 2;
+	frame[2] = seq;
+	frame[3] = rx_expected;
+	if (len) {
+		memcpy(&frame[4], data, len);
+	}
+	req->frame = frame;
+	req->len = len + 4;
+	req->access_addr = link_access_addr;
+	req->channel = link_channel;
+	req->phy_mode = link_phy;
+	ch32fun_isler_tx_queue(req); // iSLER re-arms our RX once it is out
+}
+
+// Called from the iSLER TX interrupt
+static void data_done(ch32fun_isler_txreq_t *req) {
+	ch32fun_timer_start(&tx_timer, LINK_GAP_US);
+}
+
+// Called from the SysTick ISR
+static void tx_timer_cb(ch32fun_timer_t *timer) {
+	if (!link_open || tx_next == tx_end) {
+		tx_busy = 0;
+		return;
+	}
+
+	link_frag_t *frag = &tx_win[tx_next % LINK_WINDOW];
+	link_send(&data_req, data_frame, LINK_DATA, tx_next, frag->data, frag->len);
+	tx_next++;
+	stat_tx++;
+
+	ch32fun_timer_stop(&ack_timer); // the ack rides along
+	ch32fun_timer_start(&rto_timer, LINK_RTO_US);
+}
+
+static void tx_kick(void) {
+	uint32_t mstatus = __get_MSTATUS();
+	__disable_irq();
+	if (!tx_busy) {
+		tx_busy = 1;
+		ch32fun_timer_start(&tx_timer, 0);
+	}
+	__set_MSTATUS(mstatus);
+}
+
+// Called from the SysTick ISR
+static void rto_timer_cb(ch32fun_timer_t *timer) {
+	if (tx_base == tx_end) {
+		return;
+	}
+	if (++tx_retries > LINK_MAX_RETRIES) {
+		link_dead = 1;
+		return;
+	}
+	stat_retransmit += (uint8_t)(tx_next - tx_base);
+	tx_next = tx_base;
+	tx_kick();
+}
+
+// Called from the iSLER TX interrupt
+static void ack_done(ch32fun_isler_txreq_t *req) {
+	ack_sending = 0;
+}
+
+// Called from the SysTick ISR
+static void ack_timer_cb(ch32fun_timer_t *timer) {
+	if (ack_sending) {
+		ch32fun_timer_start(timer, LINK_GAP_US); // the last one is still going out
+		return;
+	}
+	ack_sending = 1;
+	link_send(&ack_req, ack_frame, LINK_ACK, 0, NULL, 0);
+}
+
+// Called from the RF ISR
+static void link_ack(uint8_t ack) {
+	// only move forward, and never past what was queued
+	if ((uint8_t)(ack - tx_base) == 0 || (uint8_t)(ack - tx_base) > (uint8_t)(tx_end - tx_base)) {
+		return;
+	}
+	if ((uint8_t)(ack - tx_base) > (uint8_t)(tx_next - tx_base)) {
+		tx_next = ack; // acks for a burst sent before the last retransmit timeout
+	}
+	tx_base = ack;
+	tx_retries = 0;
+	if (tx_base == tx_end) {
+		ch32fun_timer_stop(&rto_timer);
+	}
+	else {
+		ch32fun_timer_start(&rto_timer, LINK_RTO_US);
+		tx_kick();
+	}
+}
+
+// Called from the RF ISR
+static int link_rx_hook(const uint8_t *frame, size_t len) {
+	if (!ch32fun_isler_rx_is(link_access_addr, link_channel)) {
+		return 0;
+	}
+	if (frame[0] != LINK_DATA && frame[0] != LINK_ACK) {
+		return 0;
+	}
+	if (len < 4) {
+		ch32fun_isler_resume();
+		return 1;
+	}
+
+	// anything from the peer shows it is alive, even when its RX buffer is
+	// full and the ack does not move, so only silence counts towards dead
+	tx_retries = 0;
+	link_ack(frame[3]);
+
+	if (frame[0] == LINK_DATA) {
+		size_t n = len - 4;
+		if (frame[2] == rx_expected && n <= rx_buf_free()) {
+			for (size_t i = 0; i < n; i++) {
+				link_rx_data[rx_buf_head] = frame[4 + i];
+				rx_buf_head = (rx_buf_head + 1) % LINK_RX_BUF_SIZE;
+			}
+			rx_expected++;
+			stat_rx++;
+		}
+		else {
+			stat_rx_rejected++;
+		}
+		ch32fun_timer_start(&ack_timer, LINK_ACK_DELAY_US);
+	}
+
+	ch32fun_isler_resume();
+	return 1;
+}
+
+static void link_close(void) {
+	link_open = 0;
+	ch32fun_isler_hook(link_rx_hook, 0);
+	ch32fun_timer_stop(&tx_timer);
+	ch32fun_timer_stop(&rto_timer);
+	ch32fun_timer_stop(&ack_timer);
+	ch32fun_isler_tx_cancel(&data_req);
+	ch32fun_isler_tx_cancel(&ack_req);
+	tx_busy = 0;
+	ack_sending = 0;
+}
+
+// Wait for cond() or the timeout, raises once the link is dead
+static void link_wait(ch32fun_link_obj_t *self, int (*cond)(void)) {
+	mp_uint_t start = mp_hal_ticks_ms();
+	while (!cond()) {
+		if (link_dead) {
+			mp_raise_OSError(MP_ECONNRESET);
+		}
+		if (self->timeout >= 0 && mp_hal_ticks_ms() - start >= (mp_uint_t)self->timeout) {
+			mp_raise_OSError(MP_ETIMEDOUT);
+		}
+		mp_hal_background_processing();
+	}
+}
+
+static int link_can_read(void) {
+	return rx_buf_count() > 0;
+}
+
+static int link_can_write(void) {
+	return (uint8_t)(tx_end - tx_base) < LINK_WINDOW;
+}
+
+static int link_flushed(void) {
+	return tx_base == tx_end;
+}
+
+// ==========================================================================
+// Python Methods
+// ==========================================================================
+
+// Usage: ch32fun.Link(access_addr, channel, phy_mode, timeout=-1)
+static mp_obj_t link_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+	enum { ARG_access_addr, ARG_channel, ARG_phy_mode, ARG_timeout };
+	static const mp_arg_t allowed_args[] = {
+		{ MP_QSTR_access_addr, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+		{ MP_QSTR_channel,     MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+		{ MP_QSTR_phy_mode,    MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+		{ MP_QSTR_timeout,     MP_ARG_INT, {.u_int = -1} },
+	};
+
+	mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+	mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+	link_close();
+	link_access_addr = mp_obj_get_int_truncated(args[ARG_access_addr].u_obj);
+	link_channel = args[ARG_channel].u_int;
+	link_phy = args[ARG_phy_mode].u_int;
+	tx_base = tx_next = tx_end = 0;
+	tx_retries = 0;
+	rx_buf_head = rx_buf_tail = 0;
+	rx_expected = 0;
+	stat_tx = stat_retransmit = stat_rx = stat_rx_rejected = 0;
+	link_dead = 0;
+
+	tx_timer.callback = tx_timer_cb;
+	rto_timer.callback = rto_timer_cb;
+	ack_timer.callback = ack_timer_cb;
+	data_req.done = data_done;
+	ack_req.done = ack_done;
+	ch32fun_isler_hook(link_rx_hook, 1);
+	link_open = 1;
+	ch32fun_isler_rx(link_access_addr, link_channel, link_phy);
+
+	ch32fun_link_obj_t *self = mp_obj_malloc(ch32fun_link_obj_t, type);
+	self->timeout = args[ARG_timeout].u_int;
+	return MP_OBJ_FROM_PTR(self);
+}
+
+static mp_uint_t link_read(mp_obj_t self_in, void *buf_in, mp_uint_t size, int *errcode) {
+	ch32fun_link_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	uint8_t *buf = buf_in;
+
+	if (size == 0) {
+		return 0;
+	}
+	link_wait(self, link_can_read);
+
+	mp_uint_t n = 0;
+	while (n < size && rx_buf_count() > 0) {
+		buf[n++] = link_rx_data[rx_buf_tail];
+		rx_buf_tail = (rx_buf_tail + 1) % LINK_RX_BUF_SIZE;
+	}
+	return n;
+}
+
+static mp_uint_t link_write(mp_obj_t self_in, const void *buf_in, mp_uint_t size, int *errcode) {
+	ch32fun_link_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	const uint8_t *buf = buf_in;
+
+	for (mp_uint_t done = 0; done < size; ) {
+		link_wait(self, link_can_write);
+
+		link_frag_t *frag = &tx_win[tx_end % LINK_WINDOW];
+		frag->len = (size - done < LINK_MTU) ? size - done : LINK_MTU;
+		memcpy(frag->data, &buf[done], frag->len);
+		done += frag->len;
+		tx_end++;
+		tx_kick();
+	}
+	return size;
+}
+
+static mp_uint_t link_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_t arg, int *errcode) {
+	ch32fun_link_obj_t *self = MP_OBJ_TO_PTR(self_in);
+
+	if (request == MP_STREAM_POLL) {
+		mp_uint_t ret = 0;
+		if ((arg & MP_STREAM_POLL_RD) && link_can_read()) ret |= MP_STREAM_POLL_RD;
+		if ((arg & MP_STREAM_POLL_WR) && link_can_write()) ret |= MP_STREAM_POLL_WR;
+		return ret;
+	}
+	else if (request == MP_STREAM_FLUSH) {
+		link_wait(self, link_flushed);
+		return 0;
+	}
+	else if (request == MP_STREAM_CLOSE) {
+		link_close();
+		return 0;
+	}
+
+	*errcode = MP_EINVAL;
+	return MP_STREAM_ERROR;
+}
+
+// Usage: link.any() -> bytes waiting to be read
+static mp_obj_t link_any(mp_obj_t self_in) {
+	return MP_OBJ_NEW_SMALL_INT(rx_buf_count());
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(link_any_obj, link_any);
+
+// Usage: link.stats() -> (frames sent, retransmitted, frames received, rejected)
+static mp_obj_t link_stats(mp_obj_t self_in) {
+	mp_obj_t items[4] = {
+		mp_obj_new_int_from_uint(stat_tx),
+		mp_obj_new_int_from_uint(stat_retransmit),
+		mp_obj_new_int_from_uint(stat_rx),
+		mp_obj_new_int_from_uint(stat_rx_rejected),
+	};
+	return mp_obj_new_tuple(4, items);
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(link_stats_obj, link_stats);
+
+static const mp_rom_map_elem_t link_locals_dict_table[] = {
+	{ MP_ROM_QSTR(MP_QSTR_read),     MP_ROM_PTR(&mp_stream_read_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_readinto), MP_ROM_PTR(&mp_stream_readinto_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_write),    MP_ROM_PTR(&mp_stream_write_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_flush),    MP_ROM_PTR(&mp_stream_flush_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_close),    MP_ROM_PTR(&mp_stream_close_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_any),      MP_ROM_PTR(&link_any_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_stats),    MP_ROM_PTR(&link_stats_obj) },
+};
+static MP_DEFINE_CONST_DICT(link_locals_dict, link_locals_dict_table);
+
+static const mp_stream_p_t link_stream_p = {
+	.read = link_read,
+	.write = link_write,
+	.ioctl = link_ioctl,
+};
+
+// NOTE: Not static
+MP_DEFINE_CONST_OBJ_TYPE(
+	ch32fun_link_type,
+	MP_QSTR_Link,
+	MP_TYPE_FLAG_ITER_IS_STREAM,
+	make_new, link_make_new,
+	protocol, &link_stream_p,
+	locals_dict, &link_locals_dict
+);
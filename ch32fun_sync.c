@@ -0,0 +1,357 @@
+#include "py/runtime.h"
+#include "py/mphal.h"
+#include "modch32fun.h"
+#include <stdlib.h>
+#include <string.h>
+
+// ==========================================================================
+// Timesync Submodule: shared microsecond clock from RF beacons (FTSP style)
+// ==========================================================================
+// The root sends beacons carrying its clock. Every node stamps their arrival
+// in the RF interrupt and fits global time against local SysTick time by
+// linear regression over the last few beacons. That gives the offset and
+// the skew of our crystal against the root's. Synced nodes repeat the
+// beacon, so the time base floods over several hops. The sequence number
+// keeps old beacons from coming back around.
+// The fit runs in task context, in integers: local ticks and global us wrap
+// on different bases, so both only ever appear as 32 bit ages back from the
+// newest beacon, each in its own base.
+// Beacons are [type, len, root_id (2), seq, global_us (4)] on channel 37.
+#define SYNC_BEACON        0x0D // PDU type the advertising channels don't use
+#define SYNC_CHANNEL       37
+#define SYNC_ACCESS_ADDR   0x8E89BED6 // the advertising one, so scanners on 37 hear beacons too
+#define SYNC_TABLE_SIZE    8
+#define SYNC_OUTLIER_US    1000  // a beacon this far off the fit restarts it
+#define SYNC_MAX_PPM       1000  // beyond this it is not a crystal, the entry is left out
+#define SYNC_TIMEOUT_US    20000000 // 32 bit SysTick differences wrap after ~29 s at 144 MHz
+#define SYNC_TIMEOUT_TICKS ((uint32_t)SYNC_TIMEOUT_US * DELAY_US_TIME)
+
+// Beacon airtime at 1M (preamble, access address, header, payload, CRC) plus
+// the time from iSLERTX() to the first bit. The receiver stamps the end of the frame.
+#define SYNC_TX_SETUP_US   40
+#define SYNC_LATENCY_US    (SYNC_TX_SETUP_US + (1 + 4 + 2 + 9 + 3) * 8)
+
+typedef struct {
+	uint32_t local;  // SysTick ticks at arrival
+	uint32_t global; // root time in us
+} sync_entry_t;
+
+static sync_entry_t sync_table[SYNC_TABLE_SIZE];
+static uint8_t sync_count;
+static uint8_t sync_next; // oldest entry, replaced next
+static uint8_t sync_epoch; // bumped by sync_reset(), a fit of an older table is dropped
+static volatile uint8_t sync_fit_pending;
+
+// current estimate: global = ref_global + (1 + skew / 2^32) * (local - ref_local)
+static volatile uint32_t ref_local;
+static volatile uint32_t ref_global;
+static volatile int32_t sync_skew;
+
+static uint16_t sync_node_id;
+static uint16_t sync_root_id;
+static uint8_t sync_seq;
+static volatile uint8_t sync_running;
+static volatile uint8_t sync_is_root;
+static volatile uint8_t sync_synced;
+static uint32_t sync_period_us;
+static uint32_t sync_seed;
+static ch32fun_timer_t sync_timer;
+static ch32fun_isler_txreq_t sync_req;
+static uint8_t sync_frame[11];
+static volatile uint8_t sync_sending;
+
+// counters for stats()
+static volatile uint32_t stat_beacons;
+static volatile uint32_t stat_resets;
+
+// local is never before ref_local, and no more than SYNC_TIMEOUT_TICKS after
+static uint32_t sync_global_at(uint32_t local) {
+	uint32_t dl = (local - ref_local) / DELAY_US_TIME;
+	return ref_global + dl + (uint32_t)(((int64_t)sync_skew * dl) >> 32);
+}
+
+// Scheduled per beacon, least squares fit of r = global age - local age
+// against the local age x, relative to the newest entry: r = a + skew * x
+static mp_obj_t sync_fit(mp_obj_t unused) {
+	sync_entry_t table[SYNC_TABLE_SIZE];
+	uint32_t mstatus = __get_MSTATUS();
+	__disable_irq();
+	sync_fit_pending = 0;
+	uint8_t epoch = sync_epoch;
+	uint8_t count = sync_count;
+	const sync_entry_t newest = sync_table[(sync_next + SYNC_TABLE_SIZE - 1) % SYNC_TABLE_SIZE];
+	memcpy(table, sync_table, sizeof(table));
+	__set_MSTATUS(mstatus);
+
+	int64_t sx = 0, sr = 0, sxx = 0, sxr = 0;
+	int n = 0;
+	for (int i = 0; i < count; i++) {
+		uint32_t age = newest.local - table[i].local;
+		if (age > SYNC_TIMEOUT_TICKS) {
+			continue; // the tick difference may have wrapped
+		}
+		int32_t x = age / DELAY_US_TIME;
+		int32_t r = (int32_t)(newest.global - table[i].global) - x;
+		if (abs(r) > x / (1000000 / SYNC_MAX_PPM) + SYNC_OUTLIER_US) {
+			continue;
+		}
+		sx += x;
+		sr += r;
+		sxx += (int64_t)x * x;
+		sxr += (int64_t)x * r;
+		n++;
+	}
+	if (n == 0) {
+		return mp_const_none;
+	}
+
+	// skew in 2^-32 units: n * sxr - sx * sr stays below 2^47, so * 2^16 fits
+	int64_t den = n * sxx - sx * sx;
+	int64_t skew = 0;
+	if ((den >> 16) > 0) {
+		skew = (n * sxr - sx * sr) * 65536 / (den >> 16);
+	}
+	if (skew > INT32_MAX || skew < INT32_MIN) {
+		skew = 0;
+	}
+	int32_t a = (sr - ((skew * sx) >> 32)) / n;
+
+	mstatus = __get_MSTATUS();
+	__disable_irq();
+	if (epoch == sync_epoch) {
+		ref_local = newest.local;
+		ref_global = newest.global - a;
+		sync_skew = skew;
+		sync_synced = n >= 2;
+	}
+	__set_MSTATUS(mstatus);
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(sync_fit_obj, sync_fit);
+
+static void sync_reset(void) {
+	sync_count = 0;
+	sync_next = 0;
+	sync_synced = 0;
+	sync_skew = 0;
+	sync_epoch++;
+}
+
+// Called from the RF ISR
+static int sync_rx_hook(const uint8_t *frame, size_t len) {
+	uint32_t now = ch32fun_isler_rx_ticks();
+	if (frame[0] != SYNC_BEACON || !ch32fun_isler_rx_is(SYNC_ACCESS_ADDR, SYNC_CHANNEL)) {
+		return 0;
+	}
+	if (len < 11 || sync_is_root) {
+		ch32fun_isler_resume();
+		return 1;
+	}
+
+	uint16_t root = frame[2] | (frame[3] << 8);
+	uint8_t seq = frame[4];
+	uint32_t global = frame[5] | (frame[6] << 8) | (frame[7] << 16) | ((uint32_t)frame[8] << 24);
+	global += SYNC_LATENCY_US;
+
+	// a lower root id takes over, the same root only with a newer beacon
+	int fresh = sync_count == 0 || root < sync_root_id ||
+		(root == sync_root_id && (int8_t)(seq - sync_seq) > 0);
+	if (fresh) {
+		if (sync_count > 0 && (root != sync_root_id ||
+			(sync_synced && abs((int32_t)(sync_global_at(now) - global)) > SYNC_OUTLIER_US))) {
+			sync_reset();
+			stat_resets++;
+		}
+		sync_root_id = root;
+		sync_seq = seq;
+
+		sync_entry_t *e = &sync_table[sync_next];
+		e->local = now;
+		e->global = global;
+		sync_next = (sync_next + 1) % SYNC_TABLE_SIZE;
+		if (sync_count < SYNC_TABLE_SIZE) sync_count++;
+
+		if (!sync_fit_pending) {
+			sync_fit_pending = mp_sched_schedule(MP_OBJ_FROM_PTR(&sync_fit_obj), mp_const_none);
+		}
+		stat_beacons++;
+	}
+
+	ch32fun_isler_resume();
+	return 1;
+}
+
+// Called from the iSLER TX interrupt right before the beacon goes on air
+static void sync_tx_start(ch32fun_isler_txreq_t *req) {
+	uint32_t mstatus = __get_MSTATUS();
+	__disable_irq();
+	uint32_t global = sync_global_at(funSysTick32());
+	__set_MSTATUS(mstatus);
+	sync_frame[5] = global & 0xFF;
+	sync_frame[6] = (global >> 8) & 0xFF;
+	sync_frame[7] = (global >> 16) & 0xFF;
+	sync_frame[8] = global >> 24;
+}
+
+// Called from the iSLER TX interrupt
+static void sync_tx_done(ch32fun_isler_txreq_t *req) {
+	sync_sending = 0;
+}
+
+// Called from the SysTick ISR
+static void sync_timer_cb(ch32fun_timer_t *timer) {
+	uint32_t now = funSysTick32();
+
+	// spread repeaters out so they don't all answer the root at once
+	sync_seed = sync_seed * 1664525 + 1013904223;
+	ch32fun_timer_start(timer, sync_period_us - sync_period_us / 8 + (sync_seed >> 8) % (sync_period_us / 4));
+	if (sync_sending) {
+		return; // the last beacon is still waiting for the radio
+	}
+
+	if (sync_is_root) {
+		// keep the reference recent so the 32 bit tick difference never wraps
+		uint32_t dt = now - ref_local;
+		ref_global += dt / DELAY_US_TIME;
+		ref_local = now - dt % DELAY_US_TIME;
+		sync_root_id = sync_node_id;
+		sync_seq++;
+	}
+	else if (!sync_synced) {
+		return;
+	}
+	else if (now - ref_local > SYNC_TIMEOUT_TICKS) {
+		sync_reset(); // lost the root
+		return;
+	}
+
+	// global_us is filled in by sync_tx_start()
+	sync_frame[0] = SYNC_BEACON;
+	sync_frame[1] = 9;
+	sync_frame[2] = sync_root_id & 0xFF;
+	sync_frame[3] = sync_root_id >> 8;
+	sync_frame[4] = sync_seq;
+	sync_frame[9] = 0;
+	sync_frame[10] = 0;
+	sync_sending = 1;
+	ch32fun_isler_tx_queue(&sync_req);
+}
+
+// Time on the shared clock, plain local time until synced
+uint32_t ch32fun_synctime_us(void) {
+	uint32_t mstatus = __get_MSTATUS();
+	__disable_irq();
+	uint32_t t = (sync_synced || sync_is_root) ? sync_global_at(funSysTick32()) : mp_hal_ticks_us();
+	__set_MSTATUS(mstatus);
+	return t;
+}
+
+// ==========================================================================
+// Python Methods
+// ==========================================================================
+
+// Usage: ch32fun.timesync.start(node_id, root=False, period_ms=1000)
+static mp_obj_t fun_sync_start(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+	enum { ARG_node_id, ARG_root, ARG_period_ms };
+	static const mp_arg_t allowed_args[] = {
+		{ MP_QSTR_node_id,   MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+		{ MP_QSTR_root,      MP_ARG_BOOL, {.u_bool = false} },
+		{ MP_QSTR_period_ms, MP_ARG_INT, {.u_int = 1000} },
+	};
+
+	mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+	mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+	if (args[ARG_period_ms].u_int < 20 || args[ARG_period_ms].u_int > SYNC_TIMEOUT_US / 4000) {
+		mp_raise_ValueError(MP_ERROR_TEXT("bad period"));
+	}
+
+	ch32fun_timer_stop(&sync_timer);
+	ch32fun_isler_tx_cancel(&sync_req);
+	sync_sending = 0;
+	sync_reset();
+	sync_node_id = args[ARG_node_id].u_int;
+	sync_is_root = args[ARG_root].u_bool;
+	sync_root_id = sync_is_root ? sync_node_id : 0xFFFF;
+	sync_period_us = args[ARG_period_ms].u_int * 1000;
+	sync_seed ^= funSysTick32() ^ sync_node_id;
+	stat_beacons = stat_resets = 0;
+
+	if (sync_is_root) {
+		ref_local = funSysTick32();
+		ref_global = mp_hal_ticks_us();
+	}
+
+	if (!sync_running) {
+		ch32fun_isler_hook(sync_rx_hook, 1);
+		sync_running = 1;
+	}
+	ch32fun_isler_rx_adv(SYNC_CHANNEL);
+	sync_req.start = sync_tx_start;
+	sync_req.done = sync_tx_done;
+	sync_req.frame = sync_frame;
+	sync_req.len = sizeof(sync_frame);
+	sync_req.access_addr = SYNC_ACCESS_ADDR;
+	sync_req.channel = SYNC_CHANNEL;
+	sync_req.phy_mode = ch32fun_isler_phy_1m;
+	sync_timer.callback = sync_timer_cb;
+	ch32fun_timer_start(&sync_timer, sync_period_us);
+
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_KW(fun_sync_start_obj, 1, fun_sync_start);
+
+// Usage: ch32fun.timesync.stop()
+static mp_obj_t fun_sync_stop(void) {
+	ch32fun_timer_stop(&sync_timer);
+	ch32fun_isler_tx_cancel(&sync_req);
+	sync_sending = 0;
+	ch32fun_isler_hook(sync_rx_hook, 0);
+	sync_running = 0;
+	sync_is_root = 0;
+	sync_reset();
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_0(fun_sync_stop_obj, fun_sync_stop);
+
+// Usage: ch32fun.timesync.synced() -> True once the clock follows a root
+static mp_obj_t fun_sync_synced(void) {
+	return mp_obj_new_bool(sync_synced || sync_is_root);
+}
+static MP_DEFINE_CONST_FUN_OBJ_0(fun_sync_synced_obj, fun_sync_synced);
+
+// Usage: ch32fun.timesync.stats() -> (root_id, skew_ppm, entries, beacons, resets)
+static mp_obj_t fun_sync_stats(void) {
+	mp_obj_t items[5] = {
+		MP_OBJ_NEW_SMALL_INT(sync_root_id),
+		MP_OBJ_NEW_SMALL_INT((mp_int_t)(((int64_t)sync_skew * 1000000) >> 32)),
+		MP_OBJ_NEW_SMALL_INT(sync_count),
+		mp_obj_new_int_from_uint(stat_beacons),
+		mp_obj_new_int_from_uint(stat_resets),
+	};
+	return mp_obj_new_tuple(5, items);
+}
+static MP_DEFINE_CONST_FUN_OBJ_0(fun_sync_stats_obj, fun_sync_stats);
+
+// Usage: ch32fun.synctime_us()
+static mp_obj_t fun_synctime_us(void) {
+	return mp_obj_new_int_from_uint(ch32fun_synctime_us());
+}
+MP_DEFINE_CONST_FUN_OBJ_0(ch32fun_synctime_us_obj, fun_synctime_us);
+
+static const mp_rom_map_elem_t sync_locals_dict_table[] = {
+	{ MP_ROM_QSTR(MP_QSTR_start),  MP_ROM_PTR(&fun_sync_start_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_stop),   MP_ROM_PTR(&fun_sync_stop_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_synced), MP_ROM_PTR(&fun_sync_synced_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_stats),  MP_ROM_PTR(&fun_sync_stats_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_time_us), MP_ROM_PTR(&ch32fun_synctime_us_obj) },
+};
+static MP_DEFINE_CONST_DICT(sync_locals_dict, sync_locals_dict_table);
+
+// NOTE: Not static
+MP_DEFINE_CONST_OBJ_TYPE(
+	ch32fun_timesync_type,
+	MP_QSTR_timesync,
+	MP_TYPE_FLAG_NONE,
+	locals_dict, &sync_locals_dict
+);
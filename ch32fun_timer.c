@@ -0,0 +1,91 @@
+#include "py/runtime.h"
+#include "py/mphal.h"
+#include "modch32fun.h"
+
+// ==========================================================================
+// Software Timers on the SysTick Compare Interrupt
+// ==========================================================================
+// SysTick keeps free running for mp_hal_ticks_*(), we only move its compare
+// value to the earliest pending deadline. Timers are kept in a list sorted
+// by deadline and callbacks run in interrupt context.
+
+void SysTick_Handler(void) __attribute__((interrupt)) __attribute__((used));
+
+static ch32fun_timer_t *timer_head;
+
+// wrap safe "a is before b" on 32 bit tick values
+static inline int timer_before(uint32_t a, uint32_t b) {
+	return (int32_t)(a - b) < 0;
+}
+
+static void timer_arm(void) {
+	if (timer_head == NULL) {
+		SysTick->CTLR &= ~SYSTICK_CTLR_STIE;
+		return;
+	}
+
+	int32_t delta = (int32_t)(timer_head->deadline - funSysTick32());
+	if (delta < DELAY_US_TIME) {
+		delta = DELAY_US_TIME; // already due, fire as soon as possible
+	}
+	SysTick->CMP = SysTick->CNT + delta;
+	SysTick->SR = 0;
+	SysTick->CTLR |= SYSTICK_CTLR_STIE;
+}
+
+static void timer_unlink(ch32fun_timer_t *timer) {
+	for (ch32fun_timer_t **p = &timer_head; *p != NULL; p = &(*p)->next) {
+		if (*p == timer) {
+			*p = timer->next;
+			break;
+		}
+	}
+	timer->next = NULL;
+}
+
+static void timer_insert(ch32fun_timer_t *timer) {
+	ch32fun_timer_t **p = &timer_head;
+	while (*p != NULL && !timer_before(timer->deadline, (*p)->deadline)) {
+		p = &(*p)->next;
+	}
+	timer->next = *p;
+	*p = timer;
+}
+
+void ch32fun_timer_start(ch32fun_timer_t *timer, uint32_t delay_us) {
+	static int irq_enabled = 0;
+	if (!irq_enabled) {
+		NVIC_EnableIRQ(SysTick_IRQn);
+		irq_enabled = 1;
+	}
+
+	uint32_t mstatus = __get_MSTATUS();
+	__disable_irq();
+	timer_unlink(timer);
+	timer->deadline = funSysTick32() + delay_us * DELAY_US_TIME;
+	timer_insert(timer);
+	timer_arm();
+	__set_MSTATUS(mstatus);
+}
+
+void ch32fun_timer_stop(ch32fun_timer_t *timer) {
+	uint32_t mstatus = __get_MSTATUS();
+	__disable_irq();
+	timer_unlink(timer);
+	timer_arm();
+	__set_MSTATUS(mstatus);
+}
+
+void SysTick_Handler(void) {
+	SysTick->SR = 0;
+
+	// callbacks may restart their own timer, so pop before calling
+	while (timer_head != NULL && !timer_before(funSysTick32(), timer_head->deadline)) {
+		ch32fun_timer_t *timer = timer_head;
+		timer_head = timer->next;
+		timer->next = NULL;
+		timer->callback(timer);
+	}
+
+	timer_arm();
+}
@@ -0,0 +1,441 @@
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "py/mphal.h"
+#include "modch32fun.h"
+#include <string.h>
+
+// ==========================================================================
+// update Submodule
+// ==========================================================================
+// Firmware images are staged in a slot above the running one. Once staged
+// and verified, the next boot swaps both slots sector by sector through a
+// scratch sector, so the previous image ends up in the staging slot. The slot
+// starts at the first sector above the larger of both images, everything
+// below it is swapped; its address is part of the update state so the image
+// rolled back to uses the same one. The new
+// image has to call update.confirm() within UPDATE_CONFIRM_S seconds: if it
+// resets before that, or hangs and the watchdog resets it, the boot after
+// swaps back. Every step of a swap is recorded in the trailer sector, so a
+// swap that loses power resumes where it stopped.
+//
+// Since the image is linked to run from 0 this is A/B in the MCUboot "swap"
+// sense, there is no second execution slot.
+
+#define UPDATE_MAGIC    0x31445055 // "UPD1"
+#define UPDATE_FLAG     0x5AA5F00F
+#define UPDATE_CHUNK    256 // streaming unit, one ACK per chunk
+#define UPDATE_ACK      0x06
+#define UPDATE_NAK      0x15
+#define UPDATE_CONFIRM_S 30     // a new image that has not confirmed by then is rolled back
+#define UPDATE_FEED_US  100000  // well inside the hardware watchdog period
+
+typedef struct {
+	uint32_t magic;
+	uint32_t size;
+	uint32_t crc;
+	uint32_t slot;      // start of the staging slot, also the size of both slots
+	// flags, each word is programmed once
+	uint32_t booted;    // the new image was started
+	uint32_t confirmed; // the new image called confirm()
+	uint32_t installed; // install swap done
+	uint32_t reverted;  // rollback swap done
+	// per sector: copied to scratch, staged <- running, running <- scratch
+	uint32_t progress[2][3 * UPDATE_SECTORS_MAX];
+} update_trailer_t;
+
+// not a const pointer variable, that would be read from flash during the swap
+#define TRAILER ((const volatile update_trailer_t *)UPDATE_TRAILER)
+
+// ==========================================================================
+// Boot time swap, runs from RAM with interrupts off
+// ==========================================================================
+// No library calls in here, they may live in the sectors being swapped.
+
+CH32FUN_RAMFUNC static bool update_is_set(uint32_t word) {
+	return word != FLASH_ERASED_WORD;
+}
+
+CH32FUN_RAMFUNC static void update_set_flag(const volatile uint32_t *word) {
+	uint32_t val = UPDATE_FLAG;
+	ch32fun_flash_program((uintptr_t)word, &val, 4);
+}
+
+CH32FUN_RAMFUNC static void update_copy_sector(uint32_t dst, uint32_t src) {
+	uint32_t buf[UPDATE_CHUNK / 4];
+
+	ch32fun_flash_erase(dst, FLASH_SECTOR_SIZE);
+	for (uint32_t off = 0; off < FLASH_SECTOR_SIZE; off += sizeof(buf)) {
+		for (int i = 0; i < UPDATE_CHUNK / 4; i++) {
+			buf[i] = ((const volatile uint32_t *)(uintptr_t)(src + off))[i];
+		}
+		ch32fun_flash_program(dst + off, buf, sizeof(buf));
+	}
+}
+
+CH32FUN_RAMFUNC static void update_swap(int pass) {
+	uint32_t slot = TRAILER->slot;
+
+	for (uint32_t i = 0; i < slot / FLASH_SECTOR_SIZE; i++) {
+		uint32_t running = FLASH_START + i * FLASH_SECTOR_SIZE;
+		uint32_t staged = slot + i * FLASH_SECTOR_SIZE;
+		const volatile uint32_t *step = &TRAILER->progress[pass][3 * i];
+
+		if (!update_is_set(step[0])) {
+			update_copy_sector(UPDATE_SCRATCH, staged);
+			update_set_flag(&step[0]);
+		}
+		if (!update_is_set(step[1])) {
+			update_copy_sector(staged, running);
+			update_set_flag(&step[1]);
+		}
+		if (!update_is_set(step[2])) {
+			update_copy_sector(running, UPDATE_SCRATCH);
+			update_set_flag(&step[2]);
+		}
+	}
+}
+
+CH32FUN_RAMFUNC static void update_reset(void) {
+#ifdef CH5xx
+	R8_SAFE_ACCESS_SIG = 0x57; // safe access mode
+	R8_SAFE_ACCESS_SIG = 0xA8;
+	R8_RST_WDOG_CTRL |= RB_SOFTWARE_RESET;
+#else
+	PFIC->CFGR = NVIC_KEY3 | (1 << 7); // system reset
+#endif
+	while (1);
+}
+
+// ==========================================================================
+// Confirm watchdog
+// ==========================================================================
+// The hardware watchdog runs from the first start of a new image until it
+// confirms. A timer feeds it for UPDATE_CONFIRM_S seconds and then stops, so
+// an image that hangs, with or without interrupts, is reset and rolled back.
+// The CH32 IWDG can't be stopped again, after confirm() the timer keeps it fed.
+
+static ch32fun_timer_t update_wdog_timer;
+static uint32_t update_wdog_left; // feeds until the deadline
+static bool update_wdog_confirmed;
+
+static void update_wdog_feed(void) {
+#ifdef CH5xx
+	R8_WDOG_COUNT = 0;
+#else
+	IWDG->CTLR = 0xAAAA;
+#endif
+}
+
+// Called from the SysTick ISR
+static void update_wdog_cb(ch32fun_timer_t *timer) {
+	if (!update_wdog_confirmed && update_wdog_left-- == 0) {
+		return; // out of time, let the watchdog reset
+	}
+	update_wdog_feed();
+	ch32fun_timer_start(timer, UPDATE_FEED_US);
+}
+
+static void update_wdog_start(void) {
+#ifdef CH5xx
+	// counts up at Fsys / 131072 and resets on overflow, 0.56 s at 60 MHz
+	R8_WDOG_COUNT = 0;
+	R8_SAFE_ACCESS_SIG = 0x57;
+	R8_SAFE_ACCESS_SIG = 0xA8;
+	R8_RST_WDOG_CTRL = (R8_RST_WDOG_CTRL | RB_WDOG_RST_EN | RB_WDOG_INT_FLAG) & ~RB_SOFTWARE_RESET;
+	R8_SAFE_ACCESS_SIG = 0;
+#else
+	// LSI 40 kHz / 64, reloaded with 1250: 2 s
+	IWDG->CTLR = 0x5555;
+	IWDG->PSCR = 4;
+	IWDG->RLDR = 1250;
+	IWDG->CTLR = 0xAAAA;
+	IWDG->CTLR = 0xCCCC;
+#endif
+	update_wdog_left = UPDATE_CONFIRM_S * (1000000 / UPDATE_FEED_US);
+	update_wdog_timer.callback = update_wdog_cb;
+	ch32fun_timer_start(&update_wdog_timer, UPDATE_FEED_US);
+}
+
+static void update_wdog_confirm(void) {
+	update_wdog_confirmed = true;
+#ifdef CH5xx
+	ch32fun_timer_stop(&update_wdog_timer);
+	R8_SAFE_ACCESS_SIG = 0x57;
+	R8_SAFE_ACCESS_SIG = 0xA8;
+	R8_RST_WDOG_CTRL &= ~(RB_WDOG_RST_EN | RB_SOFTWARE_RESET);
+	R8_SAFE_ACCESS_SIG = 0;
+#endif
+}
+
+CH32FUN_RAMFUNC void ch32fun_update_boot(void) {
+	if (TRAILER->magic != UPDATE_MAGIC || TRAILER->slot > UPDATE_SECTORS_MAX * FLASH_SECTOR_SIZE) {
+		return;
+	}
+
+	if (!update_is_set(TRAILER->installed)) {
+		__disable_irq(); // sector 0 holds the vector table
+		update_swap(0);
+		update_set_flag(&TRAILER->installed);
+		update_reset(); // the code we would return to was just replaced
+	}
+
+	if (update_is_set(TRAILER->confirmed)) {
+		return;
+	}
+
+	if (!update_is_set(TRAILER->reverted)) {
+		if (!update_is_set(TRAILER->booted)) {
+			// first start of the new image, it has until the watchdog runs out
+			// or the next reset to confirm. Nothing was swapped on this path,
+			// flash code is safe to call
+			update_set_flag(&TRAILER->booted);
+			update_wdog_start();
+			return;
+		}
+
+		__disable_irq();
+		update_swap(1);
+		update_set_flag(&TRAILER->reverted);
+		update_reset();
+	}
+
+	// rolled back, the previous image is running again
+	ch32fun_flash_erase(UPDATE_TRAILER, FLASH_SECTOR_SIZE);
+}
+
+// ==========================================================================
+// Staging
+// ==========================================================================
+
+static uint32_t update_slot;    // staging slot picked by begin()
+static uint32_t update_size;    // expected image size
+static volatile uint32_t update_written; // bytes programmed so far, read by the USB IRQ
+
+static void update_check(int err) {
+	if (err != 0) {
+		mp_raise_OSError(MP_EIO);
+	}
+}
+
+// Programs len bytes at addr, a trailing partial word is padded through a
+// local copy so nothing past the end of buf is read
+static int update_flash(uint32_t addr, const uint8_t *buf, size_t len) {
+	size_t body = len & ~3;
+	int err = (body > 0) ? ch32fun_flash_program(addr, buf, body) : 0;
+
+	if (err == 0 && body < len) {
+		uint32_t tail = 0xFFFFFFFF;
+		memcpy(&tail, buf + body, len - body);
+		err = ch32fun_flash_program(addr + body, &tail, 4);
+	}
+	return err;
+}
+
+// Programs the next part of the image, erasing sectors as they are reached
+static void update_program(const uint8_t *buf, size_t len) {
+	if (update_written + len > update_size) {
+		mp_raise_ValueError(MP_ERROR_TEXT("image larger than announced"));
+	}
+
+	uint32_t addr = update_slot + update_written;
+	uint32_t sector = (addr + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+	for (; sector < addr + len; sector += FLASH_SECTOR_SIZE) {
+		update_check(ch32fun_flash_erase(sector, FLASH_SECTOR_SIZE));
+	}
+
+	update_check(update_flash(addr, buf, len));
+	update_written += len;
+}
+
+// CDC streaming: the USB IRQ fills a two chunk ring, the receive loop
+// programs one chunk while the host sends the next.
+static uint8_t *update_rx_buf;
+static volatile uint32_t update_rx_count;
+static volatile bool update_rx_overrun;
+
+extern void (*volatile usb_cdc_rx_sink)(const uint8_t *data, int len);
+extern int usb_cdc_write(const uint8_t *buf, int size);
+
+static void update_rx_sink(const uint8_t *data, int len) {
+	for (int i = 0; i < len; i++) {
+		if (update_rx_count - update_written >= 2 * UPDATE_CHUNK) {
+			update_rx_overrun = true; // host did not wait for the ACK
+			return;
+		}
+		update_rx_buf[update_rx_count % (2 * UPDATE_CHUNK)] = data[i];
+		update_rx_count++;
+	}
+}
+
+static void update_send(uint8_t c) {
+	usb_cdc_write(&c, 1);
+}
+
+// ==========================================================================
+// Python Methods
+// ==========================================================================
+
+// Usage: update.begin(size), then write() the image in order
+static mp_obj_t fun_update_pending(void);
+
+static mp_obj_t fun_update_begin(mp_obj_t size_in) {
+	mp_int_t size = mp_obj_get_int(size_in);
+	uint32_t slot = MAX(FLASH_IMAGE_END, (uint32_t)size);
+	slot = (slot + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+	if (size <= 0 || 2 * slot > UPDATE_SCRATCH) {
+		mp_raise_ValueError(MP_ERROR_TEXT("image does not fit the slot"));
+	}
+
+	// erasing the trailer would keep the running image without confirm()
+	if (mp_obj_is_true(fun_update_pending())) {
+		mp_raise_msg(&mp_type_OSError, MP_ERROR_TEXT("running image not confirmed"));
+	}
+
+	// drop whatever was staged before
+	update_check(ch32fun_flash_erase(UPDATE_TRAILER, FLASH_SECTOR_SIZE));
+	update_slot = slot;
+	update_size = size;
+	update_written = 0;
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(fun_update_begin_obj, fun_update_begin);
+
+// Usage: update.write(buf), buf must be a multiple of 4 bytes except for the last one
+static mp_obj_t fun_update_write(mp_obj_t buf_in) {
+	mp_buffer_info_t bufinfo;
+	mp_get_buffer_raise(buf_in, &bufinfo, MP_BUFFER_READ);
+	if ((update_written & 3) != 0) {
+		mp_raise_ValueError(MP_ERROR_TEXT("unaligned write"));
+	}
+	update_program(bufinfo.buf, bufinfo.len);
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(fun_update_write_obj, fun_update_write);
+
+// Usage: update.recv(size[, timeout_ms])
+// Takes over the CDC input and receives the image in UPDATE_CHUNK byte chunks.
+// The host sends a chunk and waits for ACK (0x06) before sending the next one,
+// NAK (0x15) aborts. The ACK is sent as soon as a chunk is complete, before it
+// is programmed, so the transfer overlaps with flash programming.
+static mp_obj_t fun_update_recv(size_t n_args, const mp_obj_t *args) {
+	mp_uint_t timeout = (n_args > 1) ? mp_obj_get_int(args[1]) : 2000;
+
+	fun_update_begin(args[0]);
+	update_rx_buf = m_new(uint8_t, 2 * UPDATE_CHUNK);
+	update_rx_count = 0;
+	update_rx_overrun = false;
+	usb_cdc_rx_sink = update_rx_sink;
+
+	int err = 0;
+	mp_uint_t last = mp_hal_ticks_ms();
+	while (update_written < update_size) {
+		uint32_t chunk = update_size - update_written;
+		if (chunk > UPDATE_CHUNK) {
+			chunk = UPDATE_CHUNK;
+		}
+
+		if (update_rx_overrun) {
+			err = MP_EIO;
+			break;
+		}
+		if (update_rx_count - update_written < chunk) {
+			if (mp_hal_ticks_ms() - last > timeout) {
+				err = MP_ETIMEDOUT;
+				break;
+			}
+			continue;
+		}
+
+		// the other half of the ring is free, let the host send into it
+		const uint8_t *buf = &update_rx_buf[update_written % (2 * UPDATE_CHUNK)];
+		update_send(UPDATE_ACK);
+
+		uint32_t addr = update_slot + update_written;
+		if ((addr & (FLASH_SECTOR_SIZE - 1)) == 0 && ch32fun_flash_erase(addr, FLASH_SECTOR_SIZE) != 0) {
+			err = MP_EIO;
+			break;
+		}
+		if (update_flash(addr, buf, chunk) != 0) {
+			err = MP_EIO;
+			break;
+		}
+		update_written += chunk;
+		last = mp_hal_ticks_ms();
+	}
+
+	usb_cdc_rx_sink = NULL;
+	m_del(uint8_t, update_rx_buf, 2 * UPDATE_CHUNK);
+	update_rx_buf = NULL;
+
+	if (err != 0) {
+		update_send(UPDATE_NAK);
+		mp_raise_OSError(err);
+	}
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(fun_update_recv_obj, 1, 2, fun_update_recv);
+
+// Usage: update.finish(crc32), verifies the staged image and arms the swap
+static mp_obj_t fun_update_finish(mp_obj_t crc_in) {
+	uint32_t crc = mp_obj_get_int_truncated(crc_in);
+
+	if (update_size == 0 || update_written != update_size) {
+		mp_raise_ValueError(MP_ERROR_TEXT("image incomplete"));
+	}
+	if (ch32fun_crc32(0, (const void *)(uintptr_t)update_slot, update_size) != crc) {
+		mp_raise_ValueError(MP_ERROR_TEXT("CRC mismatch"));
+	}
+
+	uint32_t hdr[4] = { UPDATE_MAGIC, update_size, crc, update_slot };
+	update_check(ch32fun_flash_program(UPDATE_TRAILER, hdr, sizeof(hdr)));
+	update_size = 0;
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(fun_update_finish_obj, fun_update_finish);
+
+// Usage: update.pending() -> True while running a new image that is not confirmed yet
+static mp_obj_t fun_update_pending(void) {
+	return mp_obj_new_bool(TRAILER->magic == UPDATE_MAGIC
+		&& update_is_set(TRAILER->booted)
+		&& !update_is_set(TRAILER->confirmed)
+		&& !update_is_set(TRAILER->reverted));
+}
+static MP_DEFINE_CONST_FUN_OBJ_0(fun_update_pending_obj, fun_update_pending);
+
+// Usage: update.confirm(), keeps the running image
+static mp_obj_t fun_update_confirm(void) {
+	if (mp_obj_is_true(fun_update_pending())) {
+		update_set_flag(&TRAILER->confirmed);
+		update_wdog_confirm();
+		update_check(ch32fun_flash_erase(UPDATE_TRAILER, FLASH_SECTOR_SIZE));
+	}
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_0(fun_update_confirm_obj, fun_update_confirm);
+
+// Usage: update.reboot(), a staged image is installed on the way up
+static mp_obj_t fun_update_reboot(void) {
+	__disable_irq();
+	update_reset();
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_0(fun_update_reboot_obj, fun_update_reboot);
+
+static const mp_rom_map_elem_t update_locals_dict_table[] = {
+	{ MP_ROM_QSTR(MP_QSTR_begin),   MP_ROM_PTR(&fun_update_begin_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_write),   MP_ROM_PTR(&fun_update_write_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_recv),    MP_ROM_PTR(&fun_update_recv_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_finish),  MP_ROM_PTR(&fun_update_finish_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_pending), MP_ROM_PTR(&fun_update_pending_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_confirm), MP_ROM_PTR(&fun_update_confirm_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_reboot),  MP_ROM_PTR(&fun_update_reboot_obj) },
+};
+static MP_DEFINE_CONST_DICT(update_locals_dict, update_locals_dict_table);
+
+// NOTE: Not static
+MP_DEFINE_CONST_OBJ_TYPE(
+	ch32fun_update_type,
+	MP_QSTR_update,
+	MP_TYPE_FLAG_NONE,
+	locals_dict, &update_locals_dict
+);
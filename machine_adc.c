@@ -0,0 +1,484 @@
+#include "py/runtime.h"
+#include "py/mphal.h"
+#include "py/mperrno.h"
+#include "modmachine.h"
+
+#if MACHINE_HAS_ADC
+
+// ==========================================================================
+// machine.ADC
+// ==========================================================================
+// Single reads convert on demand. read_timed() and start() let the hardware
+// pace the conversions and DMA move the samples, raw 12 bit values into an
+// array('H'), with no per-sample work on the CPU.
+// CH32: TIM3 TRGO triggers the ADC1 regular conversion, DMA1 channel 1
+// runs circular over the buffer with half and full transfer interrupts.
+// CH5xx: the ADC's own auto-sample timer and DMA. That DMA has no half
+// transfer interrupt, so it runs one half at a time and the end interrupt
+// points it at the other half. Conversions that finish between the end of
+// one half and that re-point are dropped, so start() keeps at least 256
+// Fsys clocks between samples for the ISR; a longer interrupt lock still
+// loses samples there. The auto timer counts 16 Fsys clocks, which sets
+// the lowest rate to Fsys / 4096.
+#ifdef CH5xx
+static const uint32_t adc_pins[] = {
+	PA4, PA5, PA12, PA13, PA14, PA15, PA3, PA2, PA1, PA0, PA6, PA7, PA8, PA9,
+};
+#define ADC_CHANNELS 16
+#else
+#define ADC_CHANNELS 18 // 16 temperature, 17 internal reference
+#endif
+
+typedef struct _machine_adc_obj_t {
+	mp_obj_base_t base;
+	uint8_t channel;
+	mp_obj_t buf_obj; // keeps the continuous buffer alive
+	uint16_t *buf;
+	size_t len;
+	mp_obj_t callback;
+	volatile uint8_t pending; // halves scheduled but not handed to the callback yet
+	volatile uint32_t halves;
+	volatile uint32_t overruns;
+} machine_adc_obj_t;
+
+// the ADC running continuously, there is one converter
+MP_REGISTER_ROOT_POINTER(mp_obj_t machine_adc_obj);
+
+static int adc_pin_channel(uint32_t pin_id) {
+#ifdef CH5xx
+	for (size_t i = 0; i < MP_ARRAY_SIZE(adc_pins); i++) {
+		if (adc_pins[i] == pin_id) {
+			return i;
+		}
+	}
+	return -1;
+#else
+	if (pin_id < 8) {
+		return pin_id; // PA0-7
+	}
+	if (pin_id == 16 || pin_id == 17) {
+		return pin_id - 8; // PB0-1
+	}
+	if (pin_id >= 32 && pin_id < 38) {
+		return pin_id - 22; // PC0-5
+	}
+	return -1;
+#endif
+}
+
+static bool adc_busy(void) {
+	return MP_STATE_PORT(machine_adc_obj) != MP_OBJ_NULL;
+}
+
+// Scheduled per finished half, runs the callback
+static mp_obj_t adc_dispatch(mp_obj_t half_in) {
+	mp_obj_t obj = MP_STATE_PORT(machine_adc_obj);
+	if (obj == MP_OBJ_NULL) {
+		return mp_const_none;
+	}
+	machine_adc_obj_t *self = MP_OBJ_TO_PTR(obj);
+	self->pending &= ~(1 << MP_OBJ_SMALL_INT_VALUE(half_in));
+	if (self->callback != mp_const_none) {
+		mp_call_function_1(self->callback, half_in);
+	}
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(adc_dispatch_obj, adc_dispatch);
+
+// Called from the ADC DMA ISR. A half whose callback is still waiting
+// has been overwritten already, that counts as an overrun.
+static void adc_half_done(machine_adc_obj_t *self, int half) {
+	self->halves++;
+	if (self->pending & (1 << half)) {
+		self->overruns++;
+		return;
+	}
+	self->pending |= 1 << half;
+	if (!mp_sched_schedule(MP_OBJ_FROM_PTR(&adc_dispatch_obj), MP_OBJ_NEW_SMALL_INT(half))) {
+		self->pending &= ~(1 << half);
+		self->overruns++;
+	}
+}
+
+#ifdef CH5xx
+static void adc_init(void) {
+	R8_ADC_CFG = RB_ADC_POWER_ON | RB_ADC_BUF_EN; // PGA -12 dB for 0 to VDD, 3.2 MHz clock
+	R8_ADC_CTRL_DMA = 0;
+}
+
+static uint16_t adc_convert(uint8_t channel) {
+	R8_ADC_CHANNEL = channel;
+	R8_ADC_CONVERT = RB_ADC_START;
+	while (R8_ADC_CONVERT & RB_ADC_START) {
+	}
+	return R16_ADC_DATA & RB_ADC_DATA;
+}
+
+// ADC_IRQHandler() has this many auto timer steps to re-point the DMA
+#define ADC_REPOINT_CLOCKS 16
+
+static uint8_t adc_auto_cycle(mp_int_t rate, bool irq) {
+	mp_int_t clocks = FUNCONF_SYSTEM_CORE_CLOCK / 16 / ((rate > 0) ? rate : 1);
+	if (rate <= 0 || clocks < (irq ? ADC_REPOINT_CLOCKS : 1) || clocks > 255) {
+		mp_raise_ValueError(MP_ERROR_TEXT("rate out of range"));
+	}
+	return 256 - clocks; // one sample every (256 - cycle) * 16 Fsys clocks
+}
+
+static void adc_dma_to(uint16_t *buf, size_t len) {
+	R16_ADC_DMA_END = (uint32_t)(buf + len);
+	R16_ADC_DMA_BEG = (uint32_t)buf;
+	R8_ADC_DMA_IF = RB_ADC_IF_DMA_END;
+}
+
+static void adc_dma_start(machine_adc_obj_t *self, uint16_t *buf, size_t len, mp_int_t rate, bool irq) {
+	uint8_t cycle = adc_auto_cycle(rate, irq);
+	R8_ADC_CTRL_DMA = 0;
+	R8_ADC_CHANNEL = self->channel;
+	R8_ADC_AUTO_CYCLE = cycle;
+	adc_dma_to(buf, len);
+	if (irq) {
+		NVIC_EnableIRQ(ADC_IRQn);
+	}
+	R8_ADC_CTRL_DMA = RB_ADC_DMA_ENABLE | RB_ADC_AUTO_EN | (irq ? RB_ADC_IE_DMA_END : 0);
+}
+
+static bool adc_dma_done(void) {
+	return (R8_ADC_DMA_IF & RB_ADC_IF_DMA_END) != 0;
+}
+
+static void adc_dma_stop(void) {
+	R8_ADC_CTRL_DMA = 0;
+	R8_ADC_DMA_IF = RB_ADC_IF_DMA_END;
+	NVIC_DisableIRQ(ADC_IRQn);
+}
+
+// Called from the ADC ISR, one half is full, the DMA moves to the other
+void ADC_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void ADC_IRQHandler(void) {
+	mp_obj_t obj = MP_STATE_PORT(machine_adc_obj);
+	if (obj == MP_OBJ_NULL || !(R8_ADC_DMA_IF & RB_ADC_IF_DMA_END)) {
+		R8_ADC_DMA_IF = RB_ADC_IF_DMA_END;
+		return;
+	}
+	machine_adc_obj_t *self = MP_OBJ_TO_PTR(obj);
+	size_t half_len = self->len / 2;
+	int half = (R16_ADC_DMA_BEG == (uint16_t)(uint32_t)self->buf) ? 0 : 1;
+	adc_dma_to(self->buf + (half ? 0 : half_len), half_len);
+	adc_half_done(self, half);
+}
+#else
+// Sample times in ADC clocks, SAMPTR codes 0 to 7
+static const uint16_t adc_sample_x2[] = { 3, 15, 27, 57, 83, 111, 143, 479 };
+
+static uint32_t adc_clock;
+
+static void adc_init(void) {
+	// the ADC clock may not go above 14 MHz, machine_clock_init() has PCLK2
+	// low enough for that at ADCPRE /8
+	uint32_t pclk2 = machine_pclk2();
+	uint32_t div = 2;
+	while (div < 8 && pclk2 / div > 14000000) {
+		div += 2;
+	}
+
+	RCC->APB2PCENR |= RCC_ADC1EN;
+	RCC->APB1PCENR |= RCC_TIM3EN;
+	RCC->AHBPCENR |= RCC_DMA1EN;
+	RCC->CFGR0 = (RCC->CFGR0 & ~RCC_ADCPRE) | ((div / 2 - 1) << 14);
+	adc_clock = pclk2 / div;
+
+	ADC1->CTLR1 = 0;
+	ADC1->CTLR2 = ADC_ADON | ADC_TSVREFE;
+	ADC1->CTLR2 |= ADC_RSTCAL;
+	while (ADC1->CTLR2 & ADC_RSTCAL) {
+	}
+	ADC1->CTLR2 |= ADC_CAL;
+	while (ADC1->CTLR2 & ADC_CAL) {
+	}
+}
+
+static void adc_sample_time(uint8_t channel, uint32_t code) {
+	if (channel < 10) {
+		ADC1->SAMPTR2 = (ADC1->SAMPTR2 & ~(7 << (3 * channel))) | (code << (3 * channel));
+	}
+	else {
+		ADC1->SAMPTR1 = (ADC1->SAMPTR1 & ~(7 << (3 * (channel - 10)))) | (code << (3 * (channel - 10)));
+	}
+}
+
+static uint16_t adc_convert(uint8_t channel) {
+	adc_sample_time(channel, 7); // the longest, for the best single reading
+	ADC1->RSQR1 = 0; // one conversion
+	ADC1->RSQR3 = channel;
+	ADC1->CTLR2 = ADC_ADON | ADC_TSVREFE | ADC_EXTSEL | ADC_EXTTRIG; // SWSTART trigger
+	ADC1->CTLR2 |= ADC_SWSTART;
+	while (!(ADC1->STATR & ADC_EOC)) {
+	}
+	return ADC1->RDATAR;
+}
+
+static void adc_dma_start(machine_adc_obj_t *self, uint16_t *buf, size_t len, mp_int_t rate, bool irq) {
+	// the longest sample time that still fits between two triggers
+	if (rate <= 0) {
+		mp_raise_ValueError(MP_ERROR_TEXT("rate out of range"));
+	}
+	int code = 7;
+	while (code >= 0 && (uint64_t)(adc_sample_x2[code] + 25) * rate > 2ULL * adc_clock) {
+		code--;
+	}
+	uint32_t period = machine_timer_clock(TIM3) / rate;
+	if (code < 0 || period == 0) {
+		mp_raise_ValueError(MP_ERROR_TEXT("rate out of range"));
+	}
+	adc_sample_time(self->channel, code);
+	ADC1->RSQR1 = 0;
+	ADC1->RSQR3 = self->channel;
+
+	DMA_Channel_TypeDef *dma = DMA1_Channel1;
+	dma->CFGR = 0;
+	DMA1->INTFCR = DMA_CGIF1;
+	dma->PADDR = (uint32_t)&ADC1->RDATAR;
+	dma->MADDR = (uint32_t)buf;
+	dma->CNTR = len;
+	dma->CFGR = DMA_CFGR1_PL | DMA_CFGR1_MINC | DMA_CFGR1_PSIZE_0 | DMA_CFGR1_MSIZE_0 |
+		(irq ? DMA_CFGR1_CIRC | DMA_CFGR1_HTIE | DMA_CFGR1_TCIE : 0) | DMA_CFGR1_EN;
+	if (irq) {
+		NVIC_EnableIRQ(DMA1_Channel1_IRQn);
+	}
+	ADC1->CTLR2 = ADC_ADON | ADC_TSVREFE | ADC_DMA | ADC_EXTSEL_2 | ADC_EXTTRIG; // TIM3 TRGO
+
+	// TIM3 update as TRGO, at rate
+	uint32_t psc = (period - 1) / 65536;
+	TIM3->CTLR1 = 0;
+	TIM3->PSC = psc;
+	TIM3->ATRLR = period / (psc + 1) - 1;
+	TIM3->CTLR2 = TIM_MMS_1;
+	TIM3->SWEVGR = TIM_UG;
+	TIM3->CTLR1 = TIM_CEN;
+}
+
+static bool adc_dma_done(void) {
+	return DMA1_Channel1->CNTR == 0;
+}
+
+static void adc_dma_stop(void) {
+	TIM3->CTLR1 = 0;
+	ADC1->CTLR2 = ADC_ADON | ADC_TSVREFE;
+	DMA1_Channel1->CFGR = 0;
+	DMA1->INTFCR = DMA_CGIF1;
+	NVIC_DisableIRQ(DMA1_Channel1_IRQn);
+}
+
+// Called from the DMA ISR
+void DMA1_Channel1_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void DMA1_Channel1_IRQHandler(void) {
+	uint32_t flags = DMA1->INTFR;
+	DMA1->INTFCR = DMA_CGIF1;
+	mp_obj_t obj = MP_STATE_PORT(machine_adc_obj);
+	if (obj == MP_OBJ_NULL) {
+		return;
+	}
+	machine_adc_obj_t *self = MP_OBJ_TO_PTR(obj);
+	if (flags & DMA_HTIF1) {
+		adc_half_done(self, 0);
+	}
+	if (flags & DMA_TCIF1) {
+		adc_half_done(self, 1);
+	}
+}
+#endif
+
+static bool adc_ready;
+
+// A writable array('H'), the element count
+static size_t adc_get_buffer(mp_obj_t buf_in, uint16_t **buf) {
+	mp_buffer_info_t info;
+	mp_get_buffer_raise(buf_in, &info, MP_BUFFER_WRITE);
+	if (info.typecode != 'H') {
+		mp_raise_ValueError(MP_ERROR_TEXT("need an array('H')"));
+	}
+	*buf = info.buf;
+	return info.len / 2;
+}
+
+// ==========================================================================
+// Python Methods
+// ==========================================================================
+
+// Constructor: machine.ADC(pin or channel)
+static mp_obj_t machine_adc_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args) {
+	mp_arg_check_num(n_args, n_kw, 1, 1, false);
+
+	int channel;
+	if (mp_obj_is_int(args[0])) {
+		channel = mp_obj_get_int(args[0]);
+		if (channel < 0 || channel >= ADC_CHANNELS) {
+			mp_raise_ValueError(MP_ERROR_TEXT("invalid channel"));
+		}
+	}
+	else {
+		const machine_pin_obj_t *pin = machine_pin_find(args[0]);
+		channel = adc_pin_channel(pin->pin_id);
+		if (channel < 0) {
+			mp_raise_ValueError(MP_ERROR_TEXT("no ADC on this pin"));
+		}
+#ifdef CH5xx
+		funPinMode(pin->pin_id, GPIO_CFGLR_IN_FLOAT);
+#else
+		funPinMode(pin->pin_id, GPIO_CFGLR_IN_ANALOG);
+#endif
+	}
+
+	if (!adc_ready) {
+		adc_init();
+		adc_ready = true;
+	}
+
+	machine_adc_obj_t *self = mp_obj_malloc(machine_adc_obj_t, type);
+	self->channel = channel;
+	self->buf_obj = mp_const_none;
+	self->callback = mp_const_none;
+	return MP_OBJ_FROM_PTR(self);
+}
+
+// method: ADC.read_u16() -> 0 to 65535
+static mp_obj_t machine_adc_read_u16(mp_obj_t self_in) {
+	machine_adc_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	if (adc_busy()) {
+		mp_raise_OSError(MP_EBUSY);
+	}
+	uint16_t raw = adc_convert(self->channel);
+	return MP_OBJ_NEW_SMALL_INT((raw << 4) | (raw >> 8)); // 12 bits scaled up to 16
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(machine_adc_read_u16_obj, machine_adc_read_u16);
+
+// method: ADC.read_timed(buf, rate_hz)
+// Fills buf, an array('H'), with raw 12 bit samples taken rate_hz apart
+static mp_obj_t machine_adc_read_timed(mp_obj_t self_in, mp_obj_t buf_in, mp_obj_t rate_in) {
+	machine_adc_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	if (adc_busy()) {
+		mp_raise_OSError(MP_EBUSY);
+	}
+	uint16_t *buf;
+	size_t len = adc_get_buffer(buf_in, &buf);
+	if (len == 0) {
+		return mp_const_none;
+	}
+#ifdef CH5xx
+	if (len > 0x7FFF) {
+		mp_raise_ValueError(MP_ERROR_TEXT("buffer too long"));
+	}
+#else
+	if (len > 0xFFFF) {
+		mp_raise_ValueError(MP_ERROR_TEXT("buffer too long"));
+	}
+#endif
+
+	adc_dma_start(self, buf, len, mp_obj_get_int(rate_in), false);
+	// a long capture keeps USB alive, an exception stops the DMA first
+	nlr_buf_t nlr;
+	if (nlr_push(&nlr) == 0) {
+		while (!adc_dma_done()) {
+			mp_hal_background_processing();
+		}
+		nlr_pop();
+	}
+	else {
+		adc_dma_stop();
+		nlr_jump(nlr.ret_val);
+	}
+	adc_dma_stop();
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_3(machine_adc_read_timed_obj, machine_adc_read_timed);
+
+// method: ADC.start(buf, rate_hz, callback)
+// Samples into buf, an array('H'), for good. callback(half) is scheduled
+// every time half 0 (the first len(buf) // 2 samples) or half 1 is full,
+// while the hardware keeps filling the other one. CH5xx: rate_hz up to
+// Fsys / 256, see the DMA note at the top.
+static mp_obj_t machine_adc_start(size_t n_args, const mp_obj_t *args) {
+	machine_adc_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+	if (adc_busy()) {
+		mp_raise_OSError(MP_EBUSY);
+	}
+	uint16_t *buf;
+	size_t len = adc_get_buffer(args[1], &buf);
+	if (len < 2 || (len & 1)) {
+		mp_raise_ValueError(MP_ERROR_TEXT("buffer needs an even length"));
+	}
+#ifdef CH5xx
+	if (len / 2 > 0x7FFF) {
+		mp_raise_ValueError(MP_ERROR_TEXT("buffer too long"));
+	}
+#else
+	if (len > 0xFFFF) {
+		mp_raise_ValueError(MP_ERROR_TEXT("buffer too long"));
+	}
+#endif
+	mp_obj_t callback = args[3];
+	if (callback != mp_const_none && !mp_obj_is_callable(callback)) {
+		mp_raise_TypeError(MP_ERROR_TEXT("callback must be callable"));
+	}
+
+	self->buf_obj = args[1];
+	self->buf = buf;
+	self->len = len;
+	self->callback = callback;
+	self->pending = 0;
+	self->halves = 0;
+	self->overruns = 0;
+	MP_STATE_PORT(machine_adc_obj) = MP_OBJ_FROM_PTR(self);
+#ifdef CH5xx
+	adc_dma_start(self, buf, len / 2, mp_obj_get_int(args[2]), true);
+#else
+	adc_dma_start(self, buf, len, mp_obj_get_int(args[2]), true);
+#endif
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_adc_start_obj, 4, 4, machine_adc_start);
+
+// method: ADC.stop()
+static mp_obj_t machine_adc_stop(mp_obj_t self_in) {
+	machine_adc_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	if (MP_STATE_PORT(machine_adc_obj) == self_in) {
+		adc_dma_stop();
+		MP_STATE_PORT(machine_adc_obj) = MP_OBJ_NULL;
+	}
+	self->buf_obj = mp_const_none;
+	self->callback = mp_const_none;
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(machine_adc_stop_obj, machine_adc_stop);
+
+// method: ADC.stats() -> (halves filled, overruns), an overrun is a half
+// refilled before its callback ran
+static mp_obj_t machine_adc_stats(mp_obj_t self_in) {
+	machine_adc_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	mp_obj_t items[2] = {
+		mp_obj_new_int_from_uint(self->halves),
+		mp_obj_new_int_from_uint(self->overruns),
+	};
+	return mp_obj_new_tuple(2, items);
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(machine_adc_stats_obj, machine_adc_stats);
+
+static const mp_rom_map_elem_t machine_adc_locals_dict_table[] = {
+	{ MP_ROM_QSTR(MP_QSTR_read_u16),   MP_ROM_PTR(&machine_adc_read_u16_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_read_timed), MP_ROM_PTR(&machine_adc_read_timed_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_start),      MP_ROM_PTR(&machine_adc_start_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_stop),       MP_ROM_PTR(&machine_adc_stop_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_stats),      MP_ROM_PTR(&machine_adc_stats_obj) },
+};
+static MP_DEFINE_CONST_DICT(machine_adc_locals_dict, machine_adc_locals_dict_table);
+
+MP_DEFINE_CONST_OBJ_TYPE(
+	machine_adc_type,
+	MP_QSTR_ADC,
+	MP_TYPE_FLAG_NONE,
+	make_new, machine_adc_make_new,
+	locals_dict, &machine_adc_locals_dict
+);
+
+#endif // MACHINE_HAS_ADC
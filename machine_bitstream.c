@@ -0,0 +1,66 @@
+#include "py/runtime.h"
+#include "modmachine.h"
+
+// ==========================================================================
+// machine.bitstream
+// ==========================================================================
+// Bits are timed against SysTick from a loop in RAM. Interrupts are masked
+// for the high part of each bit only, an interrupt in the low part makes
+// that one bit longer, which WS2812 style receivers put up with.
+#define BITSTREAM_ENCODING_HIGH_LOW 0
+
+// Cycles from reading SysTick to the pin store, in SysTick ticks
+#define BITSTREAM_OVERHEAD ((uint32_t)(8ULL * DELAY_US_TIME * 1000000 / FUNCONF_SYSTEM_CORE_CLOCK))
+
+static inline uint32_t bitstream_ns_to_ticks(mp_int_t ns) {
+	uint32_t ticks = (uint64_t)ns * DELAY_US_TIME / 1000;
+	return (ticks > BITSTREAM_OVERHEAD) ? ticks - BITSTREAM_OVERHEAD : 0;
+}
+
+// ticks: high and low time of a 0 bit, then of a 1 bit
+static CH32FUN_RAMFUNC void bitstream_high_low(const machine_pin_obj_t *pin, const uint32_t *ticks, const uint8_t *buf, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		uint8_t b = buf[i];
+		for (int bit = 0; bit < 8; bit++, b <<= 1) {
+			const uint32_t *t = (b & 0x80) ? &ticks[2] : &ticks[0];
+			uint32_t mstatus = __get_MSTATUS();
+			__disable_irq();
+			uint32_t start = funSysTick32();
+			machine_pin_high(pin);
+			while (funSysTick32() - start < t[0]) {
+			}
+			machine_pin_low(pin);
+			__set_MSTATUS(mstatus);
+			while (funSysTick32() - start < t[0] + t[1]) {
+			}
+		}
+	}
+}
+
+// Usage: machine.bitstream(pin, encoding, timing, buf)
+// encoding 0: timing is (high0_ns, low0_ns, high1_ns, low1_ns), MSB first
+static mp_obj_t machine_bitstream(size_t n_args, const mp_obj_t *args) {
+	const machine_pin_obj_t *pin = machine_pin_find(args[0]);
+	if (mp_obj_get_int(args[1]) != BITSTREAM_ENCODING_HIGH_LOW) {
+		mp_raise_ValueError(MP_ERROR_TEXT("encoding"));
+	}
+
+	size_t n;
+	mp_obj_t *timing;
+	mp_obj_get_array(args[2], &n, &timing);
+	if (n != 4) {
+		mp_raise_ValueError(MP_ERROR_TEXT("timing needs 4 values"));
+	}
+	uint32_t ticks[4];
+	for (int i = 0; i < 4; i++) {
+		ticks[i] = bitstream_ns_to_ticks(mp_obj_get_int(timing[i]));
+	}
+
+	mp_buffer_info_t buf;
+	mp_get_buffer_raise(args[3], &buf, MP_BUFFER_READ);
+
+	funPinMode(pin->pin_id, GPIO_CFGLR_OUT_50Mhz_PP);
+	bitstream_high_low(pin, ticks, buf.buf, buf.len);
+	return mp_const_none;
+}
+MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_bitstream_obj, 4, 4, machine_bitstream);
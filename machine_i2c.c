@@ -0,0 +1,684 @@
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "modmachine.h"
+
+// ==========================================================================
+// machine.I2C
+// ==========================================================================
+// Controller mode on the hardware I2C. A transfer is a list of segments
+// that the event interrupt walks on its own: address, data, repeated start
+// into the next segment, stop after the last. Python only starts it and
+// waits, so a register pointer write plus the read behind it, or a whole
+// list of them (I2C.transaction), never goes back to the VM in between.
+// Clock stretching is handled by the peripheral, a device that holds SCL
+// for longer than timeout gets the bus reset.
+#define I2C_FREQ_DEFAULT    400000
+#define I2C_TIMEOUT_DEFAULT 50000 // us without a byte going through
+#define I2C_SLOTS           2     // root pointers, at least I2C_COUNT
+#define I2C_WRITE           1
+
+#ifdef CH5xx
+// Same layout as the CH32 I2C_TypeDef, starting at R16_I2C_CTRL1
+typedef struct {
+	vu16 CTLR1;
+	uint16_t RESERVED0;
+	vu16 CTLR2;
+	uint16_t RESERVED1;
+	vu16 OADDR1;
+	uint16_t RESERVED2;
+	vu16 OADDR2;
+	uint16_t RESERVED3;
+	vu16 DATAR;
+	uint16_t RESERVED4;
+	vu16 STAR1;
+	uint16_t RESERVED5;
+	vu16 STAR2;
+	uint16_t RESERVED6;
+	vu16 CKCFGR;
+	uint16_t RESERVED7;
+	vu16 RTR;
+} i2c_regs_t;
+
+#define I2C_BIT_PE      RB_I2C_PE
+#define I2C_BIT_START   RB_I2C_START
+#define I2C_BIT_STOP    RB_I2C_STOP
+#define I2C_BIT_ACK     RB_I2C_ACK
+#define I2C_BIT_SWRST   RB_I2C_SWRST
+#define I2C_BIT_ITERREN RB_I2C_ITERREN
+#define I2C_BIT_ITEVTEN RB_I2C_ITEVTEN
+#define I2C_BIT_ITBUFEN RB_I2C_ITBUFEN
+#define I2C_BIT_SB      RB_I2C_SB
+#define I2C_BIT_ADDR    RB_I2C_ADDR
+#define I2C_BIT_BTF     RB_I2C_BTF
+#define I2C_BIT_RXNE    RB_I2C_RxNE
+#define I2C_BIT_TXE     RB_I2C_TxE
+#define I2C_BIT_BERR    RB_I2C_BERR
+#define I2C_BIT_ARLO    RB_I2C_ARLO
+#define I2C_BIT_AF      RB_I2C_AF
+#define I2C_BIT_OVR     RB_I2C_OVR
+#define I2C_BIT_BUSY    RB_I2C_BUSY
+#define I2C_BIT_FS      RB_I2C_F_S
+#else
+typedef I2C_TypeDef i2c_regs_t;
+
+#define I2C_BIT_PE      I2C_CTLR1_PE
+#define I2C_BIT_START   I2C_CTLR1_START
+#define I2C_BIT_STOP    I2C_CTLR1_STOP
+#define I2C_BIT_ACK     I2C_CTLR1_ACK
+#define I2C_BIT_SWRST   I2C_CTLR1_SWRST
+#define I2C_BIT_ITERREN I2C_CTLR2_ITERREN
+#define I2C_BIT_ITEVTEN I2C_CTLR2_ITEVTEN
+#define I2C_BIT_ITBUFEN I2C_CTLR2_ITBUFEN
+#define I2C_BIT_SB      I2C_STAR1_SB
+#define I2C_BIT_ADDR    I2C_STAR1_ADDR
+#define I2C_BIT_BTF     I2C_STAR1_BTF
+#define I2C_BIT_RXNE    I2C_STAR1_RXNE
+#define I2C_BIT_TXE     I2C_STAR1_TXE
+#define I2C_BIT_BERR    I2C_STAR1_BERR
+#define I2C_BIT_ARLO    I2C_STAR1_ARLO
+#define I2C_BIT_AF      I2C_STAR1_AF
+#define I2C_BIT_OVR     I2C_STAR1_OVR
+#define I2C_BIT_BUSY    I2C_STAR2_BUSY
+#define I2C_BIT_FS      I2C_CKCFGR_FS
+#endif
+#define I2C_ERRORS (I2C_BIT_BERR | I2C_BIT_ARLO | I2C_BIT_AF | I2C_BIT_OVR)
+
+typedef struct {
+	uint8_t id;
+	i2c_regs_t *regs;
+	int ev_irqn;
+	int er_irqn; // the same as ev_irqn on CH5xx
+	uint32_t scl_pin;
+	uint32_t sda_pin;
+} i2c_hw_t;
+
+static const i2c_hw_t i2c_hw[] = {
+#ifdef CH5xx
+#ifdef R16_I2C_CTRL1
+	{ 0, (i2c_regs_t *)&R16_I2C_CTRL1, I2C_IRQn, I2C_IRQn, PB13, PB12 },
+#endif
+#else
+	{ 1, I2C1, I2C1_EV_IRQn, I2C1_ER_IRQn, PB6, PB7 },
+	{ 2, I2C2, I2C2_EV_IRQn, I2C2_ER_IRQn, PB10, PB11 },
+#endif
+};
+#define I2C_COUNT MP_ARRAY_SIZE(i2c_hw)
+
+// One piece of a transfer. A segment without I2C_SEG_CONT starts with a
+// (repeated) start and the address, with it the bytes carry on the write
+// of the segment before, as the data after a memory address does.
+#define I2C_SEG_READ 0x01
+#define I2C_SEG_CONT 0x02
+#define I2C_SEG_STOP 0x04
+
+typedef struct {
+	uint8_t *buf;
+	uint16_t len;
+	uint8_t addr;
+	uint8_t flags;
+	uint8_t mem[4]; // memory address bytes, buf points here for those
+} i2c_seg_t;
+
+enum { I2C_PHASE_START, I2C_PHASE_ADDR, I2C_PHASE_DATA };
+
+typedef struct _machine_i2c_obj_t {
+	mp_obj_base_t base;
+	const i2c_hw_t *hw;
+	uint32_t freq;
+	uint32_t timeout;
+	i2c_seg_t *segs;
+	size_t nseg;
+	volatile size_t seg;
+	volatile size_t pos;
+	volatile uint8_t phase;
+	volatile bool busy;
+	volatile int err;
+	bool held; // the last transfer ended without a stop, we still own the bus
+	i2c_seg_t seg_buf[2];
+} machine_i2c_obj_t;
+
+MP_REGISTER_ROOT_POINTER(mp_obj_t machine_i2c_obj[I2C_SLOTS]);
+
+// Called from the I2C ISR
+static void i2c_finish(machine_i2c_obj_t *self, int err) {
+	self->hw->regs->CTLR2 &= ~(I2C_BIT_ITEVTEN | I2C_BIT_ITBUFEN | I2C_BIT_ITERREN);
+	self->err = err;
+	self->busy = false;
+}
+
+// Called from the I2C ISR. Requests what follows the current segment,
+// for reads this happens one byte ahead, with the NACK.
+static void i2c_seg_end(machine_i2c_obj_t *self) {
+	i2c_regs_t *regs = self->hw->regs;
+	if (self->seg + 1 < self->nseg) {
+		regs->CTLR1 |= I2C_BIT_START;
+	}
+	else if (self->segs[self->seg].flags & I2C_SEG_STOP) {
+		regs->CTLR1 |= I2C_BIT_STOP;
+	}
+}
+
+// Called from the I2C ISR
+static void i2c_seg_next(machine_i2c_obj_t *self) {
+	self->hw->regs->CTLR2 &= ~I2C_BIT_ITBUFEN;
+	self->phase = I2C_PHASE_START;
+	self->pos = 0;
+	if (++self->seg == self->nseg) {
+		i2c_finish(self, 0);
+	}
+}
+
+// Called from the I2C ISR. The next byte to write, moving into the
+// segments that continue this write, NULL once there is none.
+static const uint8_t *i2c_tx_next(machine_i2c_obj_t *self) {
+	while (self->pos == self->segs[self->seg].len && self->seg + 1 < self->nseg &&
+		(self->segs[self->seg + 1].flags & I2C_SEG_CONT)) {
+		self->seg++;
+		self->pos = 0;
+	}
+	i2c_seg_t *seg = &self->segs[self->seg];
+	return (self->pos < seg->len) ? &seg->buf[self->pos] : NULL;
+}
+
+// Called from the I2C ISR
+static void i2c_irq(int index) {
+	mp_obj_t obj = MP_STATE_PORT(machine_i2c_obj[index]);
+	if (obj == MP_OBJ_NULL) {
+		return;
+	}
+	machine_i2c_obj_t *self = MP_OBJ_TO_PTR(obj);
+	i2c_regs_t *regs = self->hw->regs;
+	uint16_t star1 = regs->STAR1;
+	if (!self->busy) {
+		regs->CTLR2 &= ~(I2C_BIT_ITEVTEN | I2C_BIT_ITBUFEN | I2C_BIT_ITERREN);
+		return;
+	}
+	i2c_seg_t *seg = &self->segs[self->seg];
+
+	if (star1 & I2C_ERRORS) {
+		regs->STAR1 = ~(star1 & I2C_ERRORS);
+		if (star1 & I2C_BIT_ARLO) {
+			i2c_finish(self, MP_EIO); // the peripheral dropped out of controller mode itself
+			return;
+		}
+		regs->CTLR1 |= I2C_BIT_STOP;
+		i2c_finish(self, ((star1 & I2C_BIT_AF) && self->phase == I2C_PHASE_ADDR) ? MP_ENODEV : MP_EIO);
+		return;
+	}
+
+	if (star1 & I2C_BIT_SB) {
+		bool read = seg->flags & I2C_SEG_READ;
+		if (read && seg->len > 1) {
+			regs->CTLR1 |= I2C_BIT_ACK;
+		}
+		else {
+			regs->CTLR1 &= ~I2C_BIT_ACK;
+		}
+		regs->DATAR = (seg->addr << 1) | read;
+		self->phase = I2C_PHASE_ADDR;
+		return;
+	}
+
+	if (star1 & I2C_BIT_ADDR) {
+		(void)regs->STAR2; // STAR1 then STAR2 clears ADDR
+		self->phase = I2C_PHASE_DATA;
+		if (seg->flags & I2C_SEG_READ) {
+			if (seg->len == 1) {
+				i2c_seg_end(self); // ACK is off already, the only byte gets the NACK
+			}
+		}
+		else if (i2c_tx_next(self) == NULL) {
+			i2c_seg_end(self); // nothing to write, a probe from scan()
+			i2c_seg_next(self);
+			return;
+		}
+		regs->CTLR2 |= I2C_BIT_ITBUFEN;
+		return;
+	}
+
+	if (self->phase != I2C_PHASE_DATA) {
+		return; // BTF of the segment before, until the repeated start is out
+	}
+
+	if (seg->flags & I2C_SEG_READ) {
+		if (star1 & I2C_BIT_RXNE) {
+			seg->buf[self->pos++] = regs->DATAR;
+			size_t left = seg->len - self->pos;
+			if (left == 1) {
+				regs->CTLR1 &= ~I2C_BIT_ACK;
+				i2c_seg_end(self);
+			}
+			else if (left == 0) {
+				i2c_seg_next(self);
+			}
+		}
+	}
+	else if (star1 & I2C_BIT_TXE) {
+		const uint8_t *next = i2c_tx_next(self);
+		if (next) {
+			regs->DATAR = *next;
+			self->pos++;
+		}
+		else if (star1 & I2C_BIT_BTF) {
+			i2c_seg_end(self);
+			i2c_seg_next(self);
+		}
+		else {
+			regs->CTLR2 &= ~I2C_BIT_ITBUFEN; // the last byte is on its way, BTF follows
+		}
+	}
+}
+
+#ifdef CH5xx
+#ifdef R16_I2C_CTRL1
+void I2C_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void I2C_IRQHandler(void) { i2c_irq(0); }
+#endif
+#else
+void I2C1_EV_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void I2C1_ER_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void I2C2_EV_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void I2C2_ER_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void I2C1_EV_IRQHandler(void) { i2c_irq(0); }
+void I2C1_ER_IRQHandler(void) { i2c_irq(0); }
+void I2C2_EV_IRQHandler(void) { i2c_irq(1); }
+void I2C2_ER_IRQHandler(void) { i2c_irq(1); }
+#endif
+
+// A device stuck in the middle of a read holds SDA low, clock it out
+static void i2c_bus_recover(const i2c_hw_t *hw) {
+	funPinMode(hw->sda_pin, GPIO_CFGLR_IN_PUPD);
+	funDigitalWrite(hw->sda_pin, FUN_HIGH);
+	funPinMode(hw->scl_pin, GPIO_CFGLR_IN_PUPD);
+	funDigitalWrite(hw->scl_pin, FUN_HIGH);
+	Delay_Us(5);
+	for (int i = 0; i < 9 && !funDigitalRead(hw->sda_pin); i++) {
+		funPinMode(hw->scl_pin, GPIO_CFGLR_OUT_10Mhz_PP);
+		funDigitalWrite(hw->scl_pin, FUN_LOW);
+		Delay_Us(5);
+		funPinMode(hw->scl_pin, GPIO_CFGLR_IN_PUPD);
+		funDigitalWrite(hw->scl_pin, FUN_HIGH);
+		Delay_Us(5);
+	}
+}
+
+static void i2c_init(machine_i2c_obj_t *self) {
+	const i2c_hw_t *hw = self->hw;
+	i2c_regs_t *regs = hw->regs;
+
+	NVIC_DisableIRQ(hw->ev_irqn);
+	NVIC_DisableIRQ(hw->er_irqn);
+	i2c_bus_recover(hw);
+
+#ifdef CH5xx
+	// the peripheral drives the pins open drain, the pull-ups stay on
+#else
+	RCC->APB1PCENR |= (regs == I2C1) ? RCC_I2C1EN : RCC_I2C2EN;
+	funPinMode(hw->scl_pin, GPIO_CFGLR_OUT_10Mhz_AF_OD);
+	funPinMode(hw->sda_pin, GPIO_CFGLR_OUT_10Mhz_AF_OD);
+#endif
+
+#ifdef CH5xx
+	uint32_t pclk = FUNCONF_SYSTEM_CORE_CLOCK;
+#else
+	uint32_t pclk = machine_pclk1(); // both I2Cs are on APB1
+#endif
+	uint32_t mhz = pclk / 1000000;
+	uint32_t ccr;
+	regs->CTLR1 = I2C_BIT_SWRST;
+	regs->CTLR1 = 0;
+	regs->CTLR2 = (mhz > 63) ? 63 : mhz;
+	if (self->freq <= 100000) {
+		ccr = pclk / (2 * self->freq);
+		regs->CKCFGR = (ccr < 4) ? 4 : (ccr > 0xFFF) ? 0xFFF : ccr;
+		regs->RTR = mhz + 1; // 1000 ns rise time
+	}
+	else {
+		ccr = pclk / (3 * self->freq);
+		regs->CKCFGR = I2C_BIT_FS | ((ccr < 1) ? 1 : (ccr > 0xFFF) ? 0xFFF : ccr);
+		regs->RTR = mhz * 300 / 1000 + 1; // 300 ns rise time
+	}
+	regs->CTLR1 = I2C_BIT_PE;
+	self->held = false;
+	self->busy = false;
+
+	NVIC_EnableIRQ(hw->ev_irqn);
+	NVIC_EnableIRQ(hw->er_irqn);
+}
+
+// Runs segs from the interrupt and waits for them, 0 or an errno
+static int i2c_xfer(machine_i2c_obj_t *self, i2c_seg_t *segs, size_t nseg) {
+	i2c_regs_t *regs = self->hw->regs;
+	uint32_t timeout = self->timeout * DELAY_US_TIME;
+	uint32_t start = funSysTick32();
+
+	// another controller, or a device still finishing something
+	while (!self->held && (regs->STAR2 & I2C_BIT_BUSY)) {
+		if (funSysTick32() - start >= timeout) {
+			i2c_init(self);
+			return MP_ETIMEDOUT;
+		}
+	}
+
+	self->segs = segs;
+	self->nseg = nseg;
+	self->seg = 0;
+	self->pos = 0;
+	self->phase = I2C_PHASE_START;
+	self->err = 0;
+	self->busy = true;
+	regs->CTLR2 |= I2C_BIT_ITEVTEN | I2C_BIT_ITERREN;
+	regs->CTLR1 |= I2C_BIT_START;
+
+	// no background processing here, a KeyboardInterrupt would leave the
+	// interrupt running on buffers that are gone. The deadline restarts with
+	// every byte, long transfers only time out once the bus stops moving
+	size_t seg = 0;
+	size_t pos = 0;
+	start = funSysTick32();
+	while (self->busy) {
+		if (self->seg != seg || self->pos != pos) {
+			seg = self->seg;
+			pos = self->pos;
+			start = funSysTick32();
+		}
+		else if (funSysTick32() - start >= timeout) {
+			regs->CTLR2 &= ~(I2C_BIT_ITEVTEN | I2C_BIT_ITBUFEN | I2C_BIT_ITERREN);
+			self->busy = false;
+			self->segs = self->seg_buf;
+			i2c_init(self); // also lets go of a device stretching SCL for good
+			return MP_ETIMEDOUT;
+		}
+	}
+	self->segs = self->seg_buf;
+
+	if (self->err) {
+		if (self->err != MP_ENODEV) {
+			i2c_init(self);
+		}
+		self->held = false;
+		return self->err;
+	}
+	self->held = !(segs[nseg - 1].flags & I2C_SEG_STOP);
+	return 0;
+}
+
+static void i2c_run(machine_i2c_obj_t *self, i2c_seg_t *segs, size_t nseg) {
+	int err = i2c_xfer(self, segs, nseg);
+	if (err) {
+		mp_raise_OSError(err);
+	}
+}
+
+static void i2c_seg_data(i2c_seg_t *seg, uint8_t addr, uint8_t flags, uint8_t *buf, size_t len) {
+	if (len > 0xFFFF) {
+		mp_raise_ValueError(MP_ERROR_TEXT("buffer too long"));
+	}
+	if ((flags & I2C_SEG_READ) && len == 0) {
+		mp_raise_ValueError(MP_ERROR_TEXT("nothing to read"));
+	}
+	seg->addr = addr;
+	seg->flags = flags;
+	seg->buf = buf;
+	seg->len = len;
+}
+
+static void i2c_seg_mem(i2c_seg_t *seg, uint8_t addr, uint32_t memaddr, mp_int_t addrsize) {
+	if (addrsize != 8 && addrsize != 16 && addrsize != 24 && addrsize != 32) {
+		mp_raise_ValueError(MP_ERROR_TEXT("addrsize"));
+	}
+	size_t n = addrsize / 8;
+	for (size_t i = 0; i < n; i++) {
+		seg->mem[i] = memaddr >> (8 * (n - 1 - i)); // big endian
+	}
+	i2c_seg_data(seg, addr, 0, seg->mem, n);
+}
+
+// ==========================================================================
+// Python Methods
+// ==========================================================================
+
+// Constructor: machine.I2C(id, *, freq=400000, timeout=50000)
+static mp_obj_t machine_i2c_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+	enum { ARG_id, ARG_freq, ARG_timeout };
+	static const mp_arg_t allowed_args[] = {
+		{ MP_QSTR_id,      MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+		{ MP_QSTR_freq,    MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = I2C_FREQ_DEFAULT} },
+		{ MP_QSTR_timeout, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = I2C_TIMEOUT_DEFAULT} },
+	};
+
+	mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+	mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+	int index = -1;
+	for (size_t i = 0; i < I2C_COUNT; i++) {
+		if (i2c_hw[i].id == args[ARG_id].u_int) {
+			index = i;
+		}
+	}
+	if (index < 0) {
+		mp_raise_ValueError(MP_ERROR_TEXT("invalid I2C"));
+	}
+	if (args[ARG_freq].u_int <= 0 || args[ARG_freq].u_int > 400000) {
+		mp_raise_ValueError(MP_ERROR_TEXT("freq up to 400000"));
+	}
+	if (args[ARG_timeout].u_int <= 0 || args[ARG_timeout].u_int > 0x7FFFFFFF / DELAY_US_TIME) {
+		mp_raise_ValueError(MP_ERROR_TEXT("timeout out of range"));
+	}
+
+	// one object per bus, a second constructor call re-initialises it
+	machine_i2c_obj_t *self;
+	if (MP_STATE_PORT(machine_i2c_obj[index]) != MP_OBJ_NULL) {
+		self = MP_OBJ_TO_PTR(MP_STATE_PORT(machine_i2c_obj[index]));
+	}
+	else {
+		self = mp_obj_malloc(machine_i2c_obj_t, type);
+	}
+	self->hw = &i2c_hw[index];
+	self->freq = args[ARG_freq].u_int;
+	self->timeout = args[ARG_timeout].u_int;
+	self->segs = self->seg_buf;
+	self->nseg = 0;
+
+	MP_STATE_PORT(machine_i2c_obj[index]) = MP_OBJ_FROM_PTR(self);
+	i2c_init(self);
+
+	return MP_OBJ_FROM_PTR(self);
+}
+
+// method: I2C.scan() -> list of addresses that ACK
+static mp_obj_t machine_i2c_scan(mp_obj_t self_in) {
+	machine_i2c_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	mp_obj_t list = mp_obj_new_list(0, NULL);
+	for (uint8_t addr = 0x08; addr < 0x78; addr++) {
+		i2c_seg_data(&self->seg_buf[0], addr, I2C_SEG_STOP, NULL, 0);
+		int err = i2c_xfer(self, self->seg_buf, 1);
+		if (err == 0) {
+			mp_obj_list_append(list, MP_OBJ_NEW_SMALL_INT(addr));
+		}
+		else if (err != MP_ENODEV) {
+			mp_raise_OSError(err);
+		}
+	}
+	return list;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(machine_i2c_scan_obj, machine_i2c_scan);
+
+// method: I2C.readfrom_into(addr, buf, stop=True)
+static mp_obj_t machine_i2c_readfrom_into(size_t n_args, const mp_obj_t *args) {
+	machine_i2c_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+	mp_buffer_info_t buf;
+	mp_get_buffer_raise(args[2], &buf, MP_BUFFER_WRITE);
+	bool stop = (n_args > 3) ? mp_obj_is_true(args[3]) : true;
+	i2c_seg_data(&self->seg_buf[0], mp_obj_get_int(args[1]), I2C_SEG_READ | (stop ? I2C_SEG_STOP : 0), buf.buf, buf.len);
+	i2c_run(self, self->seg_buf, 1);
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_i2c_readfrom_into_obj, 3, 4, machine_i2c_readfrom_into);
+
+// method: I2C.readfrom(addr, nbytes, stop=True) -> bytes
+static mp_obj_t machine_i2c_readfrom(size_t n_args, const mp_obj_t *args) {
+	machine_i2c_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+	vstr_t vstr;
+	vstr_init_len(&vstr, mp_obj_get_int(args[2]));
+	bool stop = (n_args > 3) ? mp_obj_is_true(args[3]) : true;
+	i2c_seg_data(&self->seg_buf[0], mp_obj_get_int(args[1]), I2C_SEG_READ | (stop ? I2C_SEG_STOP : 0), (uint8_t *)vstr.buf, vstr.len);
+	i2c_run(self, self->seg_buf, 1);
+	return mp_obj_new_bytes_from_vstr(&vstr);
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_i2c_readfrom_obj, 3, 4, machine_i2c_readfrom);
+
+// method: I2C.writeto(addr, buf, stop=True) -> bytes written, a NACK raises
+static mp_obj_t machine_i2c_writeto(size_t n_args, const mp_obj_t *args) {
+	machine_i2c_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+	mp_buffer_info_t buf;
+	mp_get_buffer_raise(args[2], &buf, MP_BUFFER_READ);
+	bool stop = (n_args > 3) ? mp_obj_is_true(args[3]) : true;
+	i2c_seg_data(&self->seg_buf[0], mp_obj_get_int(args[1]), stop ? I2C_SEG_STOP : 0, buf.buf, buf.len);
+	i2c_run(self, self->seg_buf, 1);
+	return MP_OBJ_NEW_SMALL_INT(buf.len);
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_i2c_writeto_obj, 3, 4, machine_i2c_writeto);
+
+enum { MEM_ARG_addr, MEM_ARG_memaddr, MEM_ARG_buf, MEM_ARG_addrsize };
+static const mp_arg_t machine_i2c_mem_allowed_args[] = {
+	{ MP_QSTR_addr,     MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+	{ MP_QSTR_memaddr,  MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+	{ MP_QSTR_arg,      MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+	{ MP_QSTR_addrsize, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 8} },
+};
+
+// Register pointer write, repeated start, then the read or the data write
+// carrying on, all from one start of the interrupt
+static void i2c_mem(machine_i2c_obj_t *self, mp_arg_val_t *args, uint8_t *buf, size_t len, bool read) {
+	uint8_t addr = args[MEM_ARG_addr].u_int;
+	i2c_seg_mem(&self->seg_buf[0], addr, args[MEM_ARG_memaddr].u_int, args[MEM_ARG_addrsize].u_int);
+	i2c_seg_data(&self->seg_buf[1], addr, (read ? I2C_SEG_READ : I2C_SEG_CONT) | I2C_SEG_STOP, buf, len);
+	i2c_run(self, self->seg_buf, 2);
+}
+
+// method: I2C.readfrom_mem_into(addr, memaddr, buf, *, addrsize=8)
+static mp_obj_t machine_i2c_readfrom_mem_into(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+	machine_i2c_obj_t *self = MP_OBJ_TO_PTR(pos_args[0]);
+	mp_arg_val_t args[MP_ARRAY_SIZE(machine_i2c_mem_allowed_args)];
+	mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args, MP_ARRAY_SIZE(machine_i2c_mem_allowed_args), machine_i2c_mem_allowed_args, args);
+	mp_buffer_info_t buf;
+	mp_get_buffer_raise(args[MEM_ARG_buf].u_obj, &buf, MP_BUFFER_WRITE);
+	i2c_mem(self, args, buf.buf, buf.len, true);
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_KW(machine_i2c_readfrom_mem_into_obj, 1, machine_i2c_readfrom_mem_into);
+
+// method: I2C.readfrom_mem(addr, memaddr, nbytes, *, addrsize=8) -> bytes
+static mp_obj_t machine_i2c_readfrom_mem(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+	machine_i2c_obj_t *self = MP_OBJ_TO_PTR(pos_args[0]);
+	mp_arg_val_t args[MP_ARRAY_SIZE(machine_i2c_mem_allowed_args)];
+	mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args, MP_ARRAY_SIZE(machine_i2c_mem_allowed_args), machine_i2c_mem_allowed_args, args);
+	vstr_t vstr;
+	vstr_init_len(&vstr, mp_obj_get_int(args[MEM_ARG_buf].u_obj));
+	i2c_mem(self, args, (uint8_t *)vstr.buf, vstr.len, true);
+	return mp_obj_new_bytes_from_vstr(&vstr);
+}
+static MP_DEFINE_CONST_FUN_OBJ_KW(machine_i2c_readfrom_mem_obj, 1, machine_i2c_readfrom_mem);
+
+// method: I2C.writeto_mem(addr, memaddr, buf, *, addrsize=8)
+static mp_obj_t machine_i2c_writeto_mem(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+	machine_i2c_obj_t *self = MP_OBJ_TO_PTR(pos_args[0]);
+	mp_arg_val_t args[MP_ARRAY_SIZE(machine_i2c_mem_allowed_args)];
+	mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args, MP_ARRAY_SIZE(machine_i2c_mem_allowed_args), machine_i2c_mem_allowed_args, args);
+	mp_buffer_info_t buf;
+	mp_get_buffer_raise(args[MEM_ARG_buf].u_obj, &buf, MP_BUFFER_READ);
+	i2c_mem(self, args, buf.buf, buf.len, false);
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_KW(machine_i2c_writeto_mem_obj, 1, machine_i2c_writeto_mem);
+
+// method: I2C.transaction(ops, *, addrsize=8)
+// ops is a list of (addr, memaddr, buf) to read into buf, or
+// (addr, memaddr, buf, I2C.WRITE) to write it, memaddr None for none.
+// The whole list runs from the interrupt, repeated starts in between and
+// one stop at the end, e.g. the accelerometer and gyro registers of an IMU
+// in a single call:
+//     i2c.transaction([(0x68, 0x3B, accel), (0x68, 0x43, gyro)])
+static mp_obj_t machine_i2c_transaction(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+	enum { ARG_ops, ARG_addrsize };
+	static const mp_arg_t allowed_args[] = {
+		{ MP_QSTR_ops,      MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+		{ MP_QSTR_addrsize, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 8} },
+	};
+	machine_i2c_obj_t *self = MP_OBJ_TO_PTR(pos_args[0]);
+	mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+	mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+	size_t n_ops;
+	mp_obj_t *ops;
+	mp_obj_get_array(args[ARG_ops].u_obj, &n_ops, &ops);
+	if (n_ops == 0) {
+		return mp_const_none;
+	}
+
+	// parse everything before the bus is touched
+	size_t max_segs = 2 * n_ops;
+	i2c_seg_t *segs = m_new(i2c_seg_t, max_segs);
+	size_t nseg = 0;
+	for (size_t i = 0; i < n_ops; i++) {
+		size_t n;
+		mp_obj_t *op;
+		mp_obj_get_array(ops[i], &n, &op);
+		if (n != 3 && n != 4) {
+			mp_raise_ValueError(MP_ERROR_TEXT("op is (addr, memaddr, buf[, I2C.WRITE])"));
+		}
+		uint8_t addr = mp_obj_get_int(op[0]);
+		bool write = (n == 4) && mp_obj_get_int(op[3]) == I2C_WRITE;
+		mp_buffer_info_t buf;
+		mp_get_buffer_raise(op[2], &buf, write ? MP_BUFFER_READ : MP_BUFFER_WRITE);
+
+		uint8_t flags = write ? 0 : I2C_SEG_READ;
+		if (op[1] != mp_const_none) {
+			i2c_seg_mem(&segs[nseg++], addr, mp_obj_get_int(op[1]), args[ARG_addrsize].u_int);
+			if (write) {
+				flags = I2C_SEG_CONT;
+			}
+		}
+		i2c_seg_data(&segs[nseg++], addr, flags, buf.buf, buf.len);
+	}
+	segs[nseg - 1].flags |= I2C_SEG_STOP;
+
+	i2c_run(self, segs, nseg);
+	m_del(i2c_seg_t, segs, max_segs);
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_KW(machine_i2c_transaction_obj, 1, machine_i2c_transaction);
+
+// method: I2C.deinit()
+static mp_obj_t machine_i2c_deinit(mp_obj_t self_in) {
+	machine_i2c_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	NVIC_DisableIRQ(self->hw->ev_irqn);
+	NVIC_DisableIRQ(self->hw->er_irqn);
+	self->hw->regs->CTLR1 = 0;
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(machine_i2c_deinit_obj, machine_i2c_deinit);
+
+static const mp_rom_map_elem_t machine_i2c_locals_dict_table[] = {
+	{ MP_ROM_QSTR(MP_QSTR_scan),              MP_ROM_PTR(&machine_i2c_scan_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_readfrom),          MP_ROM_PTR(&machine_i2c_readfrom_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_readfrom_into),     MP_ROM_PTR(&machine_i2c_readfrom_into_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_writeto),           MP_ROM_PTR(&machine_i2c_writeto_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_readfrom_mem),      MP_ROM_PTR(&machine_i2c_readfrom_mem_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_readfrom_mem_into), MP_ROM_PTR(&machine_i2c_readfrom_mem_into_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_writeto_mem),       MP_ROM_PTR(&machine_i2c_writeto_mem_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_transaction),       MP_ROM_PTR(&machine_i2c_transaction_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_deinit),            MP_ROM_PTR(&machine_i2c_deinit_obj) },
+
+	{ MP_ROM_QSTR(MP_QSTR_WRITE),             MP_ROM_INT(I2C_WRITE) },
+};
+static MP_DEFINE_CONST_DICT(machine_i2c_locals_dict, machine_i2c_locals_dict_table);
+
+MP_DEFINE_CONST_OBJ_TYPE(
+	machine_i2c_type,
+	MP_QSTR_I2C,
+	MP_TYPE_FLAG_NONE,
+	make_new, machine_i2c_make_new,
+	locals_dict, &machine_i2c_locals_dict
+);
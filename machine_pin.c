@@ -1,7 +1,338 @@
 #include "py/runtime.h"
+#include "py/mperrno.h"
+#include "py/mphal.h"
+#include "py/gc.h"
+#include "extmod/virtpin.h"
 #include "modmachine.h"
 #include "ch32fun.h"
 
+// ==========================================================================
+// Pin Objects
+// ==========================================================================
+
+// One constant object per pin, generated from the ch32fun pin defines. The
+// Pin.PXn constants point into this table (ch32fun_pindefs.h, same order),
+// a CH5xx PB pin number does not fit a small int.
+#ifdef CH5xx
+#ifdef R32_PB_DIR
+#define PIN_PORT(p) ((machine_pin_port_t *)(((p) & PB) ? &R32_PB_DIR : &R32_PA_DIR))
+#else
+#define PIN_PORT(p) ((machine_pin_port_t *)&R32_PA_DIR)
+#endif
+#define PIN_MASK(p) ((p) & ~PB)
+#else
+#define PIN_PORT(p) ((machine_pin_port_t *)(GPIOA_BASE + ((p) >> 4) * 0x400))
+#define PIN_MASK(p) (1 << ((p) & 0xf))
+#endif
+
+#define PIN_OBJ(p) { { &machine_pin_type }, p, PIN_PORT(p), PIN_MASK(p) },
+static const machine_pin_obj_t machine_pin_obj_table[] = {
+	#include "ch32fun_pinobjs.h"
+};
+
+const machine_pin_obj_t *machine_pin_find(mp_obj_t pin) {
+	if (mp_obj_is_type(pin, &machine_pin_type)) {
+		return MP_OBJ_TO_PTR(pin);
+	}
+	uint32_t pin_id = mp_obj_get_int_truncated(pin);
+	for (size_t i = 0; i < MP_ARRAY_SIZE(machine_pin_obj_table); i++) {
+		if (machine_pin_obj_table[i].pin_id == pin_id) {
+			return &machine_pin_obj_table[i];
+		}
+	}
+	mp_raise_ValueError(MP_ERROR_TEXT("invalid pin"));
+}
+
+// ==========================================================================
+// Pin Interrupts
+// ==========================================================================
+// The GPIO interrupt stamps every edge into a small queue on the irq object
+// and drops edges that come within the debounce time of the last one taken.
+// A soft handler is scheduled once per burst and reads the edges back with
+// irq.events(). Hard handlers run straight from the interrupt.
+#define PIN_IRQ_FALLING 1
+#define PIN_IRQ_RISING  2
+#define PIN_IRQ_QUEUE   8
+
+#if defined(CH5xx) && defined(R16_PB_INT_EN)
+#define PIN_IRQ_LINES   32 // PA0-15, then PB0-15
+#else
+#define PIN_IRQ_LINES   16
+#endif
+
+typedef struct {
+	uint32_t us; // mp_hal_ticks_us() at the edge
+	uint8_t value; // pin level right after it
+} pin_irq_event_t;
+
+typedef struct _machine_pin_irq_obj_t {
+	mp_obj_base_t base;
+	const machine_pin_obj_t *pin;
+	mp_obj_t handler;
+	uint32_t debounce; // SysTick ticks, 0 is off
+	uint32_t last;     // SysTick at the last edge taken
+	uint8_t trigger;
+	uint8_t line;
+	bool hard;
+	volatile bool scheduled;
+	volatile uint8_t head;
+	volatile uint8_t tail;
+	pin_irq_event_t events[PIN_IRQ_QUEUE];
+	volatile uint32_t dropped; // queue full
+	volatile uint32_t bounced; // inside the debounce time
+} machine_pin_irq_obj_t;
+
+static int pin_irq_line(const machine_pin_obj_t *pin) {
+#ifdef CH5xx
+	if (pin->mask > 0xFFFF) {
+		return -1; // no interrupt on these
+	}
+	int line = __builtin_ctz(pin->mask);
+	if (pin->pin_id & PB) {
+#if PIN_IRQ_LINES > 16
+		line += 16;
+#else
+		return -1;
+#endif
+	}
+	return line;
+#else
+	return pin->pin_id & 0xF;
+#endif
+}
+
+#ifdef CH5xx
+// CH5xx edge interrupts fire on one polarity, picked by the pin's OUT bit.
+// For both edges we aim at the opposite of the current level every time.
+static void pin_irq_next_edge(const machine_pin_obj_t *pin, uint8_t trigger) {
+	int rising = (trigger == PIN_IRQ_RISING) ||
+		(trigger == (PIN_IRQ_RISING | PIN_IRQ_FALLING) && !machine_pin_read(pin));
+	if (rising) {
+		pin->port->OUT |= pin->mask;
+	}
+	else {
+		pin->port->CLR = pin->mask;
+	}
+}
+#else
+static int pin_irq_irqn(int line) {
+	if (line < 5) {
+		return EXTI0_IRQn + line;
+	}
+	return (line < 10) ? EXTI9_5_IRQn : EXTI15_10_IRQn;
+}
+#endif
+
+// Set up the interrupt controller for irq->trigger, 0 turns it off
+static void pin_irq_enable(machine_pin_irq_obj_t *irq) {
+	const machine_pin_obj_t *pin = irq->pin;
+	uint16_t bit = 1 << (irq->line & 15);
+
+#ifdef CH5xx
+	vu16 *int_en = &R16_PA_INT_EN;
+	vu16 *int_mode = &R16_PA_INT_MODE;
+	vu16 *int_if = &R16_PA_INT_IF;
+	int irqn = GPIO_A_IRQn;
+#if PIN_IRQ_LINES > 16
+	if (irq->line >= 16) {
+		int_en = &R16_PB_INT_EN;
+		int_mode = &R16_PB_INT_MODE;
+		int_if = &R16_PB_INT_IF;
+		irqn = GPIO_B_IRQn;
+	}
+#endif
+	*int_en &= ~bit;
+	if (irq->trigger == 0) {
+		return;
+	}
+	*int_mode |= bit; // edge, not level
+	pin_irq_next_edge(pin, irq->trigger);
+	*int_if = bit;
+	*int_en |= bit;
+	NVIC_EnableIRQ(irqn);
+#else
+	EXTI->INTENR &= ~bit;
+	if (irq->trigger == 0) {
+		return;
+	}
+	RCC->APB2PCENR |= RCC_AFIOEN;
+	int shift = (irq->line & 3) * 4;
+	AFIO->EXTICR[irq->line >> 2] = (AFIO->EXTICR[irq->line >> 2] & ~(0xF << shift)) | ((pin->pin_id >> 4) << shift);
+	if (irq->trigger & PIN_IRQ_RISING) {
+		EXTI->RTENR |= bit;
+	}
+	else {
+		EXTI->RTENR &= ~bit;
+	}
+	if (irq->trigger & PIN_IRQ_FALLING) {
+		EXTI->FTENR |= bit;
+	}
+	else {
+		EXTI->FTENR &= ~bit;
+	}
+	EXTI->INTFR = bit;
+	EXTI->INTENR |= bit;
+	NVIC_EnableIRQ(pin_irq_irqn(irq->line));
+#endif
+}
+
+// Scheduled once per burst, runs the soft handler
+static mp_obj_t pin_irq_dispatch(mp_obj_t irq_in) {
+	machine_pin_irq_obj_t *irq = MP_OBJ_TO_PTR(irq_in);
+	irq->scheduled = false;
+	if (irq->handler != mp_const_none) {
+		mp_call_function_1(irq->handler, MP_OBJ_FROM_PTR(irq->pin));
+	}
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(pin_irq_dispatch_obj, pin_irq_dispatch);
+
+// Called from the GPIO ISR
+static void pin_irq_call_hard(machine_pin_irq_obj_t *irq) {
+	mp_sched_lock();
+	gc_lock();
+	nlr_buf_t nlr;
+	if (nlr_push(&nlr) == 0) {
+		mp_call_function_1(irq->handler, MP_OBJ_FROM_PTR(irq->pin));
+		nlr_pop();
+	}
+	else {
+		// a broken hard handler would fire forever, take it off
+		irq->handler = mp_const_none;
+		mp_obj_print_exception(&mp_plat_print, MP_OBJ_FROM_PTR(nlr.ret_val));
+	}
+	gc_unlock();
+	mp_sched_unlock();
+}
+
+// Called from the GPIO ISR
+static void pin_irq_edge(int line) {
+	mp_obj_t obj = MP_STATE_PORT(machine_pin_irq_obj[line]);
+	if (obj == MP_OBJ_NULL) {
+		return;
+	}
+	machine_pin_irq_obj_t *irq = MP_OBJ_TO_PTR(obj);
+	uint32_t now = funSysTick32();
+	int value = machine_pin_read(irq->pin);
+#ifdef CH5xx
+	pin_irq_next_edge(irq->pin, irq->trigger);
+#endif
+
+	if (irq->debounce && now - irq->last < irq->debounce) {
+		irq->bounced++;
+		return;
+	}
+	irq->last = now;
+
+	uint8_t next = (irq->head + 1) % PIN_IRQ_QUEUE;
+	if (next == irq->tail) {
+		irq->dropped++;
+	}
+	else {
+		irq->events[irq->head].us = mp_hal_ticks_us();
+		irq->events[irq->head].value = value;
+		irq->head = next;
+	}
+
+	if (irq->handler == mp_const_none) {
+		return;
+	}
+	if (irq->hard) {
+		pin_irq_call_hard(irq);
+	}
+	else if (!irq->scheduled) {
+		irq->scheduled = mp_sched_schedule(MP_OBJ_FROM_PTR(&pin_irq_dispatch_obj), obj);
+	}
+}
+
+// Called from the GPIO ISR
+static void pin_irq_service(uint32_t flags, int first_line) {
+	while (flags) {
+		pin_irq_edge(first_line + __builtin_ctz(flags));
+		flags &= flags - 1;
+	}
+}
+
+#ifdef CH5xx
+void GPIOA_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void GPIOA_IRQHandler(void) {
+	uint16_t flags = R16_PA_INT_IF;
+	R16_PA_INT_IF = flags;
+	pin_irq_service(flags, 0);
+}
+
+#if PIN_IRQ_LINES > 16
+void GPIOB_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void GPIOB_IRQHandler(void) {
+	uint16_t flags = R16_PB_INT_IF;
+	R16_PB_INT_IF = flags;
+	pin_irq_service(flags, 16);
+}
+#endif
+#else
+static void pin_irq_exti(uint32_t lines) {
+	uint32_t flags = EXTI->INTFR & lines;
+	EXTI->INTFR = flags;
+	pin_irq_service(flags, 0);
+}
+
+void EXTI0_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void EXTI1_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void EXTI2_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void EXTI3_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void EXTI4_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void EXTI9_5_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void EXTI15_10_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void EXTI0_IRQHandler(void) { pin_irq_exti(0x0001); }
+void EXTI1_IRQHandler(void) { pin_irq_exti(0x0002); }
+void EXTI2_IRQHandler(void) { pin_irq_exti(0x0004); }
+void EXTI3_IRQHandler(void) { pin_irq_exti(0x0008); }
+void EXTI4_IRQHandler(void) { pin_irq_exti(0x0010); }
+void EXTI9_5_IRQHandler(void) { pin_irq_exti(0x03E0); }
+void EXTI15_10_IRQHandler(void) { pin_irq_exti(0xFC00); }
+#endif
+
+// method: irq.events() -> [(ticks_us, value), ...], oldest first
+// ticks_us is masked like time.ticks_us(), so ticks_diff() works on it
+static mp_obj_t machine_pin_irq_events(mp_obj_t self_in) {
+	machine_pin_irq_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	mp_obj_t list = mp_obj_new_list(0, NULL);
+	while (self->tail != self->head) {
+		pin_irq_event_t *e = &self->events[self->tail];
+		mp_obj_t item[2] = { mp_obj_new_int_from_uint(e->us & (MICROPY_PY_TIME_TICKS_PERIOD - 1)), MP_OBJ_NEW_SMALL_INT(e->value) };
+		mp_obj_list_append(list, mp_obj_new_tuple(2, item));
+		self->tail = (self->tail + 1) % PIN_IRQ_QUEUE;
+	}
+	return list;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(machine_pin_irq_events_obj, machine_pin_irq_events);
+
+// method: irq.stats() -> (dropped, bounced)
+static mp_obj_t machine_pin_irq_stats(mp_obj_t self_in) {
+	machine_pin_irq_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	mp_obj_t items[2] = {
+		mp_obj_new_int_from_uint(self->dropped),
+		mp_obj_new_int_from_uint(self->bounced),
+	};
+	return mp_obj_new_tuple(2, items);
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(machine_pin_irq_stats_obj, machine_pin_irq_stats);
+
+static const mp_rom_map_elem_t machine_pin_irq_locals_dict_table[] = {
+	{ MP_ROM_QSTR(MP_QSTR_events), MP_ROM_PTR(&machine_pin_irq_events_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_stats),  MP_ROM_PTR(&machine_pin_irq_stats_obj) },
+};
+static MP_DEFINE_CONST_DICT(machine_pin_irq_locals_dict, machine_pin_irq_locals_dict_table);
+
+static MP_DEFINE_CONST_OBJ_TYPE(
+	machine_pin_irq_type,
+	MP_QSTR_irq,
+	MP_TYPE_FLAG_NONE,
+	locals_dict, &machine_pin_irq_locals_dict
+);
+
+MP_REGISTER_ROOT_POINTER(mp_obj_t machine_pin_irq_obj[PIN_IRQ_LINES]);
+
 // ==========================================================================
 // Pin Class Methods
 // ==========================================================================
@@ -10,10 +341,8 @@
 static mp_obj_t machine_pin_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args) {
 	mp_arg_check_num(n_args, n_kw, 1, 2, false);
 
-	// 1. Create the object
-	machine_pin_obj_t *self = m_new_obj(machine_pin_obj_t);
-	self->base.type = &machine_pin_type;
-	self->pin_id = mp_obj_get_int(args[0]);
+	// 1. Look up the object, nothing is allocated
+	const machine_pin_obj_t *self = machine_pin_find(args[0]);
 
 	// 2. Configure Mode if provided (IN=0, OUT=1)
 	if (n_args >= 2) {
@@ -30,13 +359,16 @@ static mp_obj_t machine_pin_value(size_t n_args, const mp_obj_t *args) {
 
 	if (n_args == 1) {
 		// Get Value
-		int val = funDigitalRead(self->pin_id);
-		return MP_OBJ_NEW_SMALL_INT(val);
+		return MP_OBJ_NEW_SMALL_INT(machine_pin_read(self));
 	}
 	else {
 		// Set Value
-		int val = mp_obj_get_int(args[1]);
-		funDigitalWrite(self->pin_id, val);
+		if (mp_obj_is_true(args[1])) {
+			machine_pin_high(self);
+		}
+		else {
+			machine_pin_low(self);
+		}
 		return mp_const_none;
 	}
 }
@@ -45,7 +377,7 @@ static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_pin_value_obj, 1, 2, machine_
 // method: Pin.on()
 static mp_obj_t machine_pin_on(mp_obj_t self_in) {
 	machine_pin_obj_t *self = MP_OBJ_TO_PTR(self_in);
-	funDigitalWrite(self->pin_id, FUN_HIGH);
+	machine_pin_high(self);
 	return mp_const_none;
 }
 static MP_DEFINE_CONST_FUN_OBJ_1(machine_pin_on_obj, machine_pin_on);
@@ -53,23 +385,103 @@ static MP_DEFINE_CONST_FUN_OBJ_1(machine_pin_on_obj, machine_pin_on);
 // method: Pin.off()
 static mp_obj_t machine_pin_off(mp_obj_t self_in) {
 	machine_pin_obj_t *self = MP_OBJ_TO_PTR(self_in);
-	funDigitalWrite(self->pin_id, FUN_LOW);
+	machine_pin_low(self);
 	return mp_const_none;
 }
 static MP_DEFINE_CONST_FUN_OBJ_1(machine_pin_off_obj, machine_pin_off);
 
+// method: Pin.irq(handler=None, trigger=IRQ_FALLING|IRQ_RISING, hard=False, debounce_us=0)
+static mp_obj_t machine_pin_irq(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+	enum { ARG_handler, ARG_trigger, ARG_hard, ARG_debounce_us };
+	static const mp_arg_t allowed_args[] = {
+		{ MP_QSTR_handler,     MP_ARG_OBJ, {.u_obj = mp_const_none} },
+		{ MP_QSTR_trigger,     MP_ARG_INT, {.u_int = PIN_IRQ_FALLING | PIN_IRQ_RISING} },
+		{ MP_QSTR_hard,        MP_ARG_BOOL, {.u_bool = false} },
+		{ MP_QSTR_debounce_us, MP_ARG_INT, {.u_int = 0} },
+	};
+
+	const machine_pin_obj_t *self = MP_OBJ_TO_PTR(pos_args[0]);
+	mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+	mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+	int line = pin_irq_line(self);
+	if (line < 0) {
+		mp_raise_ValueError(MP_ERROR_TEXT("no interrupt on this pin"));
+	}
+
+	// Pin.irq() hands back the current one, None when the line is free or
+	// another pin on the same line holds it
+	machine_pin_irq_obj_t *irq = MP_OBJ_TO_PTR(MP_STATE_PORT(machine_pin_irq_obj[line]));
+	if (n_args == 1 && kw_args->used == 0) {
+		return (irq != NULL && irq->pin == self) ? MP_OBJ_FROM_PTR(irq) : mp_const_none;
+	}
+
+	if (irq == NULL) {
+		irq = mp_obj_malloc(machine_pin_irq_obj_t, &machine_pin_irq_type);
+	}
+	else {
+		irq->trigger = 0;
+		pin_irq_enable(irq); // off while it changes
+	}
+
+	irq->pin = self;
+	irq->line = line;
+	irq->handler = args[ARG_handler].u_obj;
+	irq->hard = args[ARG_hard].u_bool;
+	irq->debounce = args[ARG_debounce_us].u_int * DELAY_US_TIME;
+	irq->last = funSysTick32() - irq->debounce;
+	irq->scheduled = false;
+	irq->head = irq->tail = 0;
+	irq->dropped = irq->bounced = 0;
+	MP_STATE_PORT(machine_pin_irq_obj[line]) = MP_OBJ_FROM_PTR(irq);
+
+	irq->trigger = (irq->handler == mp_const_none) ? 0 : args[ARG_trigger].u_int & (PIN_IRQ_FALLING | PIN_IRQ_RISING);
+	pin_irq_enable(irq);
+
+	return MP_OBJ_FROM_PTR(irq);
+}
+static MP_DEFINE_CONST_FUN_OBJ_KW(machine_pin_irq_obj, 1, machine_pin_irq);
+
+// Pin protocol, lets C code such as machine.Signal skip the method lookup
+static mp_uint_t machine_pin_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_t arg, int *errcode) {
+	machine_pin_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	switch (request) {
+		case MP_PIN_READ:
+			return machine_pin_read(self);
+		case MP_PIN_WRITE:
+			if (arg) {
+				machine_pin_high(self);
+			}
+			else {
+				machine_pin_low(self);
+			}
+			return 0;
+	}
+	*errcode = MP_EINVAL;
+	return -1;
+}
+
+static const mp_pin_p_t machine_pin_pin_p = {
+	.ioctl = machine_pin_ioctl,
+};
+
 // --- Pin Class Lookup Table ---
 static const mp_rom_map_elem_t machine_pin_locals_dict_table[] = {
 	{ MP_ROM_QSTR(MP_QSTR_value), MP_ROM_PTR(&machine_pin_value_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_on),    MP_ROM_PTR(&machine_pin_on_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_off),   MP_ROM_PTR(&machine_pin_off_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_irq),   MP_ROM_PTR(&machine_pin_irq_obj) },
 
 	// Constants for Mode
 	{ MP_ROM_QSTR(MP_QSTR_IN),    MP_ROM_INT(GPIO_CFGLR_IN_FLOAT) },
 	{ MP_ROM_QSTR(MP_QSTR_OUT),   MP_ROM_INT(GPIO_CFGLR_OUT_50Mhz_PP) },
 
+	// Constants for irq()
+	{ MP_ROM_QSTR(MP_QSTR_IRQ_FALLING), MP_ROM_INT(PIN_IRQ_FALLING) },
+	{ MP_ROM_QSTR(MP_QSTR_IRQ_RISING),  MP_ROM_INT(PIN_IRQ_RISING) },
+
 	// Pins (Generated macros from ch32fun)
-	#include "ch32fun_pindefs.h" 
+	#include "ch32fun_pindefs.h"
 };
 static MP_DEFINE_CONST_DICT(machine_pin_locals_dict, machine_pin_locals_dict_table);
 
@@ -79,5 +491,6 @@ MP_DEFINE_CONST_OBJ_TYPE(
 	MP_QSTR_Pin,
 	MP_TYPE_FLAG_NONE,
 	make_new, machine_pin_make_new,
+	protocol, &machine_pin_pin_p,
 	locals_dict, &machine_pin_locals_dict
 );
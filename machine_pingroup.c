@@ -0,0 +1,182 @@
+#include "py/runtime.h"
+#include "py/binary.h"
+#include "modmachine.h"
+#include <string.h>
+
+// ==========================================================================
+// PinGroup: several pins written and read as one integer
+// ==========================================================================
+// Bit i of the value is pins[i]. The masks for each port are worked out
+// once in the constructor, so write() is one register store per port and
+// all pins of a port change at the same time.
+#define PINGROUP_MAX_PORTS 4
+
+typedef struct {
+	uint8_t port;  // index into ports[]
+	uint32_t mask;
+} pingroup_pin_t;
+
+typedef struct _machine_pingroup_obj_t {
+	mp_obj_base_t base;
+	uint8_t n_ports;
+	uint8_t n_pins;
+	machine_pin_port_t *ports[PINGROUP_MAX_PORTS];
+	uint32_t port_mask[PINGROUP_MAX_PORTS]; // all group pins on that port
+	pingroup_pin_t pins[];
+} machine_pingroup_obj_t;
+
+static void pingroup_write(machine_pingroup_obj_t *self, uint32_t value) {
+	uint32_t set[PINGROUP_MAX_PORTS] = { 0 };
+	for (int i = 0; i < self->n_pins; i++) {
+		if (value & (1u << i)) {
+			set[self->pins[i].port] |= self->pins[i].mask;
+		}
+	}
+
+	for (int p = 0; p < self->n_ports; p++) {
+#ifdef CH5xx
+		// no set/reset register, OUT is written in one go with interrupts off
+		uint32_t mstatus = __get_MSTATUS();
+		__disable_irq();
+		self->ports[p]->OUT = (self->ports[p]->OUT & ~self->port_mask[p]) | set[p];
+		__set_MSTATUS(mstatus);
+#else
+		self->ports[p]->BSHR = set[p] | ((self->port_mask[p] & ~set[p]) << 16);
+#endif
+	}
+}
+
+static uint32_t pingroup_read(machine_pingroup_obj_t *self) {
+	uint32_t in[PINGROUP_MAX_PORTS];
+	for (int p = 0; p < self->n_ports; p++) {
+#ifdef CH5xx
+		in[p] = self->ports[p]->PIN;
+#else
+		in[p] = self->ports[p]->INDR;
+#endif
+	}
+
+	uint32_t value = 0;
+	for (int i = 0; i < self->n_pins; i++) {
+		if (in[self->pins[i].port] & self->pins[i].mask) {
+			value |= 1u << i;
+		}
+	}
+	return value;
+}
+
+// Constructor: g = machine.PinGroup([pins...], mode=None)
+static mp_obj_t machine_pingroup_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+	enum { ARG_pins, ARG_mode };
+	static const mp_arg_t allowed_args[] = {
+		{ MP_QSTR_pins, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+		{ MP_QSTR_mode, MP_ARG_OBJ, {.u_obj = mp_const_none} },
+	};
+
+	mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+	mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+	size_t n;
+	mp_obj_t *items;
+	mp_obj_get_array(args[ARG_pins].u_obj, &n, &items);
+	if (n == 0 || n > 32) {
+		mp_raise_ValueError(MP_ERROR_TEXT("1 to 32 pins"));
+	}
+
+	machine_pingroup_obj_t *self = m_malloc(sizeof(machine_pingroup_obj_t) + n * sizeof(pingroup_pin_t));
+	self->base.type = type;
+	self->n_ports = 0;
+	self->n_pins = n;
+
+	for (size_t i = 0; i < n; i++) {
+		const machine_pin_obj_t *pin = machine_pin_find(items[i]);
+		int p = 0;
+		while (p < self->n_ports && self->ports[p] != pin->port) {
+			p++;
+		}
+		if (p == self->n_ports) {
+			if (p == PINGROUP_MAX_PORTS) {
+				mp_raise_ValueError(MP_ERROR_TEXT("too many ports"));
+			}
+			self->ports[p] = pin->port;
+			self->port_mask[p] = 0;
+			self->n_ports++;
+		}
+		self->pins[i].port = p;
+		self->pins[i].mask = pin->mask;
+		self->port_mask[p] |= pin->mask;
+
+		if (args[ARG_mode].u_obj != mp_const_none) {
+			funPinMode(pin->pin_id, mp_obj_get_int(args[ARG_mode].u_obj));
+		}
+	}
+
+	return MP_OBJ_FROM_PTR(self);
+}
+
+// method: PinGroup.write(value)
+static mp_obj_t machine_pingroup_write(mp_obj_t self_in, mp_obj_t value_in) {
+	machine_pingroup_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	pingroup_write(self, mp_obj_get_int_truncated(value_in));
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_2(machine_pingroup_write_obj, machine_pingroup_write);
+
+// method: PinGroup.read() -> bit i is pins[i]
+static mp_obj_t machine_pingroup_read(mp_obj_t self_in) {
+	machine_pingroup_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	return mp_obj_new_int_from_uint(pingroup_read(self));
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(machine_pingroup_read_obj, machine_pingroup_read);
+
+// method: PinGroup.write_seq(values, period_us=0)
+// values is bytes, bytearray or an integer array, array('B'/'H'/'I') gives
+// 8/16/32 bit entries
+static mp_obj_t machine_pingroup_write_seq(size_t n_args, const mp_obj_t *args) {
+	machine_pingroup_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+
+	mp_buffer_info_t buf;
+	mp_get_buffer_raise(args[1], &buf, MP_BUFFER_READ);
+	if (buf.typecode != BYTEARRAY_TYPECODE && (buf.typecode == 0 || strchr("bBhHiIlL", buf.typecode) == NULL)) {
+		mp_raise_ValueError(MP_ERROR_TEXT("values must be 8, 16 or 32 bit integers"));
+	}
+	size_t size = mp_binary_get_size('@', buf.typecode, NULL);
+	mp_int_t period_us = (n_args > 2) ? mp_obj_get_int(args[2]) : 0;
+	if (period_us < 0 || period_us > INT32_MAX / DELAY_US_TIME) {
+		mp_raise_ValueError(MP_ERROR_TEXT("period_us out of range"));
+	}
+	uint32_t period = period_us * DELAY_US_TIME;
+
+	uint32_t next = funSysTick32();
+	for (size_t i = 0; i < buf.len / size; i++) {
+		uint32_t value;
+		switch (size) {
+			case 1: value = ((uint8_t *)buf.buf)[i]; break;
+			case 2: value = ((uint16_t *)buf.buf)[i]; break;
+			default: value = ((uint32_t *)buf.buf)[i]; break;
+		}
+		if (period) {
+			while ((int32_t)(funSysTick32() - next) < 0) {
+			}
+			next += period;
+		}
+		pingroup_write(self, value);
+	}
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_pingroup_write_seq_obj, 2, 3, machine_pingroup_write_seq);
+
+static const mp_rom_map_elem_t machine_pingroup_locals_dict_table[] = {
+	{ MP_ROM_QSTR(MP_QSTR_write),     MP_ROM_PTR(&machine_pingroup_write_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_read),      MP_ROM_PTR(&machine_pingroup_read_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_write_seq), MP_ROM_PTR(&machine_pingroup_write_seq_obj) },
+};
+static MP_DEFINE_CONST_DICT(machine_pingroup_locals_dict, machine_pingroup_locals_dict_table);
+
+MP_DEFINE_CONST_OBJ_TYPE(
+	machine_pingroup_type,
+	MP_QSTR_PinGroup,
+	MP_TYPE_FLAG_NONE,
+	make_new, machine_pingroup_make_new,
+	locals_dict, &machine_pingroup_locals_dict
+);
@@ -0,0 +1,95 @@
+#include "py/runtime.h"
+#include "py/binary.h"
+#include "modmachine.h"
+
+// ==========================================================================
+// Pulse Timing: machine.time_pulse_us and machine.capture
+// ==========================================================================
+// Both poll the pin from a loop in RAM and stamp edges with SysTick, so the
+// resolution is a few CPU cycles. Interrupts stay on, one arriving during a
+// pulse makes that edge late by the length of its handler.
+#define PULSE_TIMEOUT_MAX_US (0x7FFFFFFF / DELAY_US_TIME)
+
+static uint32_t pulse_timeout_ticks(mp_int_t timeout_us) {
+	if (timeout_us < 0 || timeout_us > PULSE_TIMEOUT_MAX_US) {
+		mp_raise_ValueError(MP_ERROR_TEXT("timeout out of range"));
+	}
+	return timeout_us * DELAY_US_TIME;
+}
+
+// Pulse length in ticks, -2 on timeout waiting for it, -1 on timeout inside it
+static CH32FUN_RAMFUNC int32_t pulse_measure(const machine_pin_obj_t *pin, int level, uint32_t timeout) {
+	uint32_t start = funSysTick32();
+	while (machine_pin_read(pin) != level) {
+		if (funSysTick32() - start >= timeout) {
+			return -2;
+		}
+	}
+	start = funSysTick32();
+	while (machine_pin_read(pin) == level) {
+		if (funSysTick32() - start >= timeout) {
+			return -1;
+		}
+	}
+	return funSysTick32() - start;
+}
+
+// Edges in SysTick ticks, relative to the first one. Returns the edge count,
+// gives up after timeout ticks without an edge.
+static CH32FUN_RAMFUNC size_t pulse_capture(const machine_pin_obj_t *pin, uint32_t *stamps, size_t n, uint32_t timeout) {
+	uint32_t start = funSysTick32();
+	uint32_t first = start;
+	int level = machine_pin_read(pin);
+	size_t count = 0;
+
+	while (count < n) {
+		uint32_t now = funSysTick32();
+		if (machine_pin_read(pin) != level) {
+			level = !level;
+			if (count == 0) {
+				first = now;
+			}
+			stamps[count++] = now - first;
+			start = now;
+		}
+		else if (now - start >= timeout) {
+			break;
+		}
+	}
+	return count;
+}
+
+// Usage: machine.time_pulse_us(pin, pulse_level, timeout_us=1000000)
+static mp_obj_t machine_time_pulse_us(size_t n_args, const mp_obj_t *args) {
+	const machine_pin_obj_t *pin = machine_pin_find(args[0]);
+	int level = mp_obj_is_true(args[1]);
+	uint32_t timeout = pulse_timeout_ticks((n_args > 2) ? mp_obj_get_int(args[2]) : 1000000);
+
+	int32_t ticks = pulse_measure(pin, level, timeout);
+	return MP_OBJ_NEW_SMALL_INT((ticks < 0) ? ticks : ticks / DELAY_US_TIME);
+}
+MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_time_pulse_us_obj, 2, 3, machine_time_pulse_us);
+
+// Usage: machine.capture(pin, buf, timeout_us=1000000) -> number of edges
+// buf is a 32 bit array, e.g. array('I', 64). Entry i is edge i in us after
+// the first edge. The level flips at every edge, starting from the level
+// the pin had when capture() was called. Stops when buf is full or once
+// the pin stays put for timeout_us, the end of an IR frame for example.
+static mp_obj_t machine_capture(size_t n_args, const mp_obj_t *args) {
+	const machine_pin_obj_t *pin = machine_pin_find(args[0]);
+
+	mp_buffer_info_t buf;
+	mp_get_buffer_raise(args[1], &buf, MP_BUFFER_WRITE);
+	if (mp_binary_get_size('@', buf.typecode, NULL) != 4) {
+		mp_raise_ValueError(MP_ERROR_TEXT("need a 32 bit array"));
+	}
+	uint32_t timeout = pulse_timeout_ticks((n_args > 2) ? mp_obj_get_int(args[2]) : 1000000);
+
+	uint32_t *stamps = buf.buf;
+	size_t count = pulse_capture(pin, stamps, buf.len / 4, timeout);
+	for (size_t i = 0; i < count; i++) {
+		stamps[i] /= DELAY_US_TIME;
+	}
+	return MP_OBJ_NEW_SMALL_INT(count);
+}
+MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_capture_obj, 2, 3, machine_capture);
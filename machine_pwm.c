@@ -0,0 +1,445 @@
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "modmachine.h"
+#include <string.h>
+
+#if MACHINE_HAS_PWM
+
+// ==========================================================================
+// machine.PWM
+// ==========================================================================
+// CH32: TIM1, TIM2 and TIM4 channels, TIM3 is left to ADC timing. The
+// compare registers are preloaded, a new duty takes effect at the next
+// update event, and PWM.duty_group() holds the update back while it
+// writes, so all channels of a timer switch in the same period. A
+// channel can also play an array of duties by DMA, one per period.
+// CH5xx: PWM4 to PWM11, 8 bit with a 256 clock cycle, one clock divider
+// for all of them. The data registers can also be written four at a time,
+// as R32_PWM4_7_DATA and R32_PWM8_11_DATA, so a group goes out as one store
+// to each.
+#define PWM_FREQ_DEFAULT 1000
+
+typedef struct {
+	uint32_t pin;
+#ifdef CH5xx
+	uint8_t pwm; // PWMx, 4 to 11
+#else
+	uint8_t timer; // index into pwm_timers[]
+	uint8_t ch;    // 0 to 3
+#endif
+} pwm_hw_t;
+
+#ifdef CH5xx
+static const pwm_hw_t pwm_hw[] = {
+	{ PA12, 4 }, { PA13, 5 }, { PB0, 6 }, { PB4, 7 },
+	{ PB6, 8 }, { PB7, 9 }, { PB14, 10 }, { PB23, 11 },
+};
+#else
+typedef struct {
+	TIM_TypeDef *regs;
+	DMA_Channel_TypeDef *up_dma; // the DMA channel of the update request
+} pwm_timer_t;
+
+static const pwm_timer_t pwm_timers[] = {
+	{ TIM1, DMA1_Channel5 }, // shared with USART1 RX and SPI2 TX, see machine_dma_claim()
+	{ TIM2, DMA1_Channel2 }, // and this one with SPI1 RX
+	{ TIM4, DMA1_Channel7 },
+};
+#define PWM_TIMERS MP_ARRAY_SIZE(pwm_timers)
+#define PWM_TIMER_SLOTS 3 // root pointers, at least PWM_TIMERS
+
+static const pwm_hw_t pwm_hw[] = {
+	{ PA8, 0, 0 }, { PA9, 0, 1 }, { PA10, 0, 2 }, { PA11, 0, 3 },
+	{ PA0, 1, 0 }, { PA1, 1, 1 }, { PA2, 1, 2 }, { PA3, 1, 3 },
+	{ PB6, 2, 0 }, { PB7, 2, 1 }, { PB8, 2, 2 }, { PB9, 2, 3 },
+};
+
+// duty sequences playing by DMA, the buffer stays alive until the next one
+MP_REGISTER_ROOT_POINTER(uint16_t *machine_pwm_seq[PWM_TIMER_SLOTS]);
+#endif
+#define PWM_COUNT MP_ARRAY_SIZE(pwm_hw)
+
+// the last duty set on every channel, a frequency change scales them
+static uint16_t pwm_duty[PWM_COUNT];
+
+typedef struct _machine_pwm_obj_t {
+	mp_obj_base_t base;
+	const pwm_hw_t *hw;
+} machine_pwm_obj_t;
+
+static size_t pwm_index(const pwm_hw_t *hw) {
+	return hw - pwm_hw;
+}
+
+#ifdef CH5xx
+static uint32_t pwm_freq_get(const pwm_hw_t *hw) {
+	uint32_t div = R8_PWM_CLOCK_DIV ? R8_PWM_CLOCK_DIV : 256;
+	return FUNCONF_SYSTEM_CORE_CLOCK / div / 256;
+}
+
+static void pwm_freq_set(const pwm_hw_t *hw, mp_int_t freq) {
+	uint32_t div = (freq > 0) ? FUNCONF_SYSTEM_CORE_CLOCK / 256 / freq : 0;
+	if (div < 1 || div > 256) {
+		mp_raise_ValueError(MP_ERROR_TEXT("freq out of range"));
+	}
+	R8_PWM_CLOCK_DIV = div & 0xFF; // 0 divides by 256
+}
+
+static uint8_t pwm_data(uint16_t duty) {
+	uint32_t data = (duty * 256 + 32768) >> 16;
+	return (data > 255) ? 255 : data; // 255 of 256 clocks is as high as it goes
+}
+
+static void pwm_duty_write(const pwm_hw_t *hw, uint16_t duty) {
+	(&R8_PWM4_DATA)[hw->pwm - 4] = pwm_data(duty);
+}
+
+static void pwm_init(const pwm_hw_t *hw, bool invert) {
+	uint8_t bit = 1 << (hw->pwm - 4);
+	funPinMode(hw->pin, GPIO_CFGLR_OUT_10Mhz_PP);
+	R8_PWM_CONFIG &= ~RB_PWM_CYCLE_SEL; // 256 clock cycle
+	if (invert) {
+		R8_PWM_POLAR |= bit;
+	}
+	else {
+		R8_PWM_POLAR &= ~bit;
+	}
+	R8_PWM_OUT_EN |= bit;
+}
+
+static void pwm_deinit(const pwm_hw_t *hw) {
+	R8_PWM_OUT_EN &= ~(1 << (hw->pwm - 4));
+}
+#else
+static void pwm_compare_write(TIM_TypeDef *tim, uint8_t ch, uint32_t value) {
+	switch (ch) {
+		case 0: tim->CH1CVR = value; break;
+		case 1: tim->CH2CVR = value; break;
+		case 2: tim->CH3CVR = value; break;
+		default: tim->CH4CVR = value; break;
+	}
+}
+
+static volatile void *pwm_compare_addr(TIM_TypeDef *tim, uint8_t ch) {
+	switch (ch) {
+		case 0: return &tim->CH1CVR;
+		case 1: return &tim->CH2CVR;
+		case 2: return &tim->CH3CVR;
+		default: return &tim->CH4CVR;
+	}
+}
+
+// duty_u16 in timer counts, 65535 is on for the whole period
+static uint32_t pwm_compare(TIM_TypeDef *tim, uint16_t duty) {
+	uint32_t period = tim->ATRLR + 1;
+	return (duty == 65535) ? period : (uint32_t)duty * period >> 16;
+}
+
+static uint32_t pwm_freq_get(const pwm_hw_t *hw) {
+	TIM_TypeDef *tim = pwm_timers[hw->timer].regs;
+	return machine_timer_clock(tim) / (tim->PSC + 1) / (tim->ATRLR + 1);
+}
+
+static void pwm_freq_set(const pwm_hw_t *hw, mp_int_t freq) {
+	TIM_TypeDef *tim = pwm_timers[hw->timer].regs;
+	uint32_t period = (freq > 0) ? machine_timer_clock(tim) / freq : 0;
+	uint32_t psc = (period > 0) ? (period - 1) / 65536 : 0;
+	if (period < 2 || psc > 0xFFFF) {
+		mp_raise_ValueError(MP_ERROR_TEXT("freq out of range"));
+	}
+	tim->PSC = psc;
+	tim->ATRLR = period / (psc + 1) - 1;
+
+	// the other channels on this timer keep their duty
+	for (size_t i = 0; i < PWM_COUNT; i++) {
+		if (pwm_hw[i].timer == hw->timer) {
+			pwm_compare_write(tim, pwm_hw[i].ch, pwm_compare(tim, pwm_duty[i]));
+		}
+	}
+	tim->SWEVGR = TIM_UG;
+}
+
+static void pwm_duty_write(const pwm_hw_t *hw, uint16_t duty) {
+	TIM_TypeDef *tim = pwm_timers[hw->timer].regs;
+	pwm_compare_write(tim, hw->ch, pwm_compare(tim, duty));
+}
+
+static void pwm_init(const pwm_hw_t *hw, bool invert) {
+	TIM_TypeDef *tim = pwm_timers[hw->timer].regs;
+	if (tim == TIM1) {
+		RCC->APB2PCENR |= RCC_TIM1EN;
+	}
+	else {
+		RCC->APB1PCENR |= (tim == TIM2) ? RCC_TIM2EN : RCC_TIM4EN;
+	}
+
+	if (!(tim->CTLR1 & TIM_CEN)) {
+		tim->CTLR1 = TIM_ARPE;
+		tim->PSC = 0;
+		tim->ATRLR = 0xFFFF;
+		pwm_freq_set(hw, PWM_FREQ_DEFAULT);
+		if (tim == TIM1) {
+			tim->BDTR |= TIM_MOE; // the advanced timer gates all outputs here
+		}
+		tim->CTLR1 |= TIM_CEN;
+	}
+
+	// PWM mode 1 with the compare preloaded
+	uint16_t mode = (TIM_OC1M_2 | TIM_OC1M_1 | TIM_OC1PE) << (8 * (hw->ch & 1));
+	uint16_t mask = (TIM_OC1M | TIM_OC1PE | TIM_CC1S) << (8 * (hw->ch & 1));
+	if (hw->ch < 2) {
+		tim->CHCTLR1 = (tim->CHCTLR1 & ~mask) | mode;
+	}
+	else {
+		tim->CHCTLR2 = (tim->CHCTLR2 & ~mask) | mode;
+	}
+	tim->CCER = (tim->CCER & ~(TIM_CC1P << (4 * hw->ch))) |
+		((invert ? TIM_CC1P : 0) | TIM_CC1E) << (4 * hw->ch);
+	funPinMode(hw->pin, GPIO_CFGLR_OUT_50Mhz_AF_PP);
+}
+
+// Also hands the DMA channel back, the update request goes first so the
+// timer cannot trigger transfers on it for the next owner
+static void pwm_seq_stop(const pwm_hw_t *hw) {
+	const pwm_timer_t *t = &pwm_timers[hw->timer];
+	if (MP_STATE_PORT(machine_pwm_seq[hw->timer]) != NULL) {
+		t->regs->DMAINTENR &= ~TIM_UDE;
+		t->up_dma->CFGR = 0;
+		machine_dma_release(t->up_dma, t->regs);
+		MP_STATE_PORT(machine_pwm_seq[hw->timer]) = NULL;
+	}
+}
+
+static void pwm_deinit(const pwm_hw_t *hw) {
+	TIM_TypeDef *tim = pwm_timers[hw->timer].regs;
+	tim->CCER &= ~(TIM_CC1E << (4 * hw->ch));
+	bool any = false;
+	for (size_t i = 0; i < PWM_COUNT; i++) {
+		if (pwm_hw[i].timer == hw->timer && (tim->CCER & (TIM_CC1E << (4 * pwm_hw[i].ch)))) {
+			any = true;
+		}
+	}
+	if (!any) {
+		pwm_seq_stop(hw);
+		tim->CTLR1 = 0;
+	}
+}
+#endif
+
+// ==========================================================================
+// Python Methods
+// ==========================================================================
+
+// Constructor: machine.PWM(pin, *, freq, duty_u16, invert=False)
+static mp_obj_t machine_pwm_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+	enum { ARG_pin, ARG_freq, ARG_duty_u16, ARG_invert };
+	static const mp_arg_t allowed_args[] = {
+		{ MP_QSTR_pin,      MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+		{ MP_QSTR_freq,     MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = -1} },
+		{ MP_QSTR_duty_u16, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = -1} },
+		{ MP_QSTR_invert,   MP_ARG_KW_ONLY | MP_ARG_BOOL, {.u_bool = false} },
+	};
+
+	mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+	mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+	const machine_pin_obj_t *pin = machine_pin_find(args[ARG_pin].u_obj);
+	const pwm_hw_t *hw = NULL;
+	for (size_t i = 0; i < PWM_COUNT; i++) {
+		if (pwm_hw[i].pin == pin->pin_id) {
+			hw = &pwm_hw[i];
+		}
+	}
+	if (hw == NULL) {
+		mp_raise_ValueError(MP_ERROR_TEXT("no PWM on this pin"));
+	}
+
+	if (args[ARG_duty_u16].u_int >= 0) {
+		pwm_duty[pwm_index(hw)] = MIN(args[ARG_duty_u16].u_int, 65535);
+	}
+	pwm_init(hw, args[ARG_invert].u_bool);
+	if (args[ARG_freq].u_int >= 0) {
+		pwm_freq_set(hw, args[ARG_freq].u_int);
+	}
+	pwm_duty_write(hw, pwm_duty[pwm_index(hw)]);
+
+	machine_pwm_obj_t *self = mp_obj_malloc(machine_pwm_obj_t, type);
+	self->hw = hw;
+	return MP_OBJ_FROM_PTR(self);
+}
+
+// method: PWM.freq([value]), shared by every channel of the timer (CH32)
+// or by all PWMx (CH5xx)
+static mp_obj_t machine_pwm_freq(size_t n_args, const mp_obj_t *args) {
+	machine_pwm_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+	if (n_args == 1) {
+		return mp_obj_new_int_from_uint(pwm_freq_get(self->hw));
+	}
+	pwm_freq_set(self->hw, mp_obj_get_int(args[1]));
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_pwm_freq_obj, 1, 2, machine_pwm_freq);
+
+// method: PWM.duty_u16([value]), 0 to 65535
+static mp_obj_t machine_pwm_duty_u16(size_t n_args, const mp_obj_t *args) {
+	machine_pwm_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+	size_t index = pwm_index(self->hw);
+	if (n_args == 1) {
+		return MP_OBJ_NEW_SMALL_INT(pwm_duty[index]);
+	}
+	pwm_duty[index] = MIN(MAX(mp_obj_get_int(args[1]), 0), 65535);
+	pwm_duty_write(self->hw, pwm_duty[index]);
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_pwm_duty_u16_obj, 1, 2, machine_pwm_duty_u16);
+
+// method: PWM.deinit()
+static mp_obj_t machine_pwm_deinit(mp_obj_t self_in) {
+	machine_pwm_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	pwm_deinit(self->hw);
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(machine_pwm_deinit_obj, machine_pwm_deinit);
+
+// Usage: PWM.duty_group(((pwm, duty_u16), ...))
+// All new duties take effect in the same PWM period
+static mp_obj_t machine_pwm_duty_group(mp_obj_t pairs_in) {
+	size_t n;
+	mp_obj_t *pairs;
+	mp_obj_get_array(pairs_in, &n, &pairs);
+
+	// check everything before any register changes
+	const pwm_hw_t *hw[PWM_COUNT];
+	uint16_t duty[PWM_COUNT];
+	if (n > PWM_COUNT) {
+		mp_raise_ValueError(MP_ERROR_TEXT("too many channels"));
+	}
+	for (size_t i = 0; i < n; i++) {
+		size_t len;
+		mp_obj_t *pair;
+		mp_obj_get_array(pairs[i], &len, &pair);
+		if (len != 2 || !mp_obj_is_type(pair[0], &machine_pwm_type)) {
+			mp_raise_TypeError(MP_ERROR_TEXT("need (PWM, duty_u16) pairs"));
+		}
+		hw[i] = ((machine_pwm_obj_t *)MP_OBJ_TO_PTR(pair[0]))->hw;
+		duty[i] = MIN(MAX(mp_obj_get_int(pair[1]), 0), 65535);
+	}
+
+#ifdef CH5xx
+	uint8_t data[8];
+	memcpy(data, (const void *)&R8_PWM4_DATA, sizeof(data));
+	for (size_t i = 0; i < n; i++) {
+		pwm_duty[pwm_index(hw[i])] = duty[i];
+		data[hw[i]->pwm - 4] = pwm_data(duty[i]);
+	}
+	R32_PWM4_7_DATA = data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+	R32_PWM8_11_DATA = data[4] | data[5] << 8 | data[6] << 16 | (uint32_t)data[7] << 24;
+#else
+	// UDIS keeps the preloaded compares from being copied half way
+	for (size_t i = 0; i < n; i++) {
+		pwm_timers[hw[i]->timer].regs->CTLR1 |= TIM_UDIS;
+	}
+	for (size_t i = 0; i < n; i++) {
+		pwm_duty[pwm_index(hw[i])] = duty[i];
+		pwm_duty_write(hw[i], duty[i]);
+	}
+	for (size_t i = 0; i < n; i++) {
+		pwm_timers[hw[i]->timer].regs->CTLR1 &= ~TIM_UDIS;
+	}
+#endif
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(machine_pwm_duty_group_fun_obj, machine_pwm_duty_group);
+static MP_DEFINE_CONST_STATICMETHOD_OBJ(machine_pwm_duty_group_obj, MP_ROM_PTR(&machine_pwm_duty_group_fun_obj));
+
+#ifndef CH5xx
+// method: PWM.duty_seq(buf, *, loop=False) or PWM.duty_seq(None) to stop
+// Plays buf, duty_u16 values, one per PWM period by DMA from the timer
+// update. The values are turned into timer counts once, up front.
+static mp_obj_t machine_pwm_duty_seq(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+	enum { ARG_buf, ARG_loop };
+	static const mp_arg_t allowed_args[] = {
+		{ MP_QSTR_buf,  MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+		{ MP_QSTR_loop, MP_ARG_KW_ONLY | MP_ARG_BOOL, {.u_bool = false} },
+	};
+	machine_pwm_obj_t *self = MP_OBJ_TO_PTR(pos_args[0]);
+	mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+	mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+	const pwm_hw_t *hw = self->hw;
+	const pwm_timer_t *t = &pwm_timers[hw->timer];
+	pwm_seq_stop(hw);
+	if (args[ARG_buf].u_obj == mp_const_none) {
+		return mp_const_none;
+	}
+
+	mp_buffer_info_t buf;
+	mp_get_buffer_raise(args[ARG_buf].u_obj, &buf, MP_BUFFER_READ);
+	if (buf.typecode != 'H') {
+		mp_raise_ValueError(MP_ERROR_TEXT("need an array('H')"));
+	}
+	size_t len = buf.len / 2;
+	if (len == 0 || len > 0xFFFF) {
+		mp_raise_ValueError(MP_ERROR_TEXT("buffer length 1 to 65535"));
+	}
+	if (!machine_dma_claim(t->up_dma, t->regs)) {
+		mp_raise_OSError(MP_EBUSY); // the DMA channel is taken
+	}
+
+	uint16_t *seq = m_new(uint16_t, len);
+	const uint16_t *src = buf.buf;
+	for (size_t i = 0; i < len; i++) {
+		seq[i] = MIN(pwm_compare(t->regs, src[i]), 0xFFFF);
+	}
+	MP_STATE_PORT(machine_pwm_seq[hw->timer]) = seq;
+
+	RCC->AHBPCENR |= RCC_DMA1EN;
+	DMA_Channel_TypeDef *dma = t->up_dma;
+	dma->PADDR = (uint32_t)pwm_compare_addr(t->regs, hw->ch);
+	dma->MADDR = (uint32_t)seq;
+	dma->CNTR = len;
+	dma->CFGR = DMA_CFGR1_DIR | DMA_CFGR1_MINC | DMA_CFGR1_PSIZE_0 | DMA_CFGR1_MSIZE_0 |
+		(args[ARG_loop].u_bool ? DMA_CFGR1_CIRC : 0) | DMA_CFGR1_EN;
+	t->regs->DMAINTENR |= TIM_UDE;
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_KW(machine_pwm_duty_seq_obj, 1, machine_pwm_duty_seq);
+
+// method: PWM.seq_left() -> values of the sequence not played yet
+// A finished sequence gives its DMA channel back here.
+static mp_obj_t machine_pwm_seq_left(mp_obj_t self_in) {
+	machine_pwm_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	if (MP_STATE_PORT(machine_pwm_seq[self->hw->timer]) == NULL) {
+		return MP_OBJ_NEW_SMALL_INT(0);
+	}
+	const pwm_timer_t *t = &pwm_timers[self->hw->timer];
+	if (t->up_dma->CNTR == 0 && !(t->up_dma->CFGR & DMA_CFGR1_CIRC)) {
+		pwm_seq_stop(self->hw);
+		return MP_OBJ_NEW_SMALL_INT(0);
+	}
+	return MP_OBJ_NEW_SMALL_INT(t->up_dma->CNTR);
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(machine_pwm_seq_left_obj, machine_pwm_seq_left);
+#endif
+
+static const mp_rom_map_elem_t machine_pwm_locals_dict_table[] = {
+	{ MP_ROM_QSTR(MP_QSTR_freq),       MP_ROM_PTR(&machine_pwm_freq_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_duty_u16),   MP_ROM_PTR(&machine_pwm_duty_u16_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_deinit),     MP_ROM_PTR(&machine_pwm_deinit_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_duty_group), MP_ROM_PTR(&machine_pwm_duty_group_obj) },
+#ifndef CH5xx
+	{ MP_ROM_QSTR(MP_QSTR_duty_seq),   MP_ROM_PTR(&machine_pwm_duty_seq_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_seq_left),   MP_ROM_PTR(&machine_pwm_seq_left_obj) },
+#endif
+};
+static MP_DEFINE_CONST_DICT(machine_pwm_locals_dict, machine_pwm_locals_dict_table);
+
+MP_DEFINE_CONST_OBJ_TYPE(
+	machine_pwm_type,
+	MP_QSTR_PWM,
+	MP_TYPE_FLAG_NONE,
+	make_new, machine_pwm_make_new,
+	locals_dict, &machine_pwm_locals_dict
+);
+
+#endif // MACHINE_HAS_PWM
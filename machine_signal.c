@@ -1,9 +1,11 @@
 #include "py/runtime.h"
+#include "extmod/virtpin.h"
 #include "modmachine.h"
 
 typedef struct _machine_signal_obj_t {
 	mp_obj_base_t base;
 	mp_obj_t pin_obj; // The underlying Pin object
+	const mp_pin_p_t *pin_p; // its pin protocol, NULL for Python pin-like objects
 	bool invert;
 } machine_signal_obj_t;
 
@@ -21,21 +23,48 @@ static mp_obj_t machine_signal_make_new(const mp_obj_type_t *type, size_t n_args
 	machine_signal_obj_t *self = m_new_obj(machine_signal_obj_t);
 	self->base.type = &machine_signal_type;
 	self->pin_obj = args[ARG_pin_obj].u_obj;
+	self->pin_p = NULL;
 	self->invert = args[ARG_invert].u_bool;
 
+	// native pins are driven through their protocol, no method lookup
+	if (mp_obj_is_type(self->pin_obj, &machine_pin_type)) {
+		self->pin_p = MP_OBJ_TYPE_GET_SLOT(&machine_pin_type, protocol);
+	}
+
 	return MP_OBJ_FROM_PTR(self);
 }
 
-static mp_obj_t machine_signal_value(size_t n_args, const mp_obj_t *args) {
-	machine_signal_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+// Physical pin level, through the protocol or pin.value()
+static int machine_signal_read(machine_signal_obj_t *self) {
+	if (self->pin_p) {
+		int errcode;
+		return self->pin_p->ioctl(self->pin_obj, MP_PIN_READ, 0, &errcode);
+	}
+
+	mp_obj_t dest[2];
+	mp_load_method(self->pin_obj, MP_QSTR_value, dest);
+	return mp_obj_get_int(mp_call_method_n_kw(0, 0, dest));
+}
+
+static void machine_signal_write(machine_signal_obj_t *self, int val) {
+	if (self->pin_p) {
+		int errcode;
+		self->pin_p->ioctl(self->pin_obj, MP_PIN_WRITE, val, &errcode);
+		return;
+	}
 
 	mp_obj_t dest[3];
 	mp_load_method(self->pin_obj, MP_QSTR_value, dest);
+	dest[2] = MP_OBJ_NEW_SMALL_INT(val);
+	mp_call_method_n_kw(1, 0, dest);
+}
+
+static mp_obj_t machine_signal_value(size_t n_args, const mp_obj_t *args) {
+	machine_signal_obj_t *self = MP_OBJ_TO_PTR(args[0]);
 
 	if (n_args == 1) {
-		// Getter: dest[0]=method, dest[1]=pin_instance
-		mp_obj_t res = mp_call_method_n_kw(0, 0, dest);
-		int val = mp_obj_get_int(res);
+		// Getter
+		int val = machine_signal_read(self) != 0;
 		if (self->invert) {
 			val = !val;
 		}
@@ -43,12 +72,11 @@ static mp_obj_t machine_signal_value(size_t n_args, const mp_obj_t *args) {
 	}
 	else {
 		// Setter
-		int val = mp_obj_get_int(args[1]);
+		int val = mp_obj_is_true(args[1]);
 		if (self->invert) {
 			val = !val;
 		}
-		dest[2] = MP_OBJ_NEW_SMALL_INT(val);
-		mp_call_method_n_kw(1, 0, dest);
+		machine_signal_write(self, val);
 		return mp_const_none;
 	}
 }
@@ -57,14 +85,7 @@ static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_signal_value_obj, 1, 2, machi
 static mp_obj_t machine_signal_on(mp_obj_t self_in) {
 	machine_signal_obj_t *self = MP_OBJ_TO_PTR(self_in);
 	// Determine what "on" means physically
-	int phys_val = self->invert ? 0 : 1;
-
-	// Call pin.value(phys_val)
-	mp_obj_t dest[3];
-	mp_load_method(self->pin_obj, MP_QSTR_value, dest);
-	dest[2] = MP_OBJ_NEW_SMALL_INT(phys_val);
-	mp_call_method_n_kw(1, 0, dest);
-
+	machine_signal_write(self, self->invert ? 0 : 1);
 	return mp_const_none;
 }
 static MP_DEFINE_CONST_FUN_OBJ_1(machine_signal_on_obj, machine_signal_on);
@@ -72,13 +93,7 @@ static MP_DEFINE_CONST_FUN_OBJ_1(machine_signal_on_obj, machine_signal_on);
 static mp_obj_t machine_signal_off(mp_obj_t self_in) {
 	machine_signal_obj_t *self = MP_OBJ_TO_PTR(self_in);
 	// Determine what "off" means physically
-	int phys_val = self->invert ? 1 : 0;
-
-	mp_obj_t dest[3];
-	mp_load_method(self->pin_obj, MP_QSTR_value, dest);
-	dest[2] = MP_OBJ_NEW_SMALL_INT(phys_val);
-	mp_call_method_n_kw(1, 0, dest);
-
+	machine_signal_write(self, self->invert ? 1 : 0);
 	return mp_const_none;
 }
 static MP_DEFINE_CONST_FUN_OBJ_1(machine_signal_off_obj, machine_signal_off);
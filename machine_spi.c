@@ -0,0 +1,349 @@
+#include "py/runtime.h"
+#include "modmachine.h"
+#include <string.h>
+
+// ==========================================================================
+// machine.SPI
+// ==========================================================================
+// Controller mode only. Short transfers go byte by byte, anything from
+// SPI_DMA_THRESHOLD bytes up runs by DMA straight from and into the
+// caller's buffer, no copies. CH32: SPI1/SPI2 with a DMA channel for
+// each direction, so write_readinto works too. The channels are shared
+// with USART RX and the PWM sequences, while one of them is taken the
+// transfer runs from the byte loop instead. CH5xx: SPI0 has its own
+// half duplex DMA for buffers in RAM, write() uses it, reads run from
+// the byte loop which is full duplex.
+#define SPI_DMA_THRESHOLD 32
+#define SPI_NO_PIN        0xFFFFFFFF
+#define SPI_MSB           0
+#define SPI_LSB           1
+
+typedef struct {
+	uint8_t id;
+#ifndef CH5xx
+	SPI_TypeDef *regs;
+	DMA_Channel_TypeDef *rx_dma;
+	DMA_Channel_TypeDef *tx_dma;
+#endif
+	uint32_t sck_pin;
+	uint32_t mosi_pin;
+	uint32_t miso_pin;
+} spi_hw_t;
+
+static const spi_hw_t spi_hw[] = {
+#ifdef CH5xx
+#ifdef R8_SPI0_CTRL_MOD
+	{ 0, PA13, PA14, PA15 },
+#endif
+#else
+	{ 1, SPI1, DMA1_Channel2, DMA1_Channel3, PA5, PA7, PA6 },
+	{ 2, SPI2, DMA1_Channel4, DMA1_Channel5, PB13, PB15, PB14 },
+#endif
+};
+
+typedef struct _machine_spi_obj_t {
+	mp_obj_base_t base;
+	const spi_hw_t *hw;
+	uint32_t baudrate;
+	uint8_t polarity;
+	uint8_t phase;
+	uint8_t firstbit;
+} machine_spi_obj_t;
+
+#ifdef CH5xx
+static inline uint8_t spi_xfer_byte(machine_spi_obj_t *self, uint8_t out) {
+	R8_SPI0_CTRL_MOD &= ~RB_SPI_FIFO_DIR; // output, the input is sampled along
+	R8_SPI0_BUFFER = out;
+	while (!(R8_SPI0_INT_FLAG & RB_SPI_FREE)) {
+	}
+	return R8_SPI0_BUFFER;
+}
+
+// DMA for word aligned RAM buffers only, its address registers are 16 bit
+// RAM offsets. The byte counter is 12 bit, longer writes go in chunks.
+#define SPI_DMA_CHUNK 0xFFC
+
+static bool spi_dma_ok(const void *buf, size_t len) {
+	uintptr_t addr = (uintptr_t)buf;
+	return len >= SPI_DMA_THRESHOLD && addr >= 0x20000000 && !(addr & 3);
+}
+
+static void spi_dma_write(machine_spi_obj_t *self, const uint8_t *buf, size_t len) {
+	R8_SPI0_CTRL_MOD &= ~RB_SPI_FIFO_DIR;
+	R16_SPI0_DMA_BEG = (uint32_t)buf;
+	R16_SPI0_DMA_END = (uint32_t)(buf + len);
+	R16_SPI0_TOTAL_CNT = len;
+	R8_SPI0_INT_FLAG = RB_SPI_IF_CNT_END | RB_SPI_IF_DMA_END;
+	R8_SPI0_CTRL_CFG |= RB_SPI_DMA_ENABLE;
+	while (!(R8_SPI0_INT_FLAG & RB_SPI_IF_CNT_END)) {
+	}
+	R8_SPI0_CTRL_CFG &= ~RB_SPI_DMA_ENABLE;
+}
+#else
+static inline uint8_t spi_xfer_byte(machine_spi_obj_t *self, uint8_t out) {
+	SPI_TypeDef *regs = self->hw->regs;
+	while (!(regs->STATR & SPI_STATR_TXE)) {
+	}
+	regs->DATAR = out;
+	while (!(regs->STATR & SPI_STATR_RXNE)) {
+	}
+	return regs->DATAR;
+}
+
+#define SPI_DMA_CHUNK 0xFFFF // DMA counter
+
+static bool spi_dma_ok(const void *buf, size_t len) {
+	return len >= SPI_DMA_THRESHOLD;
+}
+
+// Both channels for the length of one transfer, or none
+static bool spi_dma_claim(machine_spi_obj_t *self) {
+	const spi_hw_t *hw = self->hw;
+	if (!machine_dma_claim(hw->rx_dma, hw->regs)) {
+		return false;
+	}
+	if (!machine_dma_claim(hw->tx_dma, hw->regs)) {
+		machine_dma_release(hw->rx_dma, hw->regs);
+		return false;
+	}
+	return true;
+}
+
+static void spi_dma_release(machine_spi_obj_t *self) {
+	machine_dma_release(self->hw->rx_dma, self->hw->regs);
+	machine_dma_release(self->hw->tx_dma, self->hw->regs);
+}
+
+// rbuf NULL drops what comes in, wbuf NULL sends *fill over and over
+static void spi_dma_xfer(machine_spi_obj_t *self, const uint8_t *wbuf, uint8_t *rbuf, size_t len, uint8_t fill) {
+	SPI_TypeDef *regs = self->hw->regs;
+	DMA_Channel_TypeDef *rx = self->hw->rx_dma;
+	DMA_Channel_TypeDef *tx = self->hw->tx_dma;
+	static uint8_t sink;
+
+	rx->CFGR = 0;
+	rx->PADDR = (uint32_t)&regs->DATAR;
+	rx->MADDR = (uint32_t)(rbuf ? rbuf : &sink);
+	rx->CNTR = len;
+	rx->CFGR = (rbuf ? DMA_CFGR1_MINC : 0) | DMA_CFGR1_PL | DMA_CFGR1_EN;
+
+	tx->CFGR = 0;
+	tx->PADDR = (uint32_t)&regs->DATAR;
+	tx->MADDR = (uint32_t)(wbuf ? wbuf : &fill);
+	tx->CNTR = len;
+	regs->CTLR2 |= SPI_CTLR2_RXDMAEN | SPI_CTLR2_TXDMAEN;
+	tx->CFGR = (wbuf ? DMA_CFGR1_MINC : 0) | DMA_CFGR1_DIR | DMA_CFGR1_EN;
+
+	// RX finishes last, one byte after TX
+	while (rx->CNTR) {
+	}
+	while (regs->STATR & SPI_STATR_BSY) {
+	}
+	regs->CTLR2 &= ~(SPI_CTLR2_RXDMAEN | SPI_CTLR2_TXDMAEN);
+	rx->CFGR = 0;
+	tx->CFGR = 0;
+}
+#endif
+
+// Full duplex transfer, either buffer may be NULL
+static void spi_transfer(machine_spi_obj_t *self, const uint8_t *wbuf, uint8_t *rbuf, size_t len, uint8_t fill) {
+#ifdef CH5xx
+	if (rbuf == NULL && spi_dma_ok(wbuf, len)) {
+		for (size_t pos = 0; pos < len; pos += SPI_DMA_CHUNK) {
+			size_t n = (len - pos < SPI_DMA_CHUNK) ? len - pos : SPI_DMA_CHUNK;
+			spi_dma_write(self, wbuf + pos, n);
+		}
+		return;
+	}
+#else
+	if (spi_dma_ok(wbuf ? (const void *)wbuf : rbuf, len) && spi_dma_claim(self)) {
+		for (size_t pos = 0; pos < len; pos += SPI_DMA_CHUNK) {
+			size_t n = (len - pos < SPI_DMA_CHUNK) ? len - pos : SPI_DMA_CHUNK;
+			spi_dma_xfer(self, wbuf ? wbuf + pos : NULL, rbuf ? rbuf + pos : NULL, n, fill);
+		}
+		spi_dma_release(self);
+		return;
+	}
+#endif
+	for (size_t i = 0; i < len; i++) {
+		uint8_t in = spi_xfer_byte(self, wbuf ? wbuf[i] : fill);
+		if (rbuf) {
+			rbuf[i] = in;
+		}
+	}
+}
+
+static void spi_init(machine_spi_obj_t *self) {
+	const spi_hw_t *hw = self->hw;
+
+#ifdef CH5xx
+	funPinMode(hw->sck_pin, GPIO_CFGLR_OUT_50Mhz_PP);
+	funPinMode(hw->mosi_pin, GPIO_CFGLR_OUT_50Mhz_PP);
+	funPinMode(hw->miso_pin, GPIO_CFGLR_IN_FLOAT);
+	if (self->polarity) {
+		funDigitalWrite(hw->sck_pin, FUN_HIGH); // idles high in mode 3
+	}
+
+	uint32_t div = (FUNCONF_SYSTEM_CORE_CLOCK + self->baudrate - 1) / self->baudrate;
+	R8_SPI0_CTRL_MOD = RB_SPI_ALL_CLEAR;
+	R8_SPI0_CLOCK_DIV = (div < 2) ? 2 : (div > 255) ? 255 : div;
+	R8_SPI0_CTRL_MOD = RB_SPI_MOSI_OE | RB_SPI_SCK_OE | (self->polarity ? RB_SPI_MST_SCK_MOD : 0);
+	R8_SPI0_CTRL_CFG = RB_SPI_AUTO_IF | (self->firstbit == SPI_LSB ? RB_SPI_BIT_ORDER : 0);
+	R8_SPI0_INTER_EN = 0;
+#else
+	if (hw->regs == SPI1) {
+		RCC->APB2PCENR |= RCC_SPI1EN;
+	}
+	else {
+		RCC->APB1PCENR |= RCC_SPI2EN;
+	}
+	RCC->AHBPCENR |= RCC_DMA1EN;
+	funPinMode(hw->sck_pin, GPIO_CFGLR_OUT_50Mhz_AF_PP);
+	funPinMode(hw->mosi_pin, GPIO_CFGLR_OUT_50Mhz_AF_PP);
+	funPinMode(hw->miso_pin, GPIO_CFGLR_IN_FLOAT);
+
+	// SCK = PCLK / 2^(br + 1), the fastest that is not above baudrate. SPI1
+	// is on APB2, SPI2 on APB1
+	uint32_t pclk = (hw->regs == SPI1) ? machine_pclk2() : machine_pclk1();
+	uint32_t br = 0;
+	while (br < 7 && (pclk >> (br + 1)) > self->baudrate) {
+		br++;
+	}
+	hw->regs->CTLR1 = 0;
+	hw->regs->CTLR2 = 0;
+	hw->regs->CTLR1 = SPI_CTLR1_MSTR | SPI_CTLR1_SSM | SPI_CTLR1_SSI | (br << 3) |
+		(self->polarity ? SPI_CTLR1_CPOL : 0) | (self->phase ? SPI_CTLR1_CPHA : 0) |
+		(self->firstbit == SPI_LSB ? SPI_CTLR1_LSBFIRST : 0);
+	hw->regs->CTLR1 |= SPI_CTLR1_SPE;
+#endif
+}
+
+// ==========================================================================
+// Python Methods
+// ==========================================================================
+
+// Constructor: machine.SPI(id, baudrate=1000000, *, polarity=0, phase=0, bits=8, firstbit=SPI.MSB)
+static mp_obj_t machine_spi_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+	enum { ARG_id, ARG_baudrate, ARG_polarity, ARG_phase, ARG_bits, ARG_firstbit };
+	static const mp_arg_t allowed_args[] = {
+		{ MP_QSTR_id,       MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+		{ MP_QSTR_baudrate, MP_ARG_INT, {.u_int = 1000000} },
+		{ MP_QSTR_polarity, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 0} },
+		{ MP_QSTR_phase,    MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 0} },
+		{ MP_QSTR_bits,     MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 8} },
+		{ MP_QSTR_firstbit, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = SPI_MSB} },
+	};
+
+	mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+	mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+	const spi_hw_t *hw = NULL;
+	for (size_t i = 0; i < MP_ARRAY_SIZE(spi_hw); i++) {
+		if (spi_hw[i].id == args[ARG_id].u_int) {
+			hw = &spi_hw[i];
+		}
+	}
+	if (hw == NULL) {
+		mp_raise_ValueError(MP_ERROR_TEXT("invalid SPI"));
+	}
+	if (args[ARG_baudrate].u_int <= 0) {
+		mp_raise_ValueError(MP_ERROR_TEXT("invalid baudrate"));
+	}
+	if (args[ARG_bits].u_int != 8) {
+		mp_raise_ValueError(MP_ERROR_TEXT("only 8 bits"));
+	}
+#ifdef CH5xx
+	// the CH5xx SPI does modes 0 and 3 only
+	if (args[ARG_polarity].u_int != args[ARG_phase].u_int) {
+		mp_raise_ValueError(MP_ERROR_TEXT("polarity must equal phase"));
+	}
+#endif
+
+	machine_spi_obj_t *self = mp_obj_malloc(machine_spi_obj_t, type);
+	self->hw = hw;
+	self->baudrate = args[ARG_baudrate].u_int;
+	self->polarity = args[ARG_polarity].u_int & 1;
+	self->phase = args[ARG_phase].u_int & 1;
+	self->firstbit = args[ARG_firstbit].u_int;
+	spi_init(self);
+
+	return MP_OBJ_FROM_PTR(self);
+}
+
+// method: SPI.read(nbytes, write=0x00)
+static mp_obj_t machine_spi_read(size_t n_args, const mp_obj_t *args) {
+	machine_spi_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+	vstr_t vstr;
+	vstr_init_len(&vstr, mp_obj_get_int(args[1]));
+	uint8_t fill = (n_args > 2) ? mp_obj_get_int(args[2]) : 0;
+	spi_transfer(self, NULL, (uint8_t *)vstr.buf, vstr.len, fill);
+	return mp_obj_new_bytes_from_vstr(&vstr);
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_spi_read_obj, 2, 3, machine_spi_read);
+
+// method: SPI.readinto(buf, write=0x00)
+static mp_obj_t machine_spi_readinto(size_t n_args, const mp_obj_t *args) {
+	machine_spi_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+	mp_buffer_info_t buf;
+	mp_get_buffer_raise(args[1], &buf, MP_BUFFER_WRITE);
+	uint8_t fill = (n_args > 2) ? mp_obj_get_int(args[2]) : 0;
+	spi_transfer(self, NULL, buf.buf, buf.len, fill);
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_spi_readinto_obj, 2, 3, machine_spi_readinto);
+
+// method: SPI.write(buf)
+static mp_obj_t machine_spi_write(mp_obj_t self_in, mp_obj_t buf_in) {
+	machine_spi_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	mp_buffer_info_t buf;
+	mp_get_buffer_raise(buf_in, &buf, MP_BUFFER_READ);
+	spi_transfer(self, buf.buf, NULL, buf.len, 0);
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_2(machine_spi_write_obj, machine_spi_write);
+
+// method: SPI.write_readinto(write_buf, read_buf), may be the same buffer
+static mp_obj_t machine_spi_write_readinto(mp_obj_t self_in, mp_obj_t wbuf_in, mp_obj_t rbuf_in) {
+	machine_spi_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	mp_buffer_info_t wbuf, rbuf;
+	mp_get_buffer_raise(wbuf_in, &wbuf, MP_BUFFER_READ);
+	mp_get_buffer_raise(rbuf_in, &rbuf, MP_BUFFER_WRITE);
+	if (wbuf.len != rbuf.len) {
+		mp_raise_ValueError(MP_ERROR_TEXT("buffers must be the same length"));
+	}
+	spi_transfer(self, wbuf.buf, rbuf.buf, wbuf.len, 0);
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_3(machine_spi_write_readinto_obj, machine_spi_write_readinto);
+
+// method: SPI.deinit()
+static mp_obj_t machine_spi_deinit(mp_obj_t self_in) {
+#ifdef CH5xx
+	R8_SPI0_CTRL_MOD = RB_SPI_ALL_CLEAR;
+#else
+	machine_spi_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	self->hw->regs->CTLR1 = 0;
+#endif
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(machine_spi_deinit_obj, machine_spi_deinit);
+
+static const mp_rom_map_elem_t machine_spi_locals_dict_table[] = {
+	{ MP_ROM_QSTR(MP_QSTR_read),           MP_ROM_PTR(&machine_spi_read_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_readinto),       MP_ROM_PTR(&machine_spi_readinto_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_write),          MP_ROM_PTR(&machine_spi_write_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_write_readinto), MP_ROM_PTR(&machine_spi_write_readinto_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_deinit),         MP_ROM_PTR(&machine_spi_deinit_obj) },
+
+	{ MP_ROM_QSTR(MP_QSTR_MSB),            MP_ROM_INT(SPI_MSB) },
+	{ MP_ROM_QSTR(MP_QSTR_LSB),            MP_ROM_INT(SPI_LSB) },
+};
+static MP_DEFINE_CONST_DICT(machine_spi_locals_dict, machine_spi_locals_dict_table);
+
+MP_DEFINE_CONST_OBJ_TYPE(
+	machine_spi_type,
+	MP_QSTR_SPI,
+	MP_TYPE_FLAG_NONE,
+	make_new, machine_spi_make_new,
+	locals_dict, &machine_spi_locals_dict
+);
@@ -0,0 +1,552 @@
+#include "py/runtime.h"
+#include "py/mphal.h"
+#include "py/stream.h"
+#include "py/mperrno.h"
+#include "modmachine.h"
+
+// ==========================================================================
+// machine.UART
+// ==========================================================================
+// Both directions go through rings on the heap, so Python never waits on
+// the line. CH32: RX is a circular DMA straight into the ring, the
+// write index is the DMA counter. The UART holds that DMA channel until
+// deinit(). TX is fed from the TXE interrupt.
+// CH5xx has no DMA for its UARTs, the 8 byte FIFOs are emptied and filled
+// from the UART interrupt (RX trigger at 4 bytes plus the RX timeout).
+#define UART_RXBUF_DEFAULT 256
+#define UART_TXBUF_DEFAULT 256
+#define UART_NO_PIN        0xFFFFFFFF
+
+#ifdef CH5xx
+// The same layout for every UART, starting at R8_UARTx_MCR
+typedef struct {
+	vu8 MCR;
+	vu8 IER;
+	vu8 FCR;
+	vu8 LCR;
+	vu8 IIR;
+	vu8 LSR;
+	vu8 MSR;
+	vu8 RESERVED0;
+	vu8 RBR_THR;
+	vu8 RESERVED1;
+	vu8 RFC;
+	vu8 TFC;
+	vu16 DL;
+	vu8 DIV;
+	vu8 ADR;
+} uart_regs_t;
+#define UART_FIFO_DEPTH 8
+#else
+typedef USART_TypeDef uart_regs_t;
+#endif
+
+typedef struct {
+	uint8_t id;
+	uart_regs_t *regs;
+	int irqn;
+	uint32_t tx_pin; // defaults, UART_NO_PIN leaves the pin alone
+	uint32_t rx_pin;
+#ifndef CH5xx
+	DMA_Channel_TypeDef *rx_dma;
+#endif
+} uart_hw_t;
+
+static const uart_hw_t uart_hw[] = {
+#ifdef CH5xx
+#ifdef R8_UART0_MCR
+	{ 0, (uart_regs_t *)&R8_UART0_MCR, UART0_IRQn, PB7, PB4 },
+#endif
+#ifdef R8_UART1_MCR
+	{ 1, (uart_regs_t *)&R8_UART1_MCR, UART1_IRQn, PA9, PA8 },
+#endif
+#ifdef R8_UART2_MCR
+	{ 2, (uart_regs_t *)&R8_UART2_MCR, UART2_IRQn, PA7, PA6 },
+#endif
+#ifdef R8_UART3_MCR
+	{ 3, (uart_regs_t *)&R8_UART3_MCR, UART3_IRQn, PA5, PA4 },
+#endif
+#ifdef R8_UART_MCR
+	{ 0, (uart_regs_t *)&R8_UART_MCR, UART_IRQn, UART_NO_PIN, UART_NO_PIN }, // CH570/572, pins are remappable
+#endif
+#else
+	{ 1, USART1, USART1_IRQn, PA9, PA10, DMA1_Channel5 },
+	{ 2, USART2, USART2_IRQn, PA2, PA3, DMA1_Channel6 },
+	{ 3, USART3, USART3_IRQn, PB10, PB11, DMA1_Channel3 },
+#endif
+};
+#define UART_COUNT MP_ARRAY_SIZE(uart_hw)
+#define UART_SLOTS 4 // root pointers, at least UART_COUNT
+
+typedef struct _machine_uart_obj_t {
+	mp_obj_base_t base;
+	const uart_hw_t *hw;
+	uint32_t baudrate;
+	uint16_t timeout;      // ms to wait for the first byte
+	uint16_t timeout_char; // ms to wait between bytes
+	uint8_t *rx_buf;
+	uint16_t rx_size;
+	volatile uint16_t rx_head; // CH5xx only, CH32 asks the DMA
+	uint16_t rx_tail;
+	uint8_t *tx_buf;
+	uint16_t tx_size;
+	volatile uint16_t tx_head;
+	volatile uint16_t tx_tail;
+	volatile uint32_t rx_overflow;
+} machine_uart_obj_t;
+
+MP_REGISTER_ROOT_POINTER(mp_obj_t machine_uart_obj[UART_SLOTS]);
+
+static uint16_t uart_rx_head(machine_uart_obj_t *self) {
+#ifdef CH5xx
+	return self->rx_head;
+#else
+	return (self->rx_size - self->hw->rx_dma->CNTR) % self->rx_size;
+#endif
+}
+
+static size_t uart_rx_any(machine_uart_obj_t *self) {
+	return (uart_rx_head(self) + self->rx_size - self->rx_tail) % self->rx_size;
+}
+
+static size_t uart_tx_free(machine_uart_obj_t *self) {
+	return self->tx_size - 1 - (self->tx_head + self->tx_size - self->tx_tail) % self->tx_size;
+}
+
+static bool uart_tx_done(machine_uart_obj_t *self) {
+	if (self->tx_head != self->tx_tail) {
+		return false;
+	}
+#ifdef CH5xx
+	return (self->hw->regs->LSR & RB_LSR_TX_ALL_EMP) != 0;
+#else
+	return (self->hw->regs->STATR & USART_STATR_TC) != 0;
+#endif
+}
+
+// Called from the UART ISR
+static void uart_irq(int index) {
+	mp_obj_t obj = MP_STATE_PORT(machine_uart_obj[index]);
+	if (obj == MP_OBJ_NULL) {
+		return;
+	}
+	machine_uart_obj_t *self = MP_OBJ_TO_PTR(obj);
+	uart_regs_t *regs = self->hw->regs;
+
+#ifdef CH5xx
+	(void)regs->IIR; // reading IIR acknowledges the THR empty interrupt
+	if (regs->LSR & RB_LSR_OVER_ERR) {
+		self->rx_overflow++;
+	}
+	while (regs->RFC) {
+		uint8_t c = regs->RBR_THR;
+		uint16_t next = (self->rx_head + 1) % self->rx_size;
+		if (next == self->rx_tail) {
+			self->rx_overflow++;
+			continue;
+		}
+		self->rx_buf[self->rx_head] = c;
+		self->rx_head = next;
+	}
+	if (regs->IER & RB_IER_THR_EMPTY) {
+		while (regs->TFC < UART_FIFO_DEPTH && self->tx_tail != self->tx_head) {
+			regs->RBR_THR = self->tx_buf[self->tx_tail];
+			self->tx_tail = (self->tx_tail + 1) % self->tx_size;
+		}
+		if (self->tx_tail == self->tx_head) {
+			regs->IER &= ~RB_IER_THR_EMPTY;
+		}
+	}
+#else
+	if ((regs->CTLR1 & USART_CTLR1_TXEIE) && (regs->STATR & USART_STATR_TXE)) {
+		if (self->tx_tail != self->tx_head) {
+			regs->DATAR = self->tx_buf[self->tx_tail];
+			self->tx_tail = (self->tx_tail + 1) % self->tx_size;
+		}
+		else {
+			regs->CTLR1 &= ~USART_CTLR1_TXEIE;
+		}
+	}
+#endif
+}
+
+#ifdef CH5xx
+// uart_hw[] only lists the UARTs this chip has, find ours by id
+static void uart_irq_id(uint8_t id) {
+	for (size_t i = 0; i < UART_COUNT; i++) {
+		if (uart_hw[i].id == id) {
+			uart_irq(i);
+		}
+	}
+}
+
+#ifdef R8_UART_MCR
+void UART_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void UART_IRQHandler(void) { uart_irq_id(0); }
+#endif
+#ifdef R8_UART0_MCR
+void UART0_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void UART0_IRQHandler(void) { uart_irq_id(0); }
+#endif
+#ifdef R8_UART1_MCR
+void UART1_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void UART1_IRQHandler(void) { uart_irq_id(1); }
+#endif
+#ifdef R8_UART2_MCR
+void UART2_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void UART2_IRQHandler(void) { uart_irq_id(2); }
+#endif
+#ifdef R8_UART3_MCR
+void UART3_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void UART3_IRQHandler(void) { uart_irq_id(3); }
+#endif
+#else
+void USART1_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void USART2_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void USART3_IRQHandler(void) __attribute__((interrupt)) __attribute__((used));
+void USART1_IRQHandler(void) { uart_irq(0); }
+void USART2_IRQHandler(void) { uart_irq(1); }
+void USART3_IRQHandler(void) { uart_irq(2); }
+#endif
+
+static void uart_tx_kick(machine_uart_obj_t *self) {
+#ifdef CH5xx
+	self->hw->regs->IER |= RB_IER_THR_EMPTY;
+#else
+	self->hw->regs->CTLR1 |= USART_CTLR1_TXEIE;
+#endif
+}
+
+static void uart_deinit(machine_uart_obj_t *self) {
+	NVIC_DisableIRQ(self->hw->irqn);
+#ifdef CH5xx
+	self->hw->regs->IER = 0;
+#else
+	self->hw->regs->CTLR1 = 0;
+	// the RX channel is left alone if init never got it
+	if (machine_dma_claim(self->hw->rx_dma, self->hw->regs)) {
+		self->hw->rx_dma->CFGR = 0;
+		machine_dma_release(self->hw->rx_dma, self->hw->regs);
+	}
+#endif
+}
+
+// The baud rate divisor, refused when the rate it gives is more than 2% off,
+// about what a receiver sampling mid-bit still takes over a frame.
+// CH5xx: baud = Fsys * 2 / DIV / 16 / DL, with DIV = 1
+// CH32: baud = Fsys / BRR, BRR in 1/16 bits and at least 16
+static uint32_t uart_divisor(const uart_hw_t *hw, mp_int_t baudrate) {
+#ifdef CH5xx
+	uint32_t clock = FUNCONF_SYSTEM_CORE_CLOCK / 8;
+	uint32_t min = 1;
+#else
+	// USART1 sits on APB2, USART2 and 3 on APB1
+	uint32_t clock = (hw->regs == USART1) ? machine_pclk2() : machine_pclk1();
+	uint32_t min = 16;
+#endif
+	if (baudrate <= 0) {
+		mp_raise_ValueError(MP_ERROR_TEXT("invalid baudrate"));
+	}
+	uint32_t baud = baudrate;
+	uint32_t div = (clock + baud / 2) / baud;
+	uint32_t actual = (div > 0) ? clock / div : 0;
+	uint32_t error = (actual > baud) ? actual - baud : baud - actual;
+	if (div < min || div > 0xFFFF || error * 50 > baud) {
+		mp_raise_ValueError(MP_ERROR_TEXT("baudrate not reachable"));
+	}
+	return div;
+}
+
+static void uart_init(machine_uart_obj_t *self) {
+	uart_regs_t *regs = self->hw->regs;
+
+#ifndef CH5xx
+	if (!machine_dma_claim(self->hw->rx_dma, regs)) {
+		mp_raise_OSError(MP_EBUSY); // RX DMA channel in use by SPI or PWM
+	}
+#endif
+
+	if (self->hw->tx_pin != UART_NO_PIN) {
+#ifdef CH5xx
+		funPinMode(self->hw->tx_pin, GPIO_CFGLR_OUT_10Mhz_PP);
+#else
+		funPinMode(self->hw->tx_pin, GPIO_CFGLR_OUT_10Mhz_AF_PP);
+#endif
+	}
+	if (self->hw->rx_pin != UART_NO_PIN) {
+		funPinMode(self->hw->rx_pin, GPIO_CFGLR_IN_PUPD);
+		funDigitalWrite(self->hw->rx_pin, FUN_HIGH); // pull up
+	}
+
+#ifdef CH5xx
+	regs->IER = RB_IER_RESET; // resets the UART
+	regs->DIV = 1;
+	regs->DL = uart_divisor(self->hw, self->baudrate);
+	regs->LCR = RB_LCR_WORD_SZ; // 8N1
+	regs->FCR = (2 << 6) | RB_FCR_TX_FIFO_CLR | RB_FCR_RX_FIFO_CLR | RB_FCR_FIFO_EN; // RX trigger at 4 bytes
+	regs->MCR = RB_MCR_INT_OE;
+	regs->IER = RB_IER_TXD_EN | RB_IER_RECV_RDY | RB_IER_LINE_STAT;
+#else
+	if (regs == USART1) {
+		RCC->APB2PCENR |= RCC_USART1EN;
+	}
+	else {
+		RCC->APB1PCENR |= (regs == USART2) ? RCC_USART2EN : RCC_USART3EN;
+	}
+	RCC->AHBPCENR |= RCC_DMA1EN;
+
+	regs->CTLR1 = 0;
+	regs->BRR = uart_divisor(self->hw, self->baudrate);
+	regs->CTLR2 = 0;
+	regs->CTLR3 = USART_CTLR3_DMAR;
+
+	DMA_Channel_TypeDef *dma = self->hw->rx_dma;
+	dma->CFGR = 0;
+	dma->PADDR = (uint32_t)&regs->DATAR;
+	dma->MADDR = (uint32_t)self->rx_buf;
+	dma->CNTR = self->rx_size;
+	dma->CFGR = DMA_CFGR1_PL | DMA_CFGR1_MINC | DMA_CFGR1_CIRC | DMA_CFGR1_EN;
+
+	regs->CTLR1 = USART_CTLR1_UE | USART_CTLR1_TE | USART_CTLR1_RE;
+#endif
+
+	NVIC_EnableIRQ(self->hw->irqn);
+}
+
+// ==========================================================================
+// Python Methods
+// ==========================================================================
+
+// Constructor: machine.UART(id, baudrate=115200, *, tx=None, rx=None, rxbuf=256, txbuf=256, timeout=0, timeout_char=1)
+static mp_obj_t machine_uart_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+	enum { ARG_id, ARG_baudrate, ARG_tx, ARG_rx, ARG_rxbuf, ARG_txbuf, ARG_timeout, ARG_timeout_char };
+	static const mp_arg_t allowed_args[] = {
+		{ MP_QSTR_id,           MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+		{ MP_QSTR_baudrate,     MP_ARG_INT, {.u_int = 115200} },
+		{ MP_QSTR_tx,           MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = mp_const_none} },
+		{ MP_QSTR_rx,           MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = mp_const_none} },
+		{ MP_QSTR_rxbuf,        MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = UART_RXBUF_DEFAULT} },
+		{ MP_QSTR_txbuf,        MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = UART_TXBUF_DEFAULT} },
+		{ MP_QSTR_timeout,      MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 0} },
+		{ MP_QSTR_timeout_char, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 1} },
+	};
+
+	mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+	mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+	int index = -1;
+	for (size_t i = 0; i < UART_COUNT; i++) {
+		if (uart_hw[i].id == args[ARG_id].u_int) {
+			index = i;
+		}
+	}
+	if (index < 0) {
+		mp_raise_ValueError(MP_ERROR_TEXT("invalid UART"));
+	}
+	uart_divisor(&uart_hw[index], args[ARG_baudrate].u_int); // before the running UART goes down
+	if (args[ARG_rxbuf].u_int < 16 || args[ARG_rxbuf].u_int > 0xFFFF ||
+		args[ARG_txbuf].u_int < 16 || args[ARG_txbuf].u_int > 0xFFFF) {
+		mp_raise_ValueError(MP_ERROR_TEXT("buffer size 16 to 65535"));
+	}
+
+	// one object per UART, a second constructor call re-initialises it
+	machine_uart_obj_t *self;
+	if (MP_STATE_PORT(machine_uart_obj[index]) != MP_OBJ_NULL) {
+		self = MP_OBJ_TO_PTR(MP_STATE_PORT(machine_uart_obj[index]));
+		uart_deinit(self);
+	}
+	else {
+		self = mp_obj_malloc(machine_uart_obj_t, type);
+		self->rx_buf = NULL;
+		self->tx_buf = NULL;
+	}
+
+	// a copy of the hardware entry when the pins are overridden, this only
+	// picks which pins get set up, pin remapping stays with the AFIO/PIN
+	// registers (ch32fun.regs)
+	const uart_hw_t *hw = &uart_hw[index];
+	if (args[ARG_tx].u_obj != mp_const_none || args[ARG_rx].u_obj != mp_const_none) {
+		uart_hw_t *custom = m_new_obj(uart_hw_t);
+		*custom = *hw;
+		if (args[ARG_tx].u_obj != mp_const_none) {
+			custom->tx_pin = machine_pin_find(args[ARG_tx].u_obj)->pin_id;
+		}
+		if (args[ARG_rx].u_obj != mp_const_none) {
+			custom->rx_pin = machine_pin_find(args[ARG_rx].u_obj)->pin_id;
+		}
+		hw = custom;
+	}
+
+	self->hw = hw;
+	self->baudrate = args[ARG_baudrate].u_int;
+	self->timeout = args[ARG_timeout].u_int;
+	self->timeout_char = args[ARG_timeout_char].u_int;
+	if (self->rx_buf == NULL || self->rx_size != args[ARG_rxbuf].u_int) {
+		self->rx_size = args[ARG_rxbuf].u_int;
+		self->rx_buf = m_new(uint8_t, self->rx_size);
+	}
+	if (self->tx_buf == NULL || self->tx_size != args[ARG_txbuf].u_int) {
+		self->tx_size = args[ARG_txbuf].u_int;
+		self->tx_buf = m_new(uint8_t, self->tx_size);
+	}
+	self->rx_head = self->rx_tail = 0;
+	self->tx_head = self->tx_tail = 0;
+	self->rx_overflow = 0;
+
+	MP_STATE_PORT(machine_uart_obj[index]) = MP_OBJ_FROM_PTR(self);
+	uart_init(self);
+
+	return MP_OBJ_FROM_PTR(self);
+}
+
+// Wait up to timeout ms for cond, false on timeout
+static bool uart_wait(machine_uart_obj_t *self, bool (*cond)(machine_uart_obj_t *), uint32_t timeout) {
+	uint32_t start = mp_hal_ticks_ms();
+	while (!cond(self)) {
+		if (mp_hal_ticks_ms() - start >= timeout) {
+			return false;
+		}
+		mp_hal_background_processing();
+	}
+	return true;
+}
+
+static bool uart_can_read(machine_uart_obj_t *self) {
+	return uart_rx_any(self) > 0;
+}
+
+static bool uart_can_write(machine_uart_obj_t *self) {
+	return uart_tx_free(self) > 0;
+}
+
+static mp_uint_t machine_uart_read(mp_obj_t self_in, void *buf_in, mp_uint_t size, int *errcode) {
+	machine_uart_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	uint8_t *buf = buf_in;
+
+	if (size == 0) {
+		return 0;
+	}
+	if (!uart_wait(self, uart_can_read, self->timeout)) {
+		*errcode = MP_EAGAIN;
+		return MP_STREAM_ERROR;
+	}
+
+	mp_uint_t n = 0;
+	do {
+		uint16_t head = uart_rx_head(self);
+		while (n < size && self->rx_tail != head) {
+			buf[n++] = self->rx_buf[self->rx_tail];
+			self->rx_tail = (self->rx_tail + 1) % self->rx_size;
+		}
+	} while (n < size && uart_wait(self, uart_can_read, self->timeout_char));
+	return n;
+}
+
+static mp_uint_t machine_uart_write(mp_obj_t self_in, const void *buf_in, mp_uint_t size, int *errcode) {
+	machine_uart_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	const uint8_t *buf = buf_in;
+
+	for (mp_uint_t n = 0; n < size; n++) {
+		if (uart_tx_free(self) == 0) {
+			uart_tx_kick(self);
+			// a full ring drains at line speed, allow for that plus timeout
+			uint32_t drain_ms = self->tx_size * 10000 / self->baudrate + 1;
+			if (!uart_wait(self, uart_can_write, drain_ms + self->timeout)) {
+				if (n == 0) {
+					*errcode = MP_ETIMEDOUT;
+					return MP_STREAM_ERROR;
+				}
+				return n;
+			}
+		}
+		self->tx_buf[self->tx_head] = buf[n];
+		self->tx_head = (self->tx_head + 1) % self->tx_size;
+	}
+	uart_tx_kick(self);
+	return size;
+}
+
+static mp_uint_t machine_uart_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_t arg, int *errcode) {
+	machine_uart_obj_t *self = MP_OBJ_TO_PTR(self_in);
+
+	if (request == MP_STREAM_POLL) {
+		mp_uint_t ret = 0;
+		if ((arg & MP_STREAM_POLL_RD) && uart_rx_any(self)) ret |= MP_STREAM_POLL_RD;
+		if ((arg & MP_STREAM_POLL_WR) && uart_tx_free(self)) ret |= MP_STREAM_POLL_WR;
+		return ret;
+	}
+	else if (request == MP_STREAM_FLUSH) {
+		uint32_t drain_ms = self->tx_size * 10000 / self->baudrate + 1;
+		if (!uart_wait(self, uart_tx_done, drain_ms + self->timeout)) {
+			*errcode = MP_ETIMEDOUT;
+			return MP_STREAM_ERROR;
+		}
+		return 0;
+	}
+	else if (request == MP_STREAM_CLOSE) {
+		uart_deinit(self);
+		return 0;
+	}
+
+	*errcode = MP_EINVAL;
+	return MP_STREAM_ERROR;
+}
+
+// method: UART.any() -> bytes waiting
+static mp_obj_t machine_uart_any(mp_obj_t self_in) {
+	machine_uart_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	return MP_OBJ_NEW_SMALL_INT(uart_rx_any(self));
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(machine_uart_any_obj, machine_uart_any);
+
+// method: UART.txdone() -> True once everything is on the wire
+static mp_obj_t machine_uart_txdone(mp_obj_t self_in) {
+	machine_uart_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	return mp_obj_new_bool(uart_tx_done(self));
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(machine_uart_txdone_obj, machine_uart_txdone);
+
+// method: UART.deinit()
+static mp_obj_t machine_uart_deinit(mp_obj_t self_in) {
+	machine_uart_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	uart_deinit(self);
+	return mp_const_none;
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(machine_uart_deinit_obj, machine_uart_deinit);
+
+// method: UART.stats() -> (rx overflows,), CH32 DMA overruns of the ring go unnoticed
+static mp_obj_t machine_uart_stats(mp_obj_t self_in) {
+	machine_uart_obj_t *self = MP_OBJ_TO_PTR(self_in);
+	mp_obj_t items[1] = { mp_obj_new_int_from_uint(self->rx_overflow) };
+	return mp_obj_new_tuple(1, items);
+}
+static MP_DEFINE_CONST_FUN_OBJ_1(machine_uart_stats_obj, machine_uart_stats);
+
+static const mp_rom_map_elem_t machine_uart_locals_dict_table[] = {
+	{ MP_ROM_QSTR(MP_QSTR_read),     MP_ROM_PTR(&mp_stream_read_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_readinto), MP_ROM_PTR(&mp_stream_readinto_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_readline), MP_ROM_PTR(&mp_stream_unbuffered_readline_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_write),    MP_ROM_PTR(&mp_stream_write_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_flush),    MP_ROM_PTR(&mp_stream_flush_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_any),      MP_ROM_PTR(&machine_uart_any_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_txdone),   MP_ROM_PTR(&machine_uart_txdone_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_deinit),   MP_ROM_PTR(&machine_uart_deinit_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_stats),    MP_ROM_PTR(&machine_uart_stats_obj) },
+};
+static MP_DEFINE_CONST_DICT(machine_uart_locals_dict, machine_uart_locals_dict_table);
+
+static const mp_stream_p_t machine_uart_stream_p = {
+	.read = machine_uart_read,
+	.write = machine_uart_write,
+	.ioctl = machine_uart_ioctl,
+	.is_text = false,
+};
+
+MP_DEFINE_CONST_OBJ_TYPE(
+	machine_uart_type,
+	MP_QSTR_UART,
+	MP_TYPE_FLAG_ITER_IS_STREAM,
+	make_new, machine_uart_make_new,
+	protocol, &machine_uart_stream_p,
+	locals_dict, &machine_uart_locals_dict
+);
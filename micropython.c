@@ -11,6 +11,8 @@
 #include "py/stackctrl.h"
 #include "shared/runtime/pyexec.h"
 #include "shared/runtime/interrupt_char.h"
+#include "modch32fun.h"
+#include "modmachine.h"
 
 extern int errno; // for libm
 int *__errno(void) { return &errno; }
@@ -108,6 +110,10 @@ void micropython_task() {
 extern void usb_init();
 int main(void) {
 	SystemInit();
+	ch32fun_update_boot(); // may swap in a staged image and reset
+#ifndef CH5xx
+	machine_clock_init();
+#endif
 	funGpioInitAll(); // no-op on ch5xx
 
 	usb_init();
@@ -125,12 +131,18 @@ int main(void) {
 	mp_init();
 	mp_hal_stdout_tx_strn("Booting MicroPython\r\n", 21);
 
+#if MICROPY_VFS
+	ch32fun_vfs_mount();
+#endif
+
 	while(1) {
 		micropython_task();
 	}
 }
 
 
+#if !MICROPY_VFS
+// without a filesystem there is nothing to import from, the VFS provides these otherwise
 mp_lexer_t *mp_lexer_new_from_file(qstr filename) {
 	mp_raise_OSError(MP_ENOENT);
 }
@@ -138,6 +150,7 @@ mp_lexer_t *mp_lexer_new_from_file(qstr filename) {
 mp_import_stat_t mp_import_stat(const char *path) {
 	return MP_IMPORT_STAT_NO_EXIST;
 }
+#endif
 
 void nlr_jump_fail(void *val) {
 	while (1);
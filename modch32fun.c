@@ -12,6 +12,23 @@ void ch32fun_check_addr(uintptr_t addr, size_t len, uintptr_t start, uintptr_t e
 	}
 }
 
+// zlib compatible CRC-32, nibble table to keep it small
+uint32_t ch32fun_crc32(uint32_t crc, const void *buf, size_t len) {
+	static const uint32_t table[16] = {
+		0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+		0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+	};
+	const uint8_t *p = buf;
+
+	crc = ~crc;
+	for (size_t i = 0; i < len; i++) {
+		crc ^= p[i];
+		crc = (crc >> 4) ^ table[crc & 0x0F];
+		crc = (crc >> 4) ^ table[crc & 0x0F];
+	}
+	return ~crc;
+}
+
 // ==========================================================================
 // RAM Accessor Object (ch32fun.RAM[])
 // ==========================================================================
@@ -100,8 +117,17 @@ static const mp_rom_map_elem_t ch32fun_module_globals_table[] = {
 	// These are external from other files
 	{ MP_ROM_QSTR(MP_QSTR_ch5xx),       MP_ROM_PTR(&ch32fun_ch5xx_obj) },
 	{ MP_ROM_QSTR(MP_QSTR_ch5xx_flash), MP_ROM_PTR(&ch32fun_flash_type) },
+	{ MP_ROM_QSTR(MP_QSTR_Flash),       MP_ROM_PTR(&ch32fun_flash_bdev_type) },
 	{ MP_ROM_QSTR(MP_QSTR_iSLER),       MP_ROM_PTR(&ch32fun_isler_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_Link),        MP_ROM_PTR(&ch32fun_link_type) },
+	{ MP_ROM_QSTR(MP_QSTR_timesync),    MP_ROM_PTR(&ch32fun_timesync_type) },
+	{ MP_ROM_QSTR(MP_QSTR_synctime_us), MP_ROM_PTR(&ch32fun_synctime_us_obj) },
+#if MICROPY_PY_CH32FUN_CONN
+	{ MP_ROM_QSTR(MP_QSTR_Conn),        MP_ROM_PTR(&ch32fun_conn_type) },
+#endif
 	{ MP_ROM_QSTR(MP_QSTR_NFC),         MP_ROM_PTR(&ch32fun_nfc_type) },
+	{ MP_ROM_QSTR(MP_QSTR_kv),          MP_ROM_PTR(&ch32fun_kv_type) },
+	{ MP_ROM_QSTR(MP_QSTR_update),      MP_ROM_PTR(&ch32fun_update_type) },
 };
 static MP_DEFINE_CONST_DICT(ch32fun_module_globals, ch32fun_module_globals_table);
 
@@ -18,11 +18,117 @@
 #define FLASH_SIZE     RAM_START // not the real size, but we might want to poke beyond what the DS says
 #define FLASH_END      (FLASH_START + FLASH_SIZE)
 
+// Erase granularity of the code flash, and what an erased word reads back as
+#define FLASH_SECTOR_SIZE  4096
+#ifdef CH5xx
+#define FLASH_ERASED_WORD  0xFFFFFFFF
+#else
+#define FLASH_ERASED_WORD  0xE339E339 // ch32v20x/30x quirk
+#endif
+
+// End of the code flash, persistent storage is carved off the top of it
+#if defined(CH570_CH572)
+#define FLASH_CODE_END     (240 * 1024)
+#elif defined(CH5xx)
+#define FLASH_CODE_END     (448 * 1024)
+#else
+#define FLASH_CODE_END     (128 * 1024)
+#endif
+
+// End of the firmware image in the code flash, from the ch32fun linker script.
+// Nothing below may be placed under it, ch32fun_layout.ld checks that at link
+// time against ch32fun_storage_start (ch32fun_ch5xx_flash.c).
+extern uint8_t _data_lma[], _data_vma[], _edata[];
+#define FLASH_IMAGE_END    ((uintptr_t)_data_lma + ((uintptr_t)_edata - (uintptr_t)_data_vma))
+
+// ch32fun.kv (ch32fun_kv.c)
+#define KV_FLASH_SECTORS   2
+#define KV_FLASH_END       FLASH_CODE_END
+#define KV_FLASH_START     (KV_FLASH_END - KV_FLASH_SECTORS * FLASH_SECTOR_SIZE)
+
+// ch32fun.Flash() block device holding the filesystem (ch32fun_ch5xx_flash.c)
+#if defined(CH570_CH572)
+#define VFS_FLASH_SIZE     (32 * 1024)
+#else
+#define VFS_FLASH_SIZE     (64 * 1024)
+#endif
+#define VFS_FLASH_END      KV_FLASH_START
+#define VFS_FLASH_START    (VFS_FLASH_END - VFS_FLASH_SIZE)
+
+// ch32fun.update (ch32fun_update.c): the swap scratch sector and the update
+// state sit right below the filesystem. The staging slot is placed above the
+// running image at begin(), its address is kept in the update state.
+#define UPDATE_TRAILER     (VFS_FLASH_START - FLASH_SECTOR_SIZE)
+#define UPDATE_SCRATCH     (UPDATE_TRAILER - FLASH_SECTOR_SIZE)
+#define UPDATE_SECTORS_MAX (UPDATE_SCRATCH / (2 * FLASH_SECTOR_SIZE))
+
 // ==========================================================================
 // Shared Helper Functions
 // ==========================================================================
 // Defined in modch32fun.c, used by ch32fun_flash.c
 void ch32fun_check_addr(uintptr_t addr, size_t len, uintptr_t start, uintptr_t end);
+uint32_t ch32fun_crc32(uint32_t crc, const void *buf, size_t len);
+
+// Defined in ch32fun_ch5xx_flash.c, addr and len must be word aligned
+CH32FUN_RAMFUNC int ch32fun_flash_erase(uint32_t addr, uint32_t len);
+CH32FUN_RAMFUNC int ch32fun_flash_program(uint32_t addr, const void *buf, uint32_t len);
+void ch32fun_vfs_mount(void);
+
+// Defined in ch32fun_update.c, finishes or rolls back an update, called first thing at boot
+CH32FUN_RAMFUNC void ch32fun_update_boot(void);
+
+// Defined in ch32fun_timer.c, one shot timers off the SysTick compare interrupt.
+// The callback runs in interrupt context and may restart its own timer.
+typedef struct _ch32fun_timer_t {
+	struct _ch32fun_timer_t *next;
+	uint32_t deadline; // SysTick ticks
+	void (*callback)(struct _ch32fun_timer_t *timer);
+} ch32fun_timer_t;
+
+void ch32fun_timer_start(ch32fun_timer_t *timer, uint32_t delay_us);
+void ch32fun_timer_stop(ch32fun_timer_t *timer);
+
+// Defined in ch32fun_isler.c, raw radio access for protocols on top of iSLER.
+// RX hooks run in the RF interrupt and see every frame first, returning 1
+// consumes the frame. Received frames are [header, len, payload...], a hook
+// checks with ch32fun_isler_rx_is() that they arrived on its own RX, and
+// ch32fun_isler_rx_ticks() is the SysTick stamp taken on entry to the ISR.
+// ch32fun_isler_resume() re-arms whatever RX (or scan) a TX interrupted.
+typedef int (*ch32fun_isler_hook_t)(const uint8_t *frame, size_t len);
+void ch32fun_isler_hook(ch32fun_isler_hook_t hook, int enable);
+void ch32fun_isler_rx(uint32_t access_addr, uint8_t channel, uint8_t phy_mode);
+void ch32fun_isler_rx_adv(uint8_t channel);
+int ch32fun_isler_rx_is(uint32_t access_addr, uint8_t channel);
+uint32_t ch32fun_isler_rx_ticks(void);
+void ch32fun_isler_resume(void);
+// Blocking, only for an answer due T_IFS after a frame, from its RX hook
+void ch32fun_isler_tx(uint32_t access_addr, const uint8_t *frame, size_t len, uint8_t channel, uint8_t phy_mode);
+void ch32fun_isler_crcinit(uint32_t crcinit);
+
+// Frames sent by the iSLER TX scheduler, from its lowest priority software
+// interrupt: never TX straight from SysTick or the RF interrupt, where a
+// blocking iSLERTX() holds off everything else and can land on top of the
+// scheduler's own TX. The owner leaves req and its frame alone until done
+// (may be NULL) runs in that interrupt, right after the frame is out. start
+// (may be NULL) runs just before iSLERTX(), for frames that carry a timestamp.
+typedef struct _ch32fun_isler_txreq_t {
+	struct _ch32fun_isler_txreq_t *next;
+	void (*start)(struct _ch32fun_isler_txreq_t *req);
+	void (*done)(struct _ch32fun_isler_txreq_t *req);
+	const uint8_t *frame;
+	uint32_t access_addr;
+	uint16_t len;
+	uint8_t channel;
+	uint8_t phy_mode;
+	volatile uint8_t queued;
+} ch32fun_isler_txreq_t;
+
+int ch32fun_isler_tx_queue(ch32fun_isler_txreq_t *req);
+void ch32fun_isler_tx_cancel(ch32fun_isler_txreq_t *req);
+extern const uint8_t ch32fun_isler_phy_1m;
+
+// Defined in ch32fun_sync.c, microseconds on the clock shared over timesync
+uint32_t ch32fun_synctime_us(void);
 
 // ==========================================================================
 // External Object/Type Declarations
@@ -33,10 +139,27 @@ extern const mp_obj_base_t ch32fun_ch5xx_obj; // The singleton instance
 
 // Defined in ch32fun_flash.c
 extern const mp_obj_type_t ch32fun_flash_type;
+extern const mp_obj_type_t ch32fun_flash_bdev_type;
 
 // Defined in ch32fun_isler.c
 extern const mp_obj_base_t ch32fun_isler_obj; // singleton
 
+// Defined in ch32fun_link.c
+extern const mp_obj_type_t ch32fun_link_type;
+
+// Defined in ch32fun_conn.c
+extern const mp_obj_type_t ch32fun_conn_type;
+
+// Defined in ch32fun_sync.c
+extern const mp_obj_type_t ch32fun_timesync_type;
+extern const mp_obj_fun_builtin_fixed_t ch32fun_synctime_us_obj;
+
+// Defined in ch32fun_kv.c
+extern const mp_obj_type_t ch32fun_kv_type;
+
+// Defined in ch32fun_update.c
+extern const mp_obj_type_t ch32fun_update_type;
+
 // Defined in ch32fun_nfc.c
 extern const mp_obj_type_t ch32fun_nfc_type;
 
@@ -1,6 +1,71 @@
 #include "py/runtime.h"
 #include "modmachine.h"
 
+// ==========================================================================
+// DMA Channel Ownership (see modmachine.h)
+// ==========================================================================
+#ifndef CH5xx
+#define MACHINE_DMA_CHANNELS 7
+
+static const void *machine_dma_owner[MACHINE_DMA_CHANNELS];
+
+static const void **machine_dma_slot(DMA_Channel_TypeDef *dma) {
+	uintptr_t stride = (uintptr_t)DMA1_Channel2 - (uintptr_t)DMA1_Channel1;
+	return &machine_dma_owner[((uintptr_t)dma - (uintptr_t)DMA1_Channel1) / stride];
+}
+
+bool machine_dma_claim(DMA_Channel_TypeDef *dma, const void *owner) {
+	const void **slot = machine_dma_slot(dma);
+	if (*slot != NULL && *slot != owner) {
+		return false;
+	}
+	*slot = owner;
+	return true;
+}
+
+void machine_dma_release(DMA_Channel_TypeDef *dma, const void *owner) {
+	const void **slot = machine_dma_slot(dma);
+	if (*slot == owner) {
+		*slot = NULL;
+	}
+}
+
+// ==========================================================================
+// Bus Clocks (see modmachine.h)
+// ==========================================================================
+
+// PPREx codes 0-3 pass HCLK through, 4-7 divide by 2, 4, 8 and 16. HPRE stays at /1
+static uint32_t machine_apb_clock(uint32_t ppre) {
+	uint32_t clock = FUNCONF_SYSTEM_CORE_CLOCK;
+	if (ppre & 4) {
+		clock >>= (ppre & 3) + 1;
+	}
+	return clock;
+}
+
+uint32_t machine_pclk1(void) {
+	return machine_apb_clock((RCC->CFGR0 & RCC_PPRE1) >> 8);
+}
+
+uint32_t machine_pclk2(void) {
+	return machine_apb_clock((RCC->CFGR0 & RCC_PPRE2) >> 11);
+}
+
+// TIM1 is on APB2, the others on APB1
+uint32_t machine_timer_clock(const TIM_TypeDef *tim) {
+	uint32_t ppre = (tim == TIM1) ? (RCC->CFGR0 & RCC_PPRE2) >> 11 : (RCC->CFGR0 & RCC_PPRE1) >> 8;
+	return machine_apb_clock(ppre) * ((ppre & 4) ? 2 : 1);
+}
+
+// Called once at boot, before any driver looks at the bus clocks. The ADC
+// clock is PCLK2 / 8 at most and may not go above 14 MHz
+void machine_clock_init(void) {
+	if (machine_pclk2() / 8 > 14000000) {
+		RCC->CFGR0 = (RCC->CFGR0 & ~RCC_PPRE2) | RCC_PPRE2_DIV2;
+	}
+}
+#endif
+
 // ==========================================================================
 // Machine Module Definition
 // ==========================================================================
@@ -9,12 +74,21 @@ static const mp_rom_map_elem_t machine_module_globals_table[] = {
 	{ MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_machine) },
 
 	// Add the Pin class from machine_pin.c
-	{ MP_ROM_QSTR(MP_QSTR_Pin),      MP_ROM_PTR(&machine_pin_type) },
-	{ MP_ROM_QSTR(MP_QSTR_Signal),   MP_ROM_PTR(&machine_signal_type) },
-
-	// Later
-	// { MP_ROM_QSTR(MP_QSTR_ADC),   MP_ROM_PTR(&machine_adc_type) },
-	// { MP_ROM_QSTR(MP_QSTR_SPI),   MP_ROM_PTR(&machine_spi_type) },
+	{ MP_ROM_QSTR(MP_QSTR_Pin),       MP_ROM_PTR(&machine_pin_type) },
+	{ MP_ROM_QSTR(MP_QSTR_Signal),    MP_ROM_PTR(&machine_signal_type) },
+	{ MP_ROM_QSTR(MP_QSTR_PinGroup),  MP_ROM_PTR(&machine_pingroup_type) },
+	{ MP_ROM_QSTR(MP_QSTR_bitstream), MP_ROM_PTR(&machine_bitstream_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_time_pulse_us), MP_ROM_PTR(&machine_time_pulse_us_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_capture),   MP_ROM_PTR(&machine_capture_obj) },
+	{ MP_ROM_QSTR(MP_QSTR_UART),      MP_ROM_PTR(&machine_uart_type) },
+	{ MP_ROM_QSTR(MP_QSTR_SPI),       MP_ROM_PTR(&machine_spi_type) },
+	{ MP_ROM_QSTR(MP_QSTR_I2C),       MP_ROM_PTR(&machine_i2c_type) },
+#if MACHINE_HAS_ADC
+	{ MP_ROM_QSTR(MP_QSTR_ADC),       MP_ROM_PTR(&machine_adc_type) },
+#endif
+#if MACHINE_HAS_PWM
+	{ MP_ROM_QSTR(MP_QSTR_PWM),       MP_ROM_PTR(&machine_pwm_type) },
+#endif
 };
 static MP_DEFINE_CONST_DICT(machine_module_globals, machine_module_globals_table);
 
@@ -4,12 +4,96 @@
 #include "py/obj.h"
 #include "ch32fun.h"
 
+#ifdef CH5xx
+// R32_Px_DIR, _PIN, _OUT, _CLR, _PU and _PD_DRV sit in a row for every port
+typedef struct {
+	vu32 DIR;
+	vu32 PIN;
+	vu32 OUT;
+	vu32 CLR;
+	vu32 PU;
+	vu32 PD_DRV;
+} machine_pin_port_t;
+#else
+typedef GPIO_TypeDef machine_pin_port_t;
+#endif
+
+// Peripherals that not every CH5xx has
+#if !defined(CH5xx) || defined(R8_ADC_CFG)
+#define MACHINE_HAS_ADC (1)
+#else
+#define MACHINE_HAS_ADC (0)
+#endif
+#if !defined(CH5xx) || defined(R8_PWM_OUT_EN)
+#define MACHINE_HAS_PWM (1)
+#else
+#define MACHINE_HAS_PWM (0)
+#endif
+
+#ifndef CH5xx
+// Every DMA1 channel serves several peripherals (USART RX, SPI, timer
+// updates, ...). A driver claims a channel for as long as it uses it, owner
+// being its peripheral's registers. Defined in modmachine.c, claiming
+// returns false if someone else holds the channel.
+bool machine_dma_claim(DMA_Channel_TypeDef *dma, const void *owner);
+void machine_dma_release(DMA_Channel_TypeDef *dma, const void *owner);
+
+// APB1 and APB2 clocks as the prescalers in RCC->CFGR0 are set, ch32fun's
+// SystemInit() runs APB1 at HCLK / 2 and machine_clock_init() takes APB2
+// down to HCLK / 2 where the ADC needs it. A timer runs at twice its bus
+// clock when that bus is divided. Defined in modmachine.c
+void machine_clock_init(void);
+uint32_t machine_pclk1(void);
+uint32_t machine_pclk2(void);
+uint32_t machine_timer_clock(const TIM_TypeDef *tim);
+#endif
+
+// Pins are constant objects in flash, one per pin in ch32fun_pinobjs.h
 typedef struct _machine_pin_obj_t {
 	mp_obj_base_t base;
-	uint32_t pin_id; 
+	uint32_t pin_id; // ch32fun pin number, as in funDigitalWrite()
+	machine_pin_port_t *port;
+	uint32_t mask;
 } machine_pin_obj_t;
 
+// Direct register access, no pin decoding
+static inline void machine_pin_high(const machine_pin_obj_t *pin) {
+#ifdef CH5xx
+	pin->port->OUT |= pin->mask;
+#else
+	pin->port->BSHR = pin->mask;
+#endif
+}
+
+static inline void machine_pin_low(const machine_pin_obj_t *pin) {
+#ifdef CH5xx
+	pin->port->CLR = pin->mask;
+#else
+	pin->port->BCR = pin->mask;
+#endif
+}
+
+static inline int machine_pin_read(const machine_pin_obj_t *pin) {
+#ifdef CH5xx
+	return (pin->port->PIN & pin->mask) != 0;
+#else
+	return (pin->port->INDR & pin->mask) != 0;
+#endif
+}
+
+// Pin object for a Pin or a pin number, raises ValueError for anything else
+const machine_pin_obj_t *machine_pin_find(mp_obj_t pin);
+
 extern const mp_obj_type_t machine_pin_type;
 extern const mp_obj_type_t machine_signal_type;
+extern const mp_obj_type_t machine_pingroup_type;
+extern const mp_obj_type_t machine_uart_type;
+extern const mp_obj_type_t machine_spi_type;
+extern const mp_obj_type_t machine_i2c_type;
+extern const mp_obj_type_t machine_adc_type;
+extern const mp_obj_type_t machine_pwm_type;
+extern const mp_obj_fun_builtin_var_t machine_bitstream_obj;
+extern const mp_obj_fun_builtin_var_t machine_time_pulse_us_obj;
+extern const mp_obj_fun_builtin_var_t machine_capture_obj;
 
 #endif // MICROPY_INCLUDED_WCH_MODMACHINE_H
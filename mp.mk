@@ -6,6 +6,7 @@ MODULEDEFS_HEADER = $(GENHDR_DIR)/moduledefs.h
 QSTR_GENERATED_HEADER = $(GENHDR_DIR)/qstrdefs.generated.h
 HWDEF_HEADERS = $(GENHDR_DIR)/ch32fun_hwdefs.collected
 PINDEF_HEADER = $(GENHDR_DIR)/ch32fun_pindefs.h
+PINOBJ_HEADER = $(GENHDR_DIR)/ch32fun_pinobjs.h
 REGDEF_HEADER = $(GENHDR_DIR)/ch32fun_regdefs.h
 ISLERDEF_HEADER = $(GENHDR_DIR)/ch32fun_islerdefs.h
 ISLERREG_HEADER = $(GENHDR_DIR)/ch32fun_islerregs.h
@@ -13,6 +14,7 @@ ISLERREG_HEADER = $(GENHDR_DIR)/ch32fun_islerregs.h
 $(GENHDR_DIR):
 	mkdir -p $@
 	touch $(PINDEF_HEADER)
+	touch $(PINOBJ_HEADER)
 	touch $(REGDEF_HEADER)
 	touch $(ISLERDEF_HEADER)
 	touch $(ISLERREG_HEADER)
@@ -33,10 +35,11 @@ $(ROOT_POINTERS_HEADER): $(MICROPYTHON_SRC) | $(GENHDR_DIR)
 		$(GENHDR_DIR)/root_pointers.collected > $@
 
 $(HWDEF_HEADERS): | $(GENHDR_DIR)
-	@echo "  GEN: ch32fun_{pin,reg}defs.h"
+	@echo "  GEN: ch32fun_{pin,reg}defs.h, ch32fun_pinobjs.h"
 	$(PREFIX)-gcc -E -dM -DNO_QSTR $(CFLAGS) ./*.c > $@
 
-	sed 's/.*define \(P[ABCD][0-9]\{1,2\}\).*/{ MP_ROM_QSTR(MP_QSTR_\1),   MP_ROM_INT(\1) },/;t;d' $@ |sort|uniq > $(PINDEF_HEADER)
+	sed 's/.*define \(P[ABCD][0-9]\{1,2\}\).*/PIN_OBJ(\1)/;t;d' $@ |sort|uniq > $(PINOBJ_HEADER)
+	sed 's/PIN_OBJ(\(.*\))/\1/' $(PINOBJ_HEADER) |awk '{ printf "{ MP_ROM_QSTR(MP_QSTR_%s),   MP_ROM_PTR(&machine_pin_obj_table[%d]) },\n", $$1, NR - 1 }' > $(PINDEF_HEADER)
 	sed 's/.*define \(R[0-9]\{1,2\}_.* \).*vu\([0-9]\{1,2\}\).*/{ MP_QSTR_\1, (uintptr_t)\&\1, W\2 },/;t;d' $@ |sort|uniq > $(REGDEF_HEADER)
 	sed 's/.*define \(LL_TX_POWER.* \).*/{ MP_ROM_QSTR(MP_QSTR_\1), MP_ROM_INT(\1) },/;t;d' $@ |sort|uniq > $(ISLERDEF_HEADER)
 	sed 's/\tvolatile uint32_t \(..\)\([0-9]\{1,2\}\).*/{ MP_QSTR_\1_\1\2, (uintptr_t)\&\1->\1\2, W32 },/;t;d' $(CH32FUN_PATH)/extralibs/iSLER.h $@ > $(ISLERREG_HEADER)
@@ -57,12 +57,23 @@
 #define MICROPY_PY_TIME_TIME_NS             (0)
 #define MICROPY_PY_MATH                     (0) // requires -lm
 #define MICROPY_PY_CMATH                    (0) // requires -lm
-#define MICROPY_PY_IO                       (0) // Use print() but no file objects
+#define MICROPY_PY_IO                       (1) // file objects for the VFS
 #define MICROPY_PY_STRUCT                   (1)
 #define MICROPY_PY_ARRAY                    (1)
 #define MICROPY_PY_BINASCII                 (1)
 #define MICROPY_CPYTHON_COMPAT              (1)
 
+// Filesystem: littlefs2 on internal flash (ch32fun.Flash), mounted at / on boot
+#define MICROPY_VFS                         (1)
+#define MICROPY_VFS_LFS2                    (1)
+#define MICROPY_READER_VFS                  (1)
+#define MICROPY_PY_OS                       (1)
+
+// ch32fun.Conn, BLE peripheral link layer, -DMICROPY_PY_CH32FUN_CONN=0 leaves it out
+#ifndef MICROPY_PY_CH32FUN_CONN
+#define MICROPY_PY_CH32FUN_CONN             (1)
+#endif
+
 // Shrink Internal Structures
 #define MICROPY_ALLOC_PATH_MAX              (32)
 #define MICROPY_QSTR_BYTES_IN_HASH          (1)
@@ -84,6 +95,14 @@ typedef long mp_off_t;
 
 #define MP_STATE_PORT                       MP_STATE_VM
 
+// Code run from RAM: timing critical loops, clear of flash wait states, and
+// whatever has to keep running while the code flash is rewritten
+#ifdef CH5xx
+#define CH32FUN_RAMFUNC                     __HIGH_CODE
+#else
+#define CH32FUN_RAMFUNC                     __attribute__((section(".data"), noinline))
+#endif
+
 
 void mp_hal_background_processing(void);
 #define MICROPY_VM_HOOK_LOOP \
@@ -92,7 +111,13 @@ void mp_hal_background_processing(void);
 	} while(0);
 
 
+#if MICROPY_VFS
+// use the VFS for import and builtin open
+#define mp_import_stat mp_vfs_import_stat
+#define mp_builtin_open_obj mp_vfs_open_obj
+#else
 extern const struct _mp_obj_fun_builtin_var_t mp_builtin_open_obj; // for open('main.py').read()
 
 #define MICROPY_PORT_BUILTINS \
 	{ MP_ROM_QSTR(MP_QSTR_open), MP_ROM_PTR(&mp_builtin_open_obj) },
+#endif
@@ -38,6 +38,8 @@ void execute_main_py(void) {
 	}
 }
 
+#if !MICROPY_VFS
+// Without a filesystem, open() only knows the main.py on the USB RAM disk
 // --- 1. The RamFile Object ---
 typedef struct _ram_file_obj_t {
 	mp_obj_base_t base;
@@ -107,3 +109,4 @@ mp_obj_t mp_builtin_open(size_t n_args, const mp_obj_t *args, mp_map_t *kwargs)
 	return mp_const_none;
 }
 MP_DEFINE_CONST_FUN_OBJ_KW(mp_builtin_open_obj, 1, mp_builtin_open);
+#endif
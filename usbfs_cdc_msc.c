@@ -145,8 +145,8 @@ volatile uint32_t msc_current_offset = 0;
 volatile uint32_t msc_bytes_remaining = 0;
 
 
-#if !defined(FUNCONF_USE_DEBUGPRINTF) || !FUNCONF_USE_DEBUGPRINTF
-int _write(int fd, const char *buf, int size) {
+// Raw CDC output, independent of where printf goes
+int usb_cdc_write(const uint8_t *buf, int size) {
 	if(USBFS_SendEndpointNEW(EP_CDC_IN, (uint8_t*)buf, size, /*copy*/1) == -1) { // -1 == busy
 		// wait for 1ms to try again once more
 		Delay_Ms(1);
@@ -155,13 +155,18 @@ int _write(int fd, const char *buf, int size) {
 	return size;
 }
 
+// When set, CDC OUT data goes here straight from the IRQ instead of to the
+// REPL (used by ch32fun.update to stream firmware images)
+void (*volatile usb_cdc_rx_sink)(const uint8_t *data, int len);
+
+#if !defined(FUNCONF_USE_DEBUGPRINTF) || !FUNCONF_USE_DEBUGPRINTF
+int _write(int fd, const char *buf, int size) {
+	return usb_cdc_write((const uint8_t*)buf, size);
+}
+
 int putchar(int c) {
 	uint8_t single = c;
-	if(USBFS_SendEndpointNEW(EP_CDC_IN, &single, 1, /*copy*/1) == -1) { // -1 == busy
-		// wait for 1ms to try again once more
-		Delay_Ms(1);
-		USBFS_SendEndpointNEW(EP_CDC_IN, &single, 1, /*copy*/1);
-	}
+	usb_cdc_write(&single, 1);
 	return 1;
 }
 #endif
@@ -391,6 +396,9 @@ void HandleDataOut(struct _USBState *ctx, int endp, uint8_t *data, int len) {
 	if (endp == 0) {
 		ctx->USBFS_SetupReqLen = 0;
 	}
+	else if( endp == EP_CDC_OUT && usb_cdc_rx_sink ) {
+		usb_cdc_rx_sink(data, len);
+	}
 	else if( endp == EP_CDC_OUT ) {
 		// cdc tty input
 		// discard oldest if polling is too slow